@@ -0,0 +1,33 @@
+/**
+ * RoseCompass Puzzle Controller
+ * Alchemy Escape Rooms - Watchtower Protocol
+ *
+ * Hardware: ESP32-S3 + Potentiometer (signal on GPIO 4)
+ * Puzzle: Rotate compass to SE (Southeast / 135 degrees) to solve
+ *
+ * This prop's settings for the shared firmware (lib/CompassFirmware),
+ * which includes this file after its defaults and CompassConfig.
+ */
+
+#pragma once
+
+// Device Identity
+const char* DEVICE_NAME = "RoseCompass";
+
+// Hardware Pins
+const int POT_PIN = 4;  // Potentiometer signal on GPIO 4
+
+// Compass Configuration
+const int TARGET_DIRECTION = 135;  // SE = 135 degrees
+const char* TARGET_NAME = "SE";
+
+// Solve output wiring
+const int SOLVE_OUTPUT_PIN = -1;  // -1 = no output
+const bool SOLVE_OUTPUT_ACTIVE_HIGH = true;
+
+// Add rows to run compasses that sit together off this board (one WiFi
+// client, one broker session)
+const CompassConfig COMPASSES[] = {
+    { DEVICE_NAME, POT_PIN, TARGET_DIRECTION, TARGET_NAME, DIRECTION_TOLERANCE, FILTER_ALPHA, TRACKER_BETA, SOLVE_OUTPUT_PIN },
+    // { "SecondCompass", 5, 180, "S", 10, 128, 32, -1 },
+};
@@ -0,0 +1,4059 @@
+/**
+ * Compass Puzzle Controller
+ * Alchemy Escape Rooms - Watchtower Protocol
+ * Version: 1.0.0
+ *
+ * Firmware shared by the compass props (BlueCompass, RoseCompass,
+ * SilverCompass). Hardware: ESP32-S3 + one potentiometer per compass.
+ * Each PlatformIO project supplies config/PropConfig.h (its name, target
+ * and wiring) and calls compassSetup()/compassLoop().
+ */
+
+#include <stdarg.h>
+#include <WiFi.h>
+#include <PubSubClient.h>
+#include <Preferences.h>
+#include <LittleFS.h>
+#include <esp_adc/adc_continuous.h>
+#include <esp_adc/adc_monitor.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <esp_rom_crc.h>
+#include <esp_heap_caps.h>
+#include <esp_dsp.h>
+#include <driver/gpio.h>
+#include <driver/gptimer.h>
+#include <xtensa_context.h>
+#include <time.h>
+#include <CompassPipeline.h>  // Shared with the host tools (tools/)
+#include "CompassFirmware.h"
+
+// ============================================
+// CONFIGURATION
+// ============================================
+
+// Device Identity
+#define FIRMWARE_VERSION "1.0.0"
+const char* ROOM_NAME = "MermaidsTale";
+const char* VERSION = FIRMWARE_VERSION;
+
+// WiFi Configuration
+const char* WIFI_SSID = "AlchemyGuest";
+const char* WIFI_PASSWORD = "VoodooVacation5601";
+
+// MQTT Broker (Watchtower)
+const char* MQTT_BROKER = "10.1.10.115";
+const int MQTT_PORT = 1883;
+
+// Clock for command expiry (exp=); commands carrying exp= are held until it
+// syncs, since that's exactly when queued stale commands arrive
+const char* NTP_SERVER = "pool.ntp.org";
+const time_t CLOCK_VALID_AFTER = 1700000000;  // Anything earlier = not synced
+
+// Tuned for this prop from recorded sessions by tools/compass_tune, if
+// the project has config/tuning.h; otherwise the hand-picked values below
+#if __has_include("tuning.h")
+#include "tuning.h"
+#endif
+#ifndef TUNED_DIRECTION_TOLERANCE
+#define TUNED_DIRECTION_TOLERANCE 10
+#endif
+#ifndef TUNED_ANGLE_CHANGE_THRESHOLD
+#define TUNED_ANGLE_CHANGE_THRESHOLD 2
+#endif
+#ifndef TUNED_DEBOUNCE_TIME
+#define TUNED_DEBOUNCE_TIME 500
+#endif
+#ifndef TUNED_FILTER_ALPHA
+#define TUNED_FILTER_ALPHA 128
+#endif
+#ifndef TUNED_TRACKER_BETA
+#define TUNED_TRACKER_BETA 32
+#endif
+
+// Compass Configuration
+const int DIRECTION_TOLERANCE = TUNED_DIRECTION_TOLERANCE;  // +/- degrees for valid position (default)
+const int ANGLE_CHANGE_THRESHOLD = TUNED_ANGLE_CHANGE_THRESHOLD;  // Minimum change to report (default)
+const int FILTER_ALPHA = TUNED_FILTER_ALPHA;  // Angle tracker position gain /256
+const int TRACKER_BETA = TUNED_TRACKER_BETA;  // Angle tracker velocity gain /256
+const int SETTLE_SPEED = 45;  // Degrees/s; a dwell needs the compass turning slower
+const bool SOLVE_CANDIDATES = true;  // "candidate"/"cancelled"/"triggered" on the solve topic
+const bool DEBUG_RAW_ADC = false;  // Print raw ADC readings that move by 10 or more
+
+// Solve output: a GPIO switched straight from the solve, for an effect that
+// must not wait on the network (relay, LED, maglock line). The pin and its
+// active level are wiring, set per prop in PropConfig.h
+const int SOLVE_OUTPUT_MODE = pipeline::OUTPUT_PULSE;  // 0 none, 1 pulse, 2 latch until PUZZLE_RESET (default)
+const int SOLVE_PULSE_MS = 500;  // Pulse length (default)
+
+// Multi-compass mode
+// Each COMPASSES row is one potentiometer and one Watchtower device with
+// its own MQTT topics. Pots must be on ADC1 (GPIO 1-10).
+struct CompassConfig {
+    const char* deviceName;
+    int potPin;
+    int targetDirection;
+    const char* targetName;
+    int tolerance;
+    int filterAlpha;
+    int trackerBeta;
+    int outputPin;  // Solve output GPIO, -1 for none
+};
+
+// This prop: DEVICE_NAME, pins, target and the COMPASSES table
+#include <PropConfig.h>
+const int COMPASS_COUNT = sizeof(COMPASSES) / sizeof(COMPASSES[0]);
+
+// Timing
+const unsigned long HEARTBEAT_INTERVAL = 300000;  // 5 minutes (default)
+const unsigned long LOOP_DELAY = 50;  // 20Hz update rate (default)
+const unsigned long DEBOUNCE_TIME = TUNED_DEBOUNCE_TIME;  // Debounce for puzzle solved (default)
+const unsigned long MQTT_POLL_INTERVAL = 10;  // Broker socket service
+const unsigned long MQTT_RETRY_INTERVAL = 2000;  // Reconnect backoff
+
+// ADC sampling (continuous mode, all pots scanned in one DMA sequence)
+const uint32_t ADC_SAMPLE_FREQ_HZ = 1000;  // Conversions per second, per pot
+const uint32_t ADC_CONVERSIONS_PER_FRAME = 10;  // Per pot, one DMA frame every 10ms
+const uint32_t ADC_POOL_FRAMES = 32;  // Frames the driver buffers between polls
+const uint32_t ADC_FRAME_BYTES = ADC_CONVERSIONS_PER_FRAME * COMPASS_COUNT * SOC_ADC_DIGI_RESULT_BYTES;
+
+// Mains hum: lighting dimmers couple 60 Hz and its harmonics into the pot
+// wiring. Conversions go through a decimating FIR (esp-dsp's S3 SIMD
+// kernel) whose window spans a whole number of mains cycles, which puts a
+// null on every harmonic. Its delay is that of the plain average it
+// replaces, and it doesn't depend on the sample rate. The taps and scaling
+// come from lib/CompassPipeline, whose scalar reference the host tools
+// replay conversion traces through.
+const uint32_t MAINS_HZ = 60;  // 50 in most of Europe
+const uint32_t FIR_WINDOW = pipeline::mainsWindow(ADC_SAMPLE_FREQ_HZ, MAINS_HZ);  // Conversions: 50 = 3 cycles at 60 Hz
+const uint32_t FIR_TAPS = pipeline::firTaps(FIR_WINDOW);
+const uint32_t FIR_DECIMATION = ADC_CONVERSIONS_PER_FRAME;  // One output per frame (100 Hz)
+static_assert(FIR_WINDOW >= 2 && FIR_TAPS <= pipeline::FIR_MAX_TAPS, "No short mains window at ADC_SAMPLE_FREQ_HZ");
+
+// Noise analysis (NOISE command)
+const uint32_t NOISE_POINTS = 1024;  // FFT size, about 1 s of conversions
+const int NOISE_PEAKS = 5;  // Strongest spectral peaks reported
+const int NOISE_BANDS = 16;  // Coarse spectrum, equal-width bands up to Nyquist
+
+// Sampling profiler (PROFILE command): a hardware timer interrupts the
+// loop's core and counts the program counter it landed on. PCs are counted
+// as they are; compass_profile maps them to functions with the firmware ELF
+const uint32_t PROFILE_DEFAULT_HZ = 997;  // Prime, so it doesn't beat with the 1ms tick
+const uint32_t PROFILE_MAX_HZ = 10000;
+const uint32_t PROFILE_SLOTS = 1024;  // Distinct PCs, power of two (8KB)
+const int PROFILE_PROBES = 8;  // Buckets tried before a sample is dropped
+const uint8_t PROFILE_FORMAT_VERSION = 1;
+
+// Motion-aware sampling: "loop" is the sample period while the prop is in
+// play. A fast spin switches to SAMPLE_FAST_MS, and once every compass has
+// been left alone for IDLE_AFTER_MS the board drops to SAMPLE_IDLE_MS. The
+// ADC scan itself stays at ADC_SAMPLE_FREQ_HZ, which the mains filter needs
+const unsigned long SAMPLE_FAST_MS = 10;  // Every FIR output (100Hz)
+const unsigned long SAMPLE_IDLE_MS = 250;  // 4Hz
+const int MOTION_DEGREES = 3;  // Net movement that counts as a touch
+const int FAST_DEGREES_PER_S = 90;  // Spin speed that switches to fast sampling
+const unsigned long FAST_HOLD_MS = 1000;  // Stay fast this long after the last spin
+const unsigned long IDLE_AFTER_MS = 10000;  // Untouched this long goes idle
+static_assert(SAMPLE_IDLE_MS * ADC_SAMPLE_FREQ_HZ / 1000 < ADC_POOL_FRAMES * ADC_CONVERSIONS_PER_FRAME,
+    "Idle sample period overflows the ADC pool");
+
+// Target-window wakeup (ADC digital monitor)
+// The S3 has two threshold monitors, which together cover one compass: the
+// first row in COMPASSES. Others are detected by polling only.
+const int MONITOR_SETTLE_SAMPLES = 2;  // Filter catch-up after a monitor entry
+const unsigned long MONITOR_HOLDOFF_MS = 1000;  // Re-arm delay after a hit the samples didn't confirm
+
+// Soak mode (pio run -e soak)
+// Runs the clock SOAK_CLOCK_SCALE times fast from SOAK_CLOCK_OFFSET_US and
+// drives the firmware with synthetic pot motion, random broker disconnects
+// and random commands, so weeks of uptime can be covered in hours
+#ifndef SOAK_MODE
+#define SOAK_MODE 0
+#endif
+#ifndef SOAK_CLOCK_SCALE
+#define SOAK_CLOCK_SCALE 1
+#endif
+#ifndef SOAK_CLOCK_OFFSET_US
+#define SOAK_CLOCK_OFFSET_US 0
+#endif
+const unsigned long SOAK_REPORT_INTERVAL = 3600000;  // Health report every virtual hour
+
+// Event trace (TRACE command): when the loop's MQTT, sampling, publish and
+// command work ran, for viewing in Perfetto or chrome://tracing once
+// compass_timeline has converted the dump. Build with -DTRACE_EVENTS=0 to
+// compile the trace points out
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS 1
+#endif
+const uint32_t TRACE_PSRAM_EVENTS = 16384;  // Power of two, 8 bytes each
+const uint32_t TRACE_INTERNAL_EVENTS = 1024;  // Without PSRAM
+const uint8_t TRACE_FORMAT_VERSION = 1;
+
+#if TRACE_EVENTS
+#define TRACE_BEGIN(id, arg) traceEvent('B', (id), (arg))
+#define TRACE_END(id, arg) traceEvent('E', (id), (arg))
+#define TRACE_INSTANT(id, arg) traceEvent('i', (id), (arg))
+#else
+#define TRACE_BEGIN(id, arg) ((void)0)
+#define TRACE_END(id, arg) ((void)0)
+#define TRACE_INSTANT(id, arg) ((void)0)
+#endif
+
+// ============================================
+// COMPASS STATE
+// ============================================
+
+// One averaged potentiometer reading, stamped with the time of its last
+// conversion on the 64-bit microsecond clock
+struct RawSample {
+    int64_t timestampUs;
+    int raw;
+};
+
+struct AngleSample {
+    int64_t timestampUs;
+    int raw;
+    int angle;
+    int32_t velocity;  // Tracker units, Q8 ADC counts per sample
+    int degreesPerS;
+};
+
+const int SAMPLE_QUEUE_LENGTH = 16;  // Samples buffered between loops
+
+// Angle history: every direction report and every puzzle transition, kept
+// in a ring per compass (in PSRAM when the board has it) for the HISTORY
+// dump. Reports are capped at one per REPORT_MIN_US whatever the sample rate
+const unsigned long HISTORY_MINUTES = 10;  // Sized for a pot that never stops moving
+const uint32_t HISTORY_PSRAM_ENTRIES = HISTORY_MINUTES * 60 * 1000000 / pipeline::REPORT_MIN_US;  // 240KB per compass
+const uint32_t HISTORY_INTERNAL_ENTRIES = 2048;  // Without PSRAM, 16KB per compass
+const uint8_t HISTORY_FORMAT_VERSION = 1;
+
+enum HistoryKind : uint8_t {
+    HISTORY_ANGLE,
+    HISTORY_DWELL_START,
+    HISTORY_DWELL_CANCEL,
+    HISTORY_SOLVED,
+    HISTORY_PUZZLE_RESET,
+    HISTORY_BOOT
+};
+
+struct HistoryEntry {
+    uint32_t timeMs;  // Low 32 bits of the millisecond clock
+    int16_t angle;
+    uint8_t kind;  // HistoryKind
+    uint8_t reserved;
+};
+
+// Event trace: begin/end/instant events stamped with the low 32 bits of
+// the microsecond clock, in a ring written only by the loop. Commands are
+// traced under their own names, with ids from TRACE_COMMANDS on
+enum TraceId : uint8_t {
+    TRACE_MQTT_LOOP,
+    TRACE_RECONNECT,
+    TRACE_READ_ANGLE,
+    TRACE_PUBLISH,
+    TRACE_SOLVED,
+    TRACE_COMMANDS
+};
+const char* const TRACE_NAMES[] = { "mqtt.loop", "reconnect", "readAngle", "publish", "solved" };
+
+struct TraceEvent {
+    uint32_t timeUs;
+    uint8_t phase;  // 'B', 'E' or 'i', as in the Chrome trace format
+    uint8_t id;  // TraceId
+    uint16_t arg;  // Compass index, or payload bytes for a publish
+};
+
+// Session log: one record per game (PUZZLE_RESET to solve) in a ring of
+// fixed-size segment files on LittleFS. Records are appended by a writer
+// task in batches, and a full segment moves the log on to the next file,
+// truncating the oldest, so each flash page is rewritten once per lap
+const char* SESSION_DIR = "/sessions";
+const int SESSION_SEGMENTS = 8;
+const int SESSION_SEGMENT_RECORDS = 256;  // 4KB segments, 2048 sessions in all
+const int SESSION_QUEUE_LENGTH = 16;
+const int SESSION_BATCH_RECORDS = 8;
+const unsigned long SESSION_FLUSH_DELAY = 60000;  // Longest a record waits in RAM
+const uint8_t SESSION_FORMAT_VERSION = 1;
+
+enum SessionOutcome : uint8_t {
+    SESSION_FLUSH,  // Queue marker: write out what's batched
+    SESSION_SOLVED,
+    SESSION_ABANDONED  // PUZZLE_RESET before a solve
+};
+
+struct SessionRecord {
+    uint32_t sequence;  // Numbers every record in the log
+    uint32_t startTime;  // Unix seconds, 0 if the clock wasn't synced
+    uint32_t durationMs;
+    uint8_t compass;  // Index into COMPASSES
+    uint8_t outcome;  // SessionOutcome
+    uint16_t reserved;
+};
+
+// A QoS 0 PUBLISH packet for one fixed topic, serialized once: the topic
+// and a fixed payload prefix are stored after room for the fixed header,
+// and only the variable end of the payload is written per message
+const int PACKET_HEADER_RESERVE = 5;  // Packet type + up to 4 length bytes
+const int PACKET_TEMPLATE_BYTES = 224;
+const size_t DIRECTION_VARIABLE_MAX = 11;  // "{angle}", one int32
+const size_t VELOCITY_VARIABLE_MAX = 11;  // "{degrees/s}", one int32
+const size_t HEARTBEAT_VARIABLE_MAX = 71;  // "YES | Direction:NW | Angle:..." + uint64 uptime + NUL
+
+struct PacketTemplate {
+    uint8_t buffer[PACKET_TEMPLATE_BYTES];
+    uint8_t headerByte;
+    uint16_t fixedLength;  // Topic length field, topic and payload prefix
+    uint16_t prefixLength;
+    uint16_t variableOffset;  // Where the variable payload starts, 0 = didn't fit
+    uint16_t variableMax;  // Longest variable payload there is room for
+};
+
+// A periodic or one-shot job owned by the scheduler's timer wheel
+struct TimerJob {
+    void (*run)(TimerJob& job);
+    void* context;
+    int64_t deadlineUs;
+    int64_t periodUs;  // 0 = one-shot
+    bool armed;
+    uint32_t slot;
+    TimerJob* prev;
+    TimerJob* next;
+    TimerJob* dueNext;  // Link in schedulerRun()'s list of jobs to fire
+};
+
+// Thresholds that can be changed at runtime with SET or the config topic.
+// They start from the compile-time defaults in CONFIGURATION
+struct CompassSettings {
+    int32_t tolerance;  // +/- degrees for valid position
+    int32_t angleThreshold;  // Minimum change to report
+    int32_t debounceMs;  // Dwell at target before solving
+    int32_t outputMode;  // pipeline::OutputMode
+    int32_t pulseMs;  // Solve output pulse length
+};
+
+// Commands arrive over a persistent session at QoS 1, so the broker holds
+// them while we are offline and may deliver one twice. A message can start
+// with id=<request id> (acknowledged on the status topic, duplicates
+// skipped) and exp=<unix time> (dropped if it arrives later than that)
+const int REQUEST_ID_LENGTH = 16;
+const int RECENT_REQUEST_SLOTS = 8;
+const int HELD_COMMAND_SLOTS = 4;  // exp= commands waiting for the clock
+const unsigned long HELD_COMMAND_MAX_MS = 60000;  // Then answered UNSYNCED
+const unsigned long HELD_COMMAND_POLL_MS = 500;  // Clock check while holding
+const unsigned long RESTART_DELAY = 100;  // Lets the PUBACK for RESET go out
+const int MESSAGE_MAX_BYTES = 255;  // Longer command or config messages are rejected whole
+
+// Runtime settings shared by every compass on the board
+struct BoardSettings {
+    int32_t heartbeatMs;
+    int32_t loopDelayMs;  // Sampling period
+};
+
+// Sampling pace, set by the most active compass on the board
+enum SamplingMode {
+    SAMPLING_IDLE,  // SAMPLE_IDLE_MS
+    SAMPLING_ACTIVE,  // board.loopDelayMs
+    SAMPLING_FAST,  // SAMPLE_FAST_MS
+};
+const char* const SAMPLING_MODE_NAMES[] = { "idle", "active", "fast" };
+
+struct Compass {
+    const CompassConfig* config;
+    CompassSettings settings;
+
+    // Topics (MermaidsTale/{deviceName}/...)
+    char topicCommand[64];
+    char topicStatus[64];
+    char topicLog[64];
+    char topicDirection[64];
+    char topicVelocity[64];
+    char topicSolved[64];
+    char topicSolve[64];  // Solve stages, kept off the Solved topic
+    char topicConfig[64];
+    char topicHistory[64];
+    char topicSessions[64];
+    char topicProfile[64];
+    char topicTrace[64];
+    PacketTemplate directionPacket;  // "pre_" + angle
+    PacketTemplate velocityPacket;  // Degrees/s, no prefix
+    PacketTemplate heartbeatPacket;  // "ONLINE | {name} | v{version} | Solved:" + ...
+
+    // ADC channel, conversions accumulated towards the next sample and
+    // samples waiting for the loop
+    adc_channel_t adcChannel;
+    uint32_t conversionsSinceSample;
+
+    // Mains FIR: conversions are filtered in blocks of FIR_DECIMATION
+    fir_s16_t fir;
+    alignas(16) int16_t firCoeffs[FIR_TAPS];
+    alignas(16) int16_t firDelay[FIR_TAPS + 8];  // S3 kernel reads 8 past the end
+    int16_t firBlock[FIR_DECIMATION];
+    uint32_t firBlockCount;
+    bool firPrimed;
+    int firOutput;  // Latest filtered value, 0-4095
+    int64_t firOutputUs;
+
+    // NOISE capture in progress (NULL when idle)
+    int16_t* noiseRaw;
+    int16_t* noiseFiltered;  // FIR outputs over the same span
+    uint32_t noiseCount;
+    uint32_t noiseFilteredCount;
+    RawSample samples[SAMPLE_QUEUE_LENGTH];
+    uint32_t sampleHead;
+    uint32_t sampleTail;
+    int lastRawValue;
+    pipeline::Tracker tracker;
+    int filterAlpha;  // From the config row, range-checked
+
+    int64_t lastSampleUs;
+
+    // Motion tracking for the sampling mode
+    int restAngle;  // Where the compass last settled, -1 before the first sample
+    int64_t lastMotionUs;
+    int64_t lastFastUs;  // 0 = never spun fast
+
+    // Puzzle state
+    int currentAngle;
+    pipeline::ReportState report;  // Last direction report
+    pipeline::DwellState dwell;
+    bool puzzleWasSolved;
+    TimerJob dwellJob;  // Fires when the debounce time has elapsed
+    pipeline::OutputState output;
+    TimerJob outputJob;  // Ends a solve output pulse
+
+    // Current game, from PUZZLE_RESET
+    bool sessionActive;
+    int64_t sessionStartUs;
+    uint32_t sessionStartTime;
+    pipeline::SessionStats stats;
+
+    HistoryEntry* history;  // NULL if it couldn't be allocated
+    uint32_t historyCapacity;
+    uint32_t historyHead;  // Total entries ever written
+
+    // Request ids recently handled, so QoS 1 redeliveries run only once
+    // (kept in the warm snapshot, so a RESET doesn't forget them)
+    char recentRequests[RECENT_REQUEST_SLOTS][REQUEST_ID_LENGTH + 1];
+    uint32_t recentRequestHead;
+};
+
+// A command message carrying exp= that arrived before the clock synced. Its
+// age is judged once the clock is valid, from the time it arrived
+struct HeldCommand {
+    Compass* compass;  // NULL = free slot
+    char requestId[REQUEST_ID_LENGTH + 1];  // Empty = no id=
+    long long expiry;
+    int64_t receivedUs;
+    char commands[MESSAGE_MAX_BYTES + 1];
+};
+
+// ============================================
+// GLOBAL STATE
+// ============================================
+
+WiFiClient wifiClient;
+PubSubClient mqtt(wifiClient);
+adc_continuous_handle_t adcHandle = NULL;  // NULL = fall back to analogRead()
+
+// Completion time of each DMA frame, pushed by the ADC driver ISR and
+// consumed in order by pollADC()
+const uint32_t ADC_STAMP_SLOTS = 64;
+volatile int64_t adcFrameStamps[ADC_STAMP_SLOTS];
+volatile uint32_t adcStampHead = 0;
+uint32_t adcStampTail = 0;
+uint32_t adcFrameConversion = 0;  // Position of the next conversion in its frame
+int64_t adcFrameStampUs = 0;
+
+Compass compasses[COMPASS_COUNT];
+BoardSettings board = { HEARTBEAT_INTERVAL, LOOP_DELAY };
+SamplingMode samplingMode = SAMPLING_ACTIVE;
+int32_t samplePeriodMs = LOOP_DELAY;  // Period sampleJob runs at
+int32_t previousSamplePeriodMs = LOOP_DELAY;
+int64_t samplePeriodChangedUs = 0;
+Preferences preferences;
+
+// Hashed timer wheel: 1ms ticks, 256 slots. Jobs further out than one
+// revolution stay in their slot and are skipped until their deadline comes
+// round, so insert, cancel and fire are all O(1)
+const int64_t WHEEL_TICK_US = 1000;
+const uint32_t WHEEL_SLOTS = 256;  // Power of two
+TimerJob* wheel[WHEEL_SLOTS];
+int64_t wheelTick = -1;  // Last tick fully elapsed and processed
+TaskHandle_t loopTask = NULL;
+
+TimerJob mqttJob;
+TimerJob reconnectJob;
+TimerJob sampleJob;
+TimerJob heartbeatJob;
+TimerJob soakJob;
+TimerJob monitorJob;
+TimerJob restartJob;
+TimerJob heldJob;
+
+HeldCommand heldCommands[HELD_COMMAND_SLOTS];  // In arrival order
+int heldCount = 0;
+
+// Session log writer. The segment position and sequence belong to the
+// writer task once it's running; the lock covers the files themselves
+QueueHandle_t sessionQueue = NULL;
+SemaphoreHandle_t sessionLock = NULL;
+int sessionSegment = 0;
+int sessionSegmentRecords = 0;
+uint32_t sessionNextSequence = 0;
+uint32_t sessionDrops = 0;  // Records the queue had no room for
+
+TraceEvent* traceRing = NULL;
+uint32_t traceCapacity = 0;  // 0 = not tracing
+uint32_t traceHead = 0;  // Total events ever recorded
+
+// Monitors for the first compass: one fires when the raw value rises to the
+// target window's low edge, the other when it falls to the high edge. Only
+// the one(s) facing the current position are enabled, and neither while a
+// dwell is running, so they never fire continuously.
+adc_monitor_handle_t monitorFromBelow = NULL;
+adc_monitor_handle_t monitorFromAbove = NULL;
+bool monitorFromBelowOn = false;
+bool monitorFromAboveOn = false;
+volatile bool monitorTriggered = false;
+volatile int64_t monitorHitUs = 0;
+int64_t monitorRearmUs = 0;  // Monitors stay off until then
+
+// Long-uptime health: heap high-water and fragmentation, any timing
+// anomaly seen on the sample or loop clock, and network counters
+struct HealthStats {
+    uint32_t minFreeHeap;
+    uint32_t maxFragmentation;  // Percent of free heap not in the largest block
+    uint32_t clockFaults;  // Sample timestamps that did not advance
+    uint32_t sampleGaps;  // Samples late by more than 3 periods
+    uint32_t loopOverruns;  // Jobs fired more than 3 sample periods late
+    int64_t maxLoopUs;  // Longest busy pass between sleeps
+    uint64_t totalLoopUs;
+    uint32_t loopPasses;
+    uint32_t mqttConnects;
+    uint32_t publishDrops;  // Publishes the client refused or failed to send
+    uint32_t firMismatches;  // Boot self-test: kernel outputs off the reference
+};
+HealthStats health = { UINT32_MAX, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+// PC histogram, an open-addressed hash written only by the profiler ISR
+// while it runs
+struct ProfileSlot {
+    uint32_t pc;  // 0 = empty
+    uint32_t count;
+};
+
+struct Profiler {
+    gptimer_handle_t timer;  // Created by the first PROFILE START
+    ProfileSlot* slots;  // Internal RAM, so the ISR never waits on PSRAM
+    bool running;
+    uint32_t hz;
+    int64_t startUs;
+    int64_t stopUs;
+    uint32_t samples;
+    uint32_t inInterrupt;  // Ticks that interrupted another ISR
+    uint32_t dropped;  // Ticks with no free bucket
+};
+Profiler profiler = {};
+
+// Interrupt depth per core, kept by the FreeRTOS port
+extern "C" volatile unsigned port_interruptNesting[portNUM_PROCESSORS];
+
+// Zero-allocation message writer. Output goes through a small fixed chunk,
+// so a message can be rendered once to measure it for beginPublish() and
+// again to stream it into the MQTT client
+const int STREAM_CHUNK_BYTES = 64;
+
+struct StreamWriter {
+    bool streaming;  // false = measure only
+    size_t length;
+    size_t chunkUsed;
+    uint8_t chunk[STREAM_CHUNK_BYTES];
+};
+
+// Renders one message into out. publishStreamed() calls it twice, to
+// measure and then to stream, so both passes must write the same bytes
+typedef void (*StreamRender)(StreamWriter& out, const void* context);
+
+struct JsonWriter {
+    StreamWriter* out;
+    bool firstField;
+};
+
+// Result of a NOISE capture; amplitudes in ADC counts
+struct NoiseReport {
+    float rawRms;  // Conversions, mean removed
+    float filteredRms;  // After the mains FIR
+    int peakCount;
+    float peakHz[NOISE_PEAKS];
+    float peakAmplitude[NOISE_PEAKS];
+    float band[NOISE_BANDS];  // Largest amplitude in each band
+};
+
+// Values for one STATUS message, captured once so both rendering passes
+// produce identical output
+struct StatusSnapshot {
+    const Compass* compass;
+    uint32_t ip;
+    int32_t rssi;
+    uint32_t heapFree;
+    uint64_t uptimeSeconds;
+};
+
+// What the other streamed messages render from
+struct SessionSummary {
+    const Compass* compass;
+    int64_t endUs;
+};
+
+struct HistoryRange {
+    const Compass* compass;
+    uint32_t first;
+    uint32_t nowMs;
+};
+
+struct SessionRange {
+    const SessionRecord* records;  // Copied out under sessionLock
+    uint32_t count;
+};
+
+struct TraceRange {
+    uint32_t first;
+    uint32_t head;
+    uint32_t nowUs;
+};
+
+// Watchtower commands are parsed in place on the payload: ';' or newlines
+// separate commands, spaces separate a command from its arguments
+const int COMMAND_MAX_TOKENS = 4;  // Command name + up to 3 arguments
+
+struct CommandArgs {
+    char* tokens[COMMAND_MAX_TOKENS];  // tokens[0] is the command name
+    int count;
+};
+
+typedef void (*CommandHandler)(Compass& compass, const CommandArgs& args);
+
+struct CommandEntry {
+    const char* name;
+    uint32_t hash;
+    CommandHandler handler;
+};
+
+// SET and config keys, each bound to one CompassSettings or BoardSettings
+// field with its valid range
+struct SettingEntry {
+    const char* key;
+    int32_t CompassSettings::* compassField;
+    int32_t BoardSettings::* boardField;
+    int32_t minValue;
+    int32_t maxValue;
+};
+
+const SettingEntry SETTINGS[] = {
+    { "tolerance", &CompassSettings::tolerance, NULL, 1, 90 },
+    { "threshold", &CompassSettings::angleThreshold, NULL, 1, 45 },
+    { "debounce", &CompassSettings::debounceMs, NULL, 0, 60000 },
+    { "output", &CompassSettings::outputMode, NULL, pipeline::OUTPUT_NONE, pipeline::OUTPUT_LATCH },
+    { "pulse", &CompassSettings::pulseMs, NULL, 10, 60000 },
+    { "heartbeat", NULL, &BoardSettings::heartbeatMs, 10000, 3600000 },
+    { "loop", NULL, &BoardSettings::loopDelayMs, 10, 1000 },
+};
+const int SETTING_COUNT = sizeof(SETTINGS) / sizeof(SETTINGS[0]);
+
+// Settings applied from the config topic are kept in NVS so the board
+// comes back tuned even before the broker is reachable
+const char* SETTINGS_NAMESPACE = "compass";
+const char* BOARD_SETTINGS_KEY = "board";
+
+// Boot profile: time since reset at which each setup phase finished, in
+// RTC memory so it survives a soft reset. The previous boot's profile is
+// reported with the next ONLINE, which shows where a boot that never got
+// online stalled
+enum BootPhase {
+    BOOT_SERIAL,
+    BOOT_ADC,
+    BOOT_WIFI_ASSOCIATED,
+    BOOT_DHCP,
+    BOOT_MQTT_CONNECTED,
+    BOOT_SUBSCRIBED,
+    BOOT_FIRST_SAMPLE,
+    BOOT_PHASE_COUNT
+};
+
+const char* BOOT_PHASE_NAMES[BOOT_PHASE_COUNT] = {
+    "serialMs", "adcMs", "wifiMs", "dhcpMs", "mqttMs", "subscribeMs", "firstSampleMs"
+};
+
+const uint32_t BOOT_PROFILE_MAGIC = 0xB007C0DE;
+
+struct BootProfile {
+    uint32_t magic;
+    uint32_t bootCount;  // Boots since power-on
+    uint32_t resetReason;  // esp_reset_reason_t
+    char version[16];
+    uint32_t phaseUs[BOOT_PHASE_COUNT];  // 0 = not reached
+};
+
+// Warm-restart snapshot, kept current in RTC memory (which survives a soft
+// reset but not a power cycle) so RESET, a panic or a watchdog reset comes
+// back with puzzle state, filter and network parameters intact
+const uint32_t WARM_SNAPSHOT_MAGIC = 0x5741524D;  // "WARM"
+const int WARM_WIFI_ATTEMPTS = 6;  // x 500ms on cached parameters before a full connect
+
+struct CompassSnapshot {
+    uint8_t trackerPrimed;
+    int32_t trackerPosition;
+    int32_t trackerVelocity;
+    int32_t lastRawValue;
+    int32_t currentAngle;
+    int32_t lastReportedAngle;
+    uint8_t puzzleSolved;
+    uint8_t puzzleWasSolved;
+    char recentRequests[RECENT_REQUEST_SLOTS][REQUEST_ID_LENGTH + 1];
+    uint32_t recentRequestHead;
+};
+
+// Last association: reconnecting to the same access point on a known
+// channel skips the scan. The address still comes from DHCP, so the lease
+// keeps being renewed over weeks of uptime
+struct NetworkCache {
+    uint8_t valid;
+    uint8_t bssid[6];
+    int32_t channel;
+};
+
+struct WarmSnapshot {
+    uint32_t magic;
+    char version[16];
+    CompassSnapshot compasses[COMPASS_COUNT];
+    NetworkCache network;
+    uint32_t crc;  // CRC-32 of everything above
+};
+
+RTC_NOINIT_ATTR WarmSnapshot warmSnapshot;
+bool warmRestart = false;  // State was restored from the snapshot
+
+RTC_NOINIT_ATTR BootProfile bootProfile;
+BootProfile lastBoot;  // Copy of the previous boot's profile
+bool lastBootValid = false;
+bool bootProfilePublished = false;
+
+// ============================================
+// FUNCTION PROTOTYPES
+// ============================================
+
+void setupCompasses();
+void setupADC();
+void setupWiFi();
+void setupMQTT();
+void reconnectMQTT();
+void mqttCallback(char* topic, byte* payload, unsigned int length);
+void handleCommandMessage(Compass& compass, char* text);
+void runCommandMessage(Compass& compass, const char* requestId, long long expiry, int64_t receivedUs, char* commands);
+void holdCommand(Compass& compass, const char* requestId, long long expiry, const char* commands);
+bool isHeldRequest(const Compass& compass, const char* requestId);
+void runHeldCommands(TimerJob& job);
+void handleCommand(Compass& compass, char* text);
+bool isRecentRequest(Compass& compass, const char* requestId);
+void rememberRequest(Compass& compass, const char* requestId);
+void acknowledgeRequest(Compass& compass, const char* requestId, const char* result);
+void runRestart(TimerJob& job);
+const CommandEntry* findCommand(const char* name);
+void cmdPing(Compass& compass, const CommandArgs& args);
+void cmdStatus(Compass& compass, const CommandArgs& args);
+void cmdReset(Compass& compass, const CommandArgs& args);
+void cmdPuzzleReset(Compass& compass, const CommandArgs& args);
+void cmdSet(Compass& compass, const CommandArgs& args);
+void cmdHistory(Compass& compass, const CommandArgs& args);
+void cmdSessions(Compass& compass, const CommandArgs& args);
+void setupSessionLog();
+void sessionPath(char* path, size_t size, int segment);
+void sessionWriter(void* parameter);
+void appendSessions(const SessionRecord* records, int count);
+void startSession(Compass& compass);
+void endSession(Compass& compass, SessionOutcome outcome);
+void publishSessionStats(Compass& compass, int64_t endUs);
+void writeSessionStats(StreamWriter& out, const void* context);
+void jsonBeginObject(JsonWriter& json, const char* key);
+void jsonEndObject(JsonWriter& json);
+void flushSessionLog();
+uint32_t readSessions(SessionRecord* records, uint32_t skip, uint32_t count);
+void writeSessions(StreamWriter& out, const void* context);
+void setupHistory(Compass& compass);
+void recordHistory(Compass& compass, int64_t timestampUs, HistoryKind kind);
+uint32_t historyWindowStart(const Compass& compass, uint32_t nowMs, uint32_t windowMs);
+void writeHistory(StreamWriter& out, const void* context);
+void streamVarint(StreamWriter& out, uint32_t value);
+bool parseSetting(Compass& compass, const char* key, const char* text, CompassSettings& settings, BoardSettings& boardSettings);
+void applySettings(Compass& compass, const CompassSettings& settings);
+void applyBoardSettings(const BoardSettings& settings);
+void handleConfig(Compass& compass, char* text);
+void loadSettings();
+void saveSettings(Compass& compass);
+bool settingsValid(const CompassSettings& settings, const BoardSettings& boardSettings);
+void stopADC();
+void retuneTargetMonitor();
+int64_t nowMicros();
+int64_t realMicros(int64_t us);
+void schedulerAt(TimerJob& job, int64_t deadlineUs);
+void schedulerEvery(TimerJob& job, int64_t periodUs);
+void schedulerCancel(TimerJob& job);
+void schedulerRun();
+void schedulerSleep();
+void runMqtt(TimerJob& job);
+void runReconnect(TimerJob& job);
+void runSampling(TimerJob& job);
+void runHeartbeat(TimerJob& job);
+void runDwellDeadline(TimerJob& job);
+void runSoak(TimerJob& job);
+void runTargetEntered(TimerJob& job);
+void serviceCompasses();
+bool onAdcFrameDone(adc_continuous_handle_t handle, const adc_continuous_evt_data_t* data, void* context);
+bool onAdcPoolOverflow(adc_continuous_handle_t handle, const adc_continuous_evt_data_t* data, void* context);
+bool onTargetMonitor(adc_monitor_handle_t monitor, const adc_monitor_evt_data_t* data, void* context);
+void setupTargetMonitor();
+void armTargetMonitor(Compass& compass);
+void pollADC();
+void queueSample(Compass& compass, int64_t timestampUs, int raw);
+void setupFir(Compass& compass);
+void checkFirKernel();
+void filterConversion(Compass& compass, int64_t timestampUs, int raw, uint32_t conversionsPerSample);
+void cmdNoise(Compass& compass, const CommandArgs& args);
+void cmdProfile(Compass& compass, const CommandArgs& args);
+bool startProfile(uint32_t hz);
+void stopProfile();
+bool onProfileTick(gptimer_handle_t timer, const gptimer_alarm_event_data_t* data, void* context);
+void publishProfile(Compass& compass);
+void writeProfile(StreamWriter& out, const void* context);
+void setupTrace();
+void traceEvent(uint8_t phase, uint8_t id, uint32_t arg);
+void cmdTrace(Compass& compass, const CommandArgs& args);
+void writeTrace(StreamWriter& out, const void* context);
+void analyzeNoise(Compass& compass);
+void finishNoise(Compass& compass);
+void writeNoiseReport(StreamWriter& out, const void* context);
+void jsonFixed(JsonWriter& json, const char* key, float value, int decimals);
+void jsonBeginArray(JsonWriter& json, const char* key);
+void jsonEndArray(JsonWriter& json);
+bool readCompassAngle(Compass& compass, AngleSample& sample);
+const char* angleToDirection(int angle);
+void checkPuzzleState(Compass& compass, const AngleSample& sample);
+void publishSolveStage(Compass& compass, const char* stage);
+void setupSolveOutput(Compass& compass);
+void driveSolveOutput(Compass& compass);
+int solveOutputLevel(const Compass& compass);
+void runOutputEnd(TimerJob& job);
+void publishStatus(Compass& compass);
+void writeStatus(StreamWriter& out, const void* context);
+bool publishMessage(const char* topic, const char* payload, bool retained = false);
+void streamBegin(StreamWriter& out, bool streaming);
+void streamWrite(StreamWriter& out, const uint8_t* data, size_t length);
+void streamFlush(StreamWriter& out);
+size_t publishStreamed(const char* topic, StreamRender render, const void* context);
+void jsonBegin(JsonWriter& json, StreamWriter& out);
+void jsonEnd(JsonWriter& json);
+void jsonRaw(JsonWriter& json, const char* text, size_t length);
+void jsonKey(JsonWriter& json, const char* key);
+void jsonString(JsonWriter& json, const char* key, const char* value);
+void jsonInt(JsonWriter& json, const char* key, int64_t value);
+void jsonBool(JsonWriter& json, const char* key, bool value);
+void jsonIp(JsonWriter& json, const char* key, uint32_t ip);
+void publishLog(Compass& compass, const char* format, ...) __attribute__((format(printf, 2, 3)));
+void sendHeartbeat(Compass& compass);
+bool buildPacketTemplate(PacketTemplate& packet, const char* topic, const char* payloadPrefix, bool retained, size_t variableMax);
+char* packetPayload(PacketTemplate& packet);
+bool sendPacketTemplate(PacketTemplate& packet, size_t variableLength);
+char* appendText(char* out, const char* text);
+template <typename T> size_t formatUnsigned(char* out, T value);
+size_t formatInt(char* out, int32_t value);
+bool restoreSnapshot();
+void saveSnapshot();
+uint32_t snapshotCrc(const WarmSnapshot& snapshot);
+void cacheNetwork();
+bool connectCachedWiFi();
+void startBootProfile();
+void markBootPhase(BootPhase phase);
+void onWiFiEvent(arduino_event_id_t event, arduino_event_info_t info);
+const char* resetReasonName(uint32_t reason);
+void publishBootProfile(Compass& compass);
+void writeBootProfile(StreamWriter& out, const void* context);
+void updateHealth(int64_t busyUs);
+void checkSampleTiming(Compass& compass, const AngleSample& sample);
+void trackMotion(Compass& compass, const AngleSample& sample);
+void updateSamplingMode();
+int32_t samplingPeriodFor(SamplingMode mode);
+void applySamplePeriod(int32_t periodMs);
+int soakPotRaw(Compass& compass, int raw);
+void soakChaos();
+
+// ============================================
+// SETUP
+// ============================================
+
+void compassSetup() {
+    startBootProfile();
+    Serial.begin(115200);
+    delay(100);
+    markBootPhase(BOOT_SERIAL);
+
+    Serial.println();
+    Serial.println("========================================");
+    Serial.print(DEVICE_NAME);
+    Serial.println(" Puzzle Controller v" FIRMWARE_VERSION);
+    Serial.println("Alchemy Escape Rooms - Watchtower Protocol");
+    Serial.println("========================================");
+
+    // Build MQTT topics and reset per-compass state
+    loopTask = xTaskGetCurrentTaskHandle();
+    setupTrace();
+    setupCompasses();
+    loadSettings();
+    warmRestart = restoreSnapshot();
+    for (int i = 0; i < COMPASS_COUNT; i++) {
+        recordHistory(compasses[i], nowMicros(), HISTORY_BOOT);
+    }
+
+    // Session log on flash, written from its own task
+    setupSessionLog();
+
+    // Solve outputs, latched on again if the puzzle was already solved
+    for (int i = 0; i < COMPASS_COUNT; i++) {
+        setupSolveOutput(compasses[i]);
+    }
+
+    // Configure ADC for potentiometers
+    checkFirKernel();
+    setupADC();
+    markBootPhase(BOOT_ADC);
+
+    // Initialize networking
+    setupWiFi();
+    setupMQTT();
+
+    // The pool filled up and overflowed while WiFi connected; sample from
+    // now rather than through a second of stale conversions and a gap
+    if (adcHandle != NULL) {
+        stopADC();
+        adc_continuous_start(adcHandle);
+    }
+
+    // Periodic jobs
+    mqttJob.run = runMqtt;
+    schedulerEvery(mqttJob, realMicros((int64_t)MQTT_POLL_INTERVAL * 1000));
+    reconnectJob.run = runReconnect;
+    schedulerAt(reconnectJob, nowMicros());
+    sampleJob.run = runSampling;
+    samplePeriodMs = board.loopDelayMs;
+    previousSamplePeriodMs = samplePeriodMs;
+    schedulerEvery(sampleJob, realMicros((int64_t)samplePeriodMs * 1000));
+    heartbeatJob.run = runHeartbeat;
+    schedulerEvery(heartbeatJob, (int64_t)board.heartbeatMs * 1000);
+    if (SOAK_MODE) {
+        soakJob.run = runSoak;
+        schedulerEvery(soakJob, realMicros((int64_t)board.loopDelayMs * 1000));
+    }
+    monitorJob.run = runTargetEntered;
+    restartJob.run = runRestart;
+    heldJob.run = runHeldCommands;
+
+    for (int i = 0; i < COMPASS_COUNT; i++) {
+        Serial.print("Setup complete. ");
+        Serial.print(COMPASSES[i].deviceName);
+        Serial.print(" target: ");
+        Serial.print(COMPASSES[i].targetName);
+        Serial.print(" (");
+        Serial.print(COMPASSES[i].targetDirection);
+        Serial.println(" degrees)");
+    }
+    Serial.println("========================================");
+}
+
+// ============================================
+// MAIN LOOP
+// ============================================
+
+void compassLoop() {
+    // Run every job that is due, then sleep until the next deadline
+    int64_t passStartUs = nowMicros();
+
+    // Interrupt events become jobs due now
+    if (monitorTriggered) {
+        monitorTriggered = false;
+        schedulerAt(monitorJob, passStartUs);
+    }
+
+    schedulerRun();
+    updateHealth(nowMicros() - passStartUs);
+    schedulerSleep();
+}
+
+void runMqtt(TimerJob& job) {
+    // Maintain MQTT connection; reconnects are retried by their own job
+    if (mqtt.connected()) {
+        TRACE_BEGIN(TRACE_MQTT_LOOP, 0);
+        mqtt.loop();
+        TRACE_END(TRACE_MQTT_LOOP, 0);
+    } else if (!reconnectJob.armed) {
+        schedulerAt(reconnectJob, nowMicros());
+    }
+}
+
+void runReconnect(TimerJob& job) {
+    if (mqtt.connected()) return;
+
+    TRACE_BEGIN(TRACE_RECONNECT, 0);
+    reconnectMQTT();
+    TRACE_END(TRACE_RECONNECT, mqtt.connected());
+    if (!mqtt.connected()) {
+        schedulerAt(reconnectJob, nowMicros() + realMicros((int64_t)MQTT_RETRY_INTERVAL * 1000));
+    }
+}
+
+void runSampling(TimerJob& job) {
+    serviceCompasses();
+}
+
+void runHeartbeat(TimerJob& job) {
+    for (int i = 0; i < COMPASS_COUNT; i++) {
+        sendHeartbeat(compasses[i]);
+    }
+}
+
+void runDwellDeadline(TimerJob& job) {
+    // Evaluate the dwell as soon as it can complete rather than on the next
+    // sampling pass
+    serviceCompasses();
+}
+
+void runSoak(TimerJob& job) {
+    soakChaos();
+}
+
+void runTargetEntered(TimerJob& job) {
+    // The first compass just entered its target window: start the dwell at
+    // the interrupt time instead of the next sample's. The monitor sees raw
+    // conversions, hum and all, so "candidate" waits for a filtered sample
+    // to confirm (DWELL_CONFIRMED)
+    Compass& compass = compasses[0];
+    if (!compass.dwell.solved && !compass.dwell.active) {
+        compass.dwell.active = true;
+        compass.dwell.fromMonitor = true;
+        compass.dwell.startUs = monitorHitUs;
+        recordHistory(compass, compass.dwell.startUs, HISTORY_DWELL_START);
+        schedulerAt(compass.dwellJob, compass.dwell.startUs + (int64_t)compass.settings.debounceMs * 1000);
+    }
+    serviceCompasses();
+}
+
+void serviceCompasses() {
+    // Collect conversions from the ADC scan
+    pollADC();
+
+    for (int i = 0; i < COMPASS_COUNT; i++) {
+        Compass& compass = compasses[i];
+
+        if (compass.noiseRaw != NULL && compass.noiseCount == NOISE_POINTS) {
+            analyzeNoise(compass);
+        }
+
+        // Process every sample taken since the last pass, in order
+        AngleSample sample;
+        while (readCompassAngle(compass, sample)) {
+            markBootPhase(BOOT_FIRST_SAMPLE);
+            checkSampleTiming(compass, sample);
+            trackMotion(compass, sample);
+            compass.currentAngle = sample.angle;
+            if (compass.sessionActive && !compass.dwell.solved) {
+                pipeline::sessionStep(compass.stats, sample.angle, compass.config->targetDirection,
+                    compass.settings.tolerance, compass.settings.angleThreshold, sample.timestampUs);
+            }
+
+            // Report angle changes (rate-capped for fast sampling)
+            if (pipeline::reportStep(compass.report, compass.currentAngle, compass.settings.angleThreshold, sample.timestampUs)) {
+                const char* direction = angleToDirection(compass.currentAngle);
+
+                Serial.print(compass.config->deviceName);
+                Serial.print(": ");
+                Serial.print(compass.currentAngle);
+                Serial.print(" deg (");
+                Serial.print(direction);
+                Serial.print(") ");
+                Serial.print(sample.degreesPerS);
+                Serial.println(" deg/s");
+
+                // Publish to MQTT (only the digits change between messages):
+                // "pre_{angle}", then the turning speed on its own topic so
+                // direction subscribers see the payload they always have
+                PacketTemplate& packet = compass.directionPacket;
+                char* payload = packetPayload(packet);
+                if (payload != NULL) {
+                    sendPacketTemplate(packet, formatInt(payload, compass.currentAngle));
+                } else {
+                    health.publishDrops++;
+                }
+                PacketTemplate& velocity = compass.velocityPacket;
+                payload = packetPayload(velocity);
+                if (payload != NULL) {
+                    sendPacketTemplate(velocity, formatInt(payload, sample.degreesPerS));
+                } else {
+                    health.publishDrops++;
+                }
+
+                recordHistory(compass, sample.timestampUs, HISTORY_ANGLE);
+            }
+
+            // Check if puzzle is solved
+            checkPuzzleState(compass, sample);
+        }
+    }
+
+    updateSamplingMode();
+    armTargetMonitor(compasses[0]);
+    saveSnapshot();
+}
+
+// ============================================
+// SCHEDULER
+// ============================================
+
+uint32_t wheelSlot(const TimerJob& job) {
+    // Deadlines already passed live in the next slot to be processed
+    int64_t tick = job.deadlineUs / WHEEL_TICK_US;
+    if (tick <= wheelTick) {
+        tick = wheelTick + 1;
+    }
+    return tick & (WHEEL_SLOTS - 1);
+}
+
+void schedulerAt(TimerJob& job, int64_t deadlineUs) {
+    // A deadline already past (a dwell started on a sample older than the
+    // debounce time) is due now; the loop isn't late for it until then
+    int64_t now = nowMicros();
+    if (deadlineUs < now) {
+        deadlineUs = now;
+    }
+
+    schedulerCancel(job);
+    job.deadlineUs = deadlineUs;
+    job.periodUs = 0;
+
+    job.slot = wheelSlot(job);
+    TimerJob*& head = wheel[job.slot];
+    job.prev = NULL;
+    job.next = head;
+    if (head != NULL) {
+        head->prev = &job;
+    }
+    head = &job;
+    job.armed = true;
+}
+
+void schedulerEvery(TimerJob& job, int64_t periodUs) {
+    // First run is immediate
+    schedulerAt(job, nowMicros());
+    job.periodUs = periodUs;
+}
+
+void schedulerCancel(TimerJob& job) {
+    if (!job.armed) return;
+
+    if (job.prev != NULL) {
+        job.prev->next = job.next;
+    } else {
+        wheel[job.slot] = job.next;
+    }
+    if (job.next != NULL) {
+        job.next->prev = job.prev;
+    }
+    job.prev = NULL;
+    job.next = NULL;
+    job.armed = false;
+}
+
+void schedulerRun() {
+    int64_t now = nowMicros();
+    int64_t nowTick = now / WHEEL_TICK_US;
+    if (wheelTick < 0) {
+        wheelTick = nowTick - 1;
+    }
+
+    // Unlink everything due from the slots up to and including the current
+    // tick (each slot at most once, however long we slept). The current
+    // tick hasn't finished: jobs later in it stay in the slot, and it is
+    // scanned again on the next pass
+    int64_t steps = nowTick - wheelTick;
+    if (steps > (int64_t)WHEEL_SLOTS) {
+        steps = WHEEL_SLOTS;
+    }
+    TimerJob* due = NULL;
+    for (int64_t step = 1; step <= steps; step++) {
+        TimerJob* job = wheel[(wheelTick + step) & (WHEEL_SLOTS - 1)];
+        while (job != NULL) {
+            TimerJob* next = job->next;
+            if (job->deadlineUs <= now) {
+                schedulerCancel(*job);
+                job->dueNext = due;
+                due = job;
+            }
+            job = next;
+        }
+    }
+    wheelTick = nowTick - 1;
+
+    // Fire them; periodic jobs are re-armed first so they may cancel
+    // themselves
+    while (due != NULL) {
+        TimerJob& job = *due;
+        due = job.dueNext;
+        job.dueNext = NULL;
+
+        // Re-armed by a job that ran earlier in this pass: the new deadline
+        // stands
+        if (job.armed) continue;
+
+        if (now - job.deadlineUs > realMicros((int64_t)board.loopDelayMs * 3000)) {
+            health.loopOverruns++;
+        }
+        if (job.periodUs > 0) {
+            int64_t periodUs = job.periodUs;
+            int64_t deadlineUs = job.deadlineUs + periodUs;
+            if (deadlineUs <= now) {
+                deadlineUs = now + periodUs;  // Skip missed periods
+            }
+            schedulerAt(job, deadlineUs);
+            job.periodUs = periodUs;
+        }
+        job.run(job);
+    }
+}
+
+void schedulerSleep() {
+    // Find the earliest deadline: walk the slots in tick order; the first
+    // job due within this revolution wins, otherwise take the earliest of
+    // the far-future jobs
+    int64_t next = INT64_MAX;
+    for (uint32_t step = 1; step <= WHEEL_SLOTS; step++) {
+        int64_t tick = wheelTick + step;
+        for (TimerJob* job = wheel[tick & (WHEEL_SLOTS - 1)]; job != NULL; job = job->next) {
+            if (job->deadlineUs < next) {
+                next = job->deadlineUs;
+            }
+        }
+        if (next / WHEEL_TICK_US <= tick) {
+            break;
+        }
+    }
+    if (next == INT64_MAX) {
+        next = nowMicros() + realMicros((int64_t)board.loopDelayMs * 1000);
+    }
+
+    // Block until then; xTaskNotifyGive(loopTask) wakes the loop early.
+    // Rounded up: a deadline less than a tick away still sleeps a tick
+    // rather than spinning the loop until it comes
+    int64_t waitUs = (next - nowMicros()) / SOAK_CLOCK_SCALE;
+    TickType_t ticks = 0;
+    if (waitUs > 0) {
+        ticks = pdMS_TO_TICKS((waitUs + 999) / 1000);
+        if (ticks == 0) {
+            ticks = 1;
+        }
+    }
+    ulTaskNotifyTake(pdTRUE, ticks);
+}
+
+// ============================================
+// COMPASS SETUP
+// ============================================
+
+void setupCompasses() {
+    for (int i = 0; i < COMPASS_COUNT; i++) {
+        Compass& compass = compasses[i];
+        const CompassConfig& config = COMPASSES[i];
+
+        compass.config = &config;
+        compass.settings.tolerance = config.tolerance;
+        compass.settings.angleThreshold = ANGLE_CHANGE_THRESHOLD;
+        compass.settings.debounceMs = DEBOUNCE_TIME;
+        compass.settings.outputMode = SOLVE_OUTPUT_MODE;
+        compass.settings.pulseMs = SOLVE_PULSE_MS;
+        snprintf(compass.topicCommand, sizeof(compass.topicCommand), "%s/%s/command", ROOM_NAME, config.deviceName);
+        snprintf(compass.topicStatus, sizeof(compass.topicStatus), "%s/%s/status", ROOM_NAME, config.deviceName);
+        snprintf(compass.topicLog, sizeof(compass.topicLog), "%s/%s/log", ROOM_NAME, config.deviceName);
+        snprintf(compass.topicDirection, sizeof(compass.topicDirection), "%s/%s/direction", ROOM_NAME, config.deviceName);
+        snprintf(compass.topicVelocity, sizeof(compass.topicVelocity), "%s/%s/velocity", ROOM_NAME, config.deviceName);
+        snprintf(compass.topicSolved, sizeof(compass.topicSolved), "%s/%sSolved", ROOM_NAME, config.deviceName);
+        snprintf(compass.topicSolve, sizeof(compass.topicSolve), "%s/%s/solve", ROOM_NAME, config.deviceName);
+        snprintf(compass.topicConfig, sizeof(compass.topicConfig), "%s/%s/config", ROOM_NAME, config.deviceName);
+        snprintf(compass.topicHistory, sizeof(compass.topicHistory), "%s/%s/history", ROOM_NAME, config.deviceName);
+        snprintf(compass.topicSessions, sizeof(compass.topicSessions), "%s/%s/sessions", ROOM_NAME, config.deviceName);
+        snprintf(compass.topicProfile, sizeof(compass.topicProfile), "%s/%s/profile", ROOM_NAME, config.deviceName);
+        snprintf(compass.topicTrace, sizeof(compass.topicTrace), "%s/%s/trace", ROOM_NAME, config.deviceName);
+
+        char heartbeatPrefix[96];
+        snprintf(heartbeatPrefix, sizeof(heartbeatPrefix), "ONLINE | %s | v%s | Solved:", config.deviceName, VERSION);
+        buildPacketTemplate(compass.directionPacket, compass.topicDirection, "pre_", false, DIRECTION_VARIABLE_MAX);
+        buildPacketTemplate(compass.velocityPacket, compass.topicVelocity, "", false, VELOCITY_VARIABLE_MAX);
+        buildPacketTemplate(compass.heartbeatPacket, compass.topicStatus, heartbeatPrefix, i == 0, HEARTBEAT_VARIABLE_MAX);  // Retained under the last will only
+
+        compass.conversionsSinceSample = 0;
+        compass.noiseRaw = NULL;
+        compass.noiseFiltered = NULL;
+        compass.sampleHead = 0;
+        compass.sampleTail = 0;
+        compass.lastRawValue = -1;
+        compass.tracker.primed = false;
+        // A zero position gain would hold the tracker at its first reading
+        compass.filterAlpha = config.filterAlpha;
+        if (compass.filterAlpha < 1 || compass.filterAlpha > pipeline::FILTER_ALPHA_ONE) {
+            Serial.printf("%s: filterAlpha %d out of range (1-%d), using %d\n", config.deviceName,
+                config.filterAlpha, pipeline::FILTER_ALPHA_ONE, pipeline::FILTER_ALPHA_DEFAULT);
+            compass.filterAlpha = pipeline::FILTER_ALPHA_DEFAULT;
+        }
+        compass.lastSampleUs = 0;
+        compass.restAngle = -1;
+        compass.lastMotionUs = 0;
+        compass.lastFastUs = 0;
+        compass.currentAngle = 0;
+        pipeline::reportReset(compass.report);
+        compass.dwell.solved = false;
+        compass.puzzleWasSolved = false;
+        compass.dwell.active = false;
+        compass.dwell.fromMonitor = false;
+        compass.dwell.startUs = 0;
+        compass.dwellJob.run = runDwellDeadline;
+        compass.dwellJob.context = &compass;
+        compass.output.on = false;
+        compass.output.offUs = 0;
+        compass.outputJob.run = runOutputEnd;
+        compass.outputJob.context = &compass;
+        memset(compass.recentRequests, 0, sizeof(compass.recentRequests));
+        compass.recentRequestHead = 0;
+        compass.sessionActive = false;
+        compass.sessionStartUs = 0;
+        compass.sessionStartTime = 0;
+        setupHistory(compass);
+    }
+}
+
+void setupADC() {
+    // Every pot gets one slot in the conversion pattern, so a single DMA
+    // sequence scans all of them round-robin
+    adc_digi_pattern_config_t pattern[SOC_ADC_PATT_LEN_MAX] = {};
+    bool patternValid = (COMPASS_COUNT <= SOC_ADC_PATT_LEN_MAX);
+
+    for (int i = 0; i < COMPASS_COUNT && patternValid; i++) {
+        adc_unit_t unit;
+        adc_channel_t channel;
+        if (adc_continuous_io_to_channel(COMPASSES[i].potPin, &unit, &channel) != ESP_OK || unit != ADC_UNIT_1) {
+            Serial.print("GPIO ");
+            Serial.print(COMPASSES[i].potPin);
+            Serial.println(" is not an ADC1 pin");
+            patternValid = false;
+            break;
+        }
+        compasses[i].adcChannel = channel;
+        setupFir(compasses[i]);
+        pattern[i].atten = ADC_ATTEN_DB_12;  // Full range 0-3.3V
+        pattern[i].channel = channel;
+        pattern[i].unit = ADC_UNIT_1;
+        pattern[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;  // 12-bit (0-4095)
+    }
+
+    if (patternValid) {
+        adc_continuous_handle_cfg_t handleConfig = {};
+        handleConfig.max_store_buf_size = ADC_POOL_FRAMES * ADC_FRAME_BYTES;
+        handleConfig.conv_frame_size = ADC_FRAME_BYTES;
+
+        adc_continuous_config_t scanConfig = {};
+        scanConfig.pattern_num = COMPASS_COUNT;
+        scanConfig.adc_pattern = pattern;
+        scanConfig.sample_freq_hz = ADC_SAMPLE_FREQ_HZ * COMPASS_COUNT;
+        scanConfig.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+        scanConfig.format = ADC_DIGI_OUTPUT_FORMAT_TYPE2;
+
+        adc_continuous_evt_cbs_t callbacks = {};
+        callbacks.on_conv_done = onAdcFrameDone;
+        callbacks.on_pool_ovf = onAdcPoolOverflow;
+
+        if (adc_continuous_new_handle(&handleConfig, &adcHandle) == ESP_OK &&
+            adc_continuous_config(adcHandle, &scanConfig) == ESP_OK &&
+            adc_continuous_register_event_callbacks(adcHandle, &callbacks, NULL) == ESP_OK) {
+            // Monitors have to be created before the scan starts
+            setupTargetMonitor();
+
+            if (adc_continuous_start(adcHandle) == ESP_OK) {
+                Serial.print("ADC scan running: ");
+                Serial.print(COMPASS_COUNT);
+                Serial.println(" channel(s)");
+                return;
+            }
+        }
+
+        if (monitorFromBelow != NULL) {
+            adc_del_continuous_monitor(monitorFromBelow);
+            monitorFromBelow = NULL;
+        }
+        if (monitorFromAbove != NULL) {
+            adc_del_continuous_monitor(monitorFromAbove);
+            monitorFromAbove = NULL;
+        }
+        if (adcHandle != NULL) {
+            adc_continuous_deinit(adcHandle);
+            adcHandle = NULL;
+        }
+    }
+
+    // Fall back to one-shot reads
+    Serial.println("ADC scan unavailable, using analogRead()");
+    analogReadResolution(12);  // 12-bit resolution (0-4095)
+    for (int i = 0; i < COMPASS_COUNT; i++) {
+        analogSetPinAttenuation(COMPASSES[i].potPin, ADC_11db);  // Full range 0-3.3V on this pin
+    }
+}
+
+// ============================================
+// WIFI FUNCTIONS
+// ============================================
+
+void setupWiFi() {
+    Serial.print("Connecting to WiFi: ");
+    Serial.print(WIFI_SSID);
+
+    WiFi.onEvent(onWiFiEvent);
+    WiFi.mode(WIFI_STA);
+
+    if (!connectCachedWiFi()) {
+        WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+
+        int attempts = 0;
+        while (WiFi.status() != WL_CONNECTED && attempts < 30) {
+            delay(500);
+            Serial.print(".");
+            attempts++;
+        }
+    }
+
+    if (WiFi.status() == WL_CONNECTED) {
+        Serial.println(" Connected!");
+        Serial.print("IP Address: ");
+        Serial.println(WiFi.localIP());
+        cacheNetwork();
+    } else {
+        Serial.println(" Failed!");
+        Serial.println("Continuing in offline mode...");
+    }
+
+    // SNTP keeps retrying in the background until the network is up
+    configTime(0, 0, NTP_SERVER);
+}
+
+// ============================================
+// MQTT FUNCTIONS (Watchtower Protocol)
+// ============================================
+
+void setupMQTT() {
+    mqtt.setServer(MQTT_BROKER, MQTT_PORT);
+    mqtt.setCallback(mqttCallback);
+    mqtt.setBufferSize(512);
+    wifiClient.setNoDelay(true);  // Templated publishes go out in one segment
+}
+
+void reconnectMQTT() {
+    if (WiFi.status() != WL_CONNECTED) return;
+
+    Serial.print("Connecting to MQTT broker...");
+
+    // Last Will Testament - publish OFFLINE if we disconnect
+    // (a session carries one will, so it covers the first compass only)
+    const char* willTopic = compasses[0].topicStatus;
+    const char* willMessage = "OFFLINE";
+
+    // Same client id every time (from the MAC), and no clean session: the
+    // broker keeps our subscriptions and queues QoS 1 commands while we're
+    // away, then delivers them as soon as we're back
+    char clientId[48];
+    snprintf(clientId, sizeof(clientId), "%s_%06lx", DEVICE_NAME, (unsigned long)((ESP.getEfuseMac() >> 24) & 0xffffff));
+
+    if (mqtt.connect(clientId, NULL, NULL, willTopic, 1, true, willMessage, false)) {
+        Serial.println(" Connected!");
+        health.mqttConnects++;
+        markBootPhase(BOOT_MQTT_CONNECTED);
+
+        for (int i = 0; i < COMPASS_COUNT; i++) {
+            Compass& compass = compasses[i];
+
+            // Clear any retained command before (re)subscribing, so the
+            // broker has none to replay (prevents RESET boot loops)
+            publishMessage(compass.topicCommand, "", true);
+
+            // Subscribe to command topic
+            mqtt.subscribe(compass.topicCommand, 1);
+            Serial.print("Subscribed to: ");
+            Serial.println(compass.topicCommand);
+
+            // Retained config is delivered right away and applied
+            mqtt.subscribe(compass.topicConfig, 1);
+        }
+        markBootPhase(BOOT_SUBSCRIBED);
+
+        for (int i = 0; i < COMPASS_COUNT; i++) {
+            Compass& compass = compasses[i];
+
+            // Announce online status, with the boot profile the first time.
+            // Retained only where the last will can replace it with
+            // OFFLINE; other rows clear any retained status and rely on
+            // the heartbeat
+            if (i == 0) {
+                publishMessage(compass.topicStatus, "ONLINE", true);
+            } else {
+                publishMessage(compass.topicStatus, "", true);
+                publishMessage(compass.topicStatus, "ONLINE");
+            }
+            if (!bootProfilePublished) {
+                publishBootProfile(compass);
+            }
+            publishLog(compass, "%s controller online", compass.config->deviceName);
+            if (warmRestart && !bootProfilePublished) {
+                publishLog(compass, "Resumed after restart: %d deg, %s", compass.currentAngle,
+                    compass.dwell.solved ? "solved" : "not solved");
+            }
+        }
+        bootProfilePublished = true;
+
+    } else {
+        Serial.print(" Failed (rc=");
+        Serial.print(mqtt.state());
+        Serial.println("). Retrying...");
+    }
+}
+
+// Compile-time FNV-1a of a command name, folded to upper case so lookups
+// are case-insensitive
+constexpr uint32_t commandHash(const char* text) {
+    uint32_t hash = 2166136261u;
+    for (; *text != '\0'; text++) {
+        char c = *text;
+        if (c >= 'a' && c <= 'z') {
+            c -= 'a' - 'A';
+        }
+        hash = (hash ^ (uint8_t)c) * 16777619u;
+    }
+    return hash;
+}
+
+constexpr CommandEntry COMMANDS[] = {
+    { "PING", commandHash("PING"), cmdPing },
+    { "STATUS", commandHash("STATUS"), cmdStatus },
+    { "RESET", commandHash("RESET"), cmdReset },
+    { "PUZZLE_RESET", commandHash("PUZZLE_RESET"), cmdPuzzleReset },
+    { "SET", commandHash("SET"), cmdSet },
+    { "HISTORY", commandHash("HISTORY"), cmdHistory },
+    { "SESSIONS", commandHash("SESSIONS"), cmdSessions },
+    { "NOISE", commandHash("NOISE"), cmdNoise },
+    { "PROFILE", commandHash("PROFILE"), cmdProfile },
+    { "TRACE", commandHash("TRACE"), cmdTrace },
+};
+constexpr int COMMAND_COUNT = sizeof(COMMANDS) / sizeof(COMMANDS[0]);
+
+// Open-addressed index into COMMANDS, built by the compiler. Kept at most
+// half full so a lookup is one hash and, almost always, one probe
+constexpr uint32_t COMMAND_SLOTS = 32;  // Power of two
+static_assert(COMMAND_COUNT * 2 <= (int)COMMAND_SLOTS, "Grow COMMAND_SLOTS");
+
+struct CommandIndex {
+    int8_t slots[COMMAND_SLOTS];  // -1 = empty
+};
+
+constexpr CommandIndex buildCommandIndex() {
+    CommandIndex index = {};
+    for (uint32_t s = 0; s < COMMAND_SLOTS; s++) {
+        index.slots[s] = -1;
+    }
+    for (int i = 0; i < COMMAND_COUNT; i++) {
+        uint32_t s = COMMANDS[i].hash & (COMMAND_SLOTS - 1);
+        while (index.slots[s] >= 0) {
+            s = (s + 1) & (COMMAND_SLOTS - 1);
+        }
+        index.slots[s] = i;
+    }
+    return index;
+}
+
+constexpr CommandIndex COMMAND_INDEX = buildCommandIndex();
+
+void mqttCallback(char* topic, byte* payload, unsigned int length) {
+    // Copy topic first to avoid stack corruption
+    char topicBuf[128];
+    strncpy(topicBuf, topic, sizeof(topicBuf) - 1);
+    topicBuf[sizeof(topicBuf) - 1] = '\0';
+
+    for (int i = 0; i < COMPASS_COUNT; i++) {
+        Compass& compass = compasses[i];
+        bool isCommand = (strcmp(topicBuf, compass.topicCommand) == 0);
+        if (!isCommand && strcmp(topicBuf, compass.topicConfig) != 0) continue;
+
+        // A cut-off message could still parse (a config value cut in half
+        // passes its range check), so it's rejected rather than truncated
+        if (length > (unsigned int)MESSAGE_MAX_BYTES) {
+            publishLog(compass, "Ignored %u-byte message on %s (max %d)", length, topicBuf, MESSAGE_MAX_BYTES);
+            return;
+        }
+
+        // Copy the payload out too: it lives in the client's buffer, which
+        // the handlers' replies reuse
+        char message[MESSAGE_MAX_BYTES + 1];
+        memcpy(message, payload, length);
+        message[length] = '\0';
+
+        Serial.print("MQTT: ");
+        Serial.print(topicBuf);
+        Serial.print(" -> ");
+        Serial.println(message);
+
+        if (isCommand) {
+            handleCommandMessage(compass, message);
+        } else {
+            handleConfig(compass, message);
+        }
+        return;
+    }
+}
+
+const CommandEntry* findCommand(const char* name) {
+    uint32_t hash = commandHash(name);
+    uint32_t s = hash & (COMMAND_SLOTS - 1);
+    while (COMMAND_INDEX.slots[s] >= 0) {
+        const CommandEntry& entry = COMMANDS[COMMAND_INDEX.slots[s]];
+        if (entry.hash == hash && strcasecmp(entry.name, name) == 0) {
+            return &entry;
+        }
+        s = (s + 1) & (COMMAND_SLOTS - 1);
+    }
+    return NULL;
+}
+
+void handleCommandMessage(Compass& compass, char* text) {
+    // Optional header: id=<request id> and/or exp=<unix time>, separated
+    // from each other and the commands by whitespace
+    const char* requestId = NULL;
+    long long expiry = 0;
+    char* cursor = text;
+    while (true) {
+        cursor += strspn(cursor, " \t");
+        size_t length = strcspn(cursor, " \t;\r\n");
+        if (length > 3 && strncasecmp(cursor, "id=", 3) == 0) {
+            requestId = cursor + 3;
+        } else if (length > 4 && strncasecmp(cursor, "exp=", 4) == 0) {
+            expiry = strtoll(cursor + 4, NULL, 10);
+        } else {
+            break;
+        }
+        char* end = cursor + length;
+        if (*end == '\0') {
+            cursor = end;
+            break;
+        }
+        *end = '\0';
+        cursor = end + 1;
+    }
+
+    if (requestId != NULL && (isRecentRequest(compass, requestId) || isHeldRequest(compass, requestId))) {
+        acknowledgeRequest(compass, requestId, "DUPLICATE");
+        return;
+    }
+
+    // After a power cycle the broker hands over queued commands right after
+    // connect, long before SNTP syncs: their age can't be checked yet, so
+    // they wait for the clock
+    if (expiry != 0 && time(NULL) < CLOCK_VALID_AFTER) {
+        holdCommand(compass, requestId, expiry, cursor);
+        return;
+    }
+    runCommandMessage(compass, requestId, expiry, nowMicros(), cursor);
+}
+
+void runCommandMessage(Compass& compass, const char* requestId, long long expiry, int64_t receivedUs, char* commands) {
+    // The clock is valid here. A held command is judged by when it arrived,
+    // not by when the clock caught up
+    time_t arrived = time(NULL) - (time_t)((nowMicros() - receivedUs) / realMicros(1000000));
+    if (expiry != 0 && arrived > expiry) {
+        publishLog(compass, "Expired %llds ago: %s", (long long)(arrived - expiry), commands);
+        if (requestId != NULL) {
+            rememberRequest(compass, requestId);
+            acknowledgeRequest(compass, requestId, "EXPIRED");
+        }
+        return;
+    }
+
+    if (requestId != NULL) {
+        rememberRequest(compass, requestId);
+    }
+    handleCommand(compass, commands);
+    if (requestId != NULL) {
+        acknowledgeRequest(compass, requestId, "OK");
+    }
+}
+
+void holdCommand(Compass& compass, const char* requestId, long long expiry, const char* commands) {
+    // Full, or the clock never syncs: refused, and not remembered, so the
+    // sender can retry with the same id
+    if (heldCount == HELD_COMMAND_SLOTS) {
+        publishLog(compass, "Clock not synced, no room to hold: %s", commands);
+        if (requestId != NULL) {
+            acknowledgeRequest(compass, requestId, "UNSYNCED");
+        }
+        return;
+    }
+
+    HeldCommand& held = heldCommands[heldCount++];
+    held.compass = &compass;
+    held.requestId[0] = '\0';
+    if (requestId != NULL) {
+        strncpy(held.requestId, requestId, REQUEST_ID_LENGTH);
+        held.requestId[REQUEST_ID_LENGTH] = '\0';
+    }
+    held.expiry = expiry;
+    held.receivedUs = nowMicros();
+    strncpy(held.commands, commands, MESSAGE_MAX_BYTES);
+    held.commands[MESSAGE_MAX_BYTES] = '\0';
+    publishLog(compass, "Clock not synced, holding: %s", commands);
+
+    if (!heldJob.armed) {
+        schedulerEvery(heldJob, realMicros((int64_t)HELD_COMMAND_POLL_MS * 1000));
+    }
+}
+
+bool isHeldRequest(const Compass& compass, const char* requestId) {
+    for (int i = 0; i < heldCount; i++) {
+        const HeldCommand& held = heldCommands[i];
+        if (held.compass == &compass && strncmp(held.requestId, requestId, REQUEST_ID_LENGTH) == 0) return true;
+    }
+    return false;
+}
+
+void runHeldCommands(TimerJob& job) {
+    // Runs the held commands in arrival order once the clock is valid, or
+    // gives up on the ones held too long
+    bool synced = (time(NULL) >= CLOCK_VALID_AFTER);
+    int64_t now = nowMicros();
+    int kept = 0;
+    for (int i = 0; i < heldCount; i++) {
+        HeldCommand& held = heldCommands[i];
+        const char* requestId = (held.requestId[0] != '\0') ? held.requestId : NULL;
+        if (synced) {
+            runCommandMessage(*held.compass, requestId, held.expiry, held.receivedUs, held.commands);
+        } else if (now - held.receivedUs >= realMicros((int64_t)HELD_COMMAND_MAX_MS * 1000)) {
+            publishLog(*held.compass, "Clock not synced, exp= unchecked: %s", held.commands);
+            if (requestId != NULL) {
+                acknowledgeRequest(*held.compass, requestId, "UNSYNCED");
+            }
+        } else {
+            if (kept != i) {
+                heldCommands[kept] = held;
+            }
+            kept++;
+        }
+    }
+    heldCount = kept;
+    if (heldCount == 0) {
+        schedulerCancel(heldJob);
+    }
+}
+
+bool isRecentRequest(Compass& compass, const char* requestId) {
+    for (int i = 0; i < RECENT_REQUEST_SLOTS; i++) {
+        if (strncmp(compass.recentRequests[i], requestId, REQUEST_ID_LENGTH) == 0) return true;
+    }
+    return false;
+}
+
+void rememberRequest(Compass& compass, const char* requestId) {
+    char* slot = compass.recentRequests[compass.recentRequestHead % RECENT_REQUEST_SLOTS];
+    strncpy(slot, requestId, REQUEST_ID_LENGTH);
+    slot[REQUEST_ID_LENGTH] = '\0';
+    compass.recentRequestHead++;
+    // Into RTC memory now: the command may be the RESET itself
+    saveSnapshot();
+}
+
+void acknowledgeRequest(Compass& compass, const char* requestId, const char* result) {
+    // ACK <id> OK|DUPLICATE|EXPIRED|UNSYNCED
+    char ack[REQUEST_ID_LENGTH + 24];
+    snprintf(ack, sizeof(ack), "ACK %.*s %s", REQUEST_ID_LENGTH, requestId, result);
+    publishMessage(compass.topicStatus, ack);
+}
+
+void handleCommand(Compass& compass, char* text) {
+    // Watchtower Protocol Standard Commands, tokenized in place
+    char* cursor = text;
+    while (*cursor != '\0') {
+        char* end = cursor + strcspn(cursor, ";\r\n");
+        bool last = (*end == '\0');
+        *end = '\0';
+
+        CommandArgs args;
+        args.count = 0;
+        bool overflow = false;
+        char* save = NULL;
+        for (char* token = strtok_r(cursor, " \t", &save); token != NULL; token = strtok_r(NULL, " \t", &save)) {
+            if (args.count == COMMAND_MAX_TOKENS) {
+                overflow = true;
+                break;
+            }
+            args.tokens[args.count++] = token;
+        }
+
+        if (args.count > 0) {
+            const CommandEntry* entry = findCommand(args.tokens[0]);
+            if (entry == NULL) {
+                publishLog(compass, "Unknown command: %s", args.tokens[0]);
+            } else if (overflow) {
+                publishLog(compass, "Too many arguments: %s", entry->name);
+            } else {
+                TRACE_BEGIN(TRACE_COMMANDS + (entry - COMMANDS), &compass - compasses);
+                entry->handler(compass, args);
+                TRACE_END(TRACE_COMMANDS + (entry - COMMANDS), &compass - compasses);
+            }
+        }
+
+        if (last) break;
+        cursor = end + 1;
+    }
+}
+
+void cmdPing(Compass& compass, const CommandArgs& args) {
+    publishMessage(compass.topicStatus, "PONG");
+    publishLog(compass, "PONG");
+}
+
+void cmdStatus(Compass& compass, const CommandArgs& args) {
+    publishStatus(compass);
+}
+
+void cmdReset(Compass& compass, const CommandArgs& args) {
+    // Restart from the scheduler, after the client has acknowledged the
+    // command; restarting inside the callback would leave it unacknowledged
+    // and the broker would hand it to us again after the reboot
+    publishLog(compass, "Resetting device...");
+    flushSessionLog();
+    schedulerAt(restartJob, nowMicros() + realMicros((int64_t)RESTART_DELAY * 1000));
+}
+
+void runRestart(TimerJob& job) {
+    saveSnapshot();
+    ESP.restart();
+}
+
+void cmdPuzzleReset(Compass& compass, const CommandArgs& args) {
+    if (compass.dwell.active && !compass.dwell.fromMonitor) {
+        publishSolveStage(compass, "cancelled");
+    }
+    compass.dwell.solved = false;
+    compass.puzzleWasSolved = false;
+    compass.dwell.active = false;
+    compass.dwell.fromMonitor = false;
+    schedulerCancel(compass.dwellJob);
+    if (pipeline::outputRelease(compass.output)) {
+        schedulerCancel(compass.outputJob);
+        driveSolveOutput(compass);
+    }
+    recordHistory(compass, nowMicros(), HISTORY_PUZZLE_RESET);
+    if (compass.sessionActive) {
+        endSession(compass, SESSION_ABANDONED);
+    }
+    startSession(compass);
+    publishLog(compass, "Puzzle reset - find %s to solve", compass.config->targetName);
+    publishMessage(compass.topicStatus, "PUZZLE_RESET");
+}
+
+void cmdSet(Compass& compass, const CommandArgs& args) {
+    // SET alone reports the current values
+    if (args.count == 1) {
+        publishLog(compass, "Settings: tolerance=%ld threshold=%ld debounce=%ld heartbeat=%ld loop=%ld output=%ld pulse=%ld",
+            (long)compass.settings.tolerance,
+            (long)compass.settings.angleThreshold,
+            (long)compass.settings.debounceMs,
+            (long)board.heartbeatMs,
+            (long)board.loopDelayMs,
+            (long)compass.settings.outputMode,
+            (long)compass.settings.pulseMs);
+        return;
+    }
+    if (args.count != 3) {
+        publishLog(compass, "Usage: SET <tolerance|threshold|debounce|heartbeat|loop|output|pulse> <value>");
+        return;
+    }
+
+    CompassSettings updated = compass.settings;
+    BoardSettings updatedBoard = board;
+    if (!parseSetting(compass, args.tokens[1], args.tokens[2], updated, updatedBoard)) return;
+
+    applySettings(compass, updated);
+    applyBoardSettings(updatedBoard);
+    publishLog(compass, "SET %s = %s", args.tokens[1], args.tokens[2]);
+}
+
+bool parseSetting(Compass& compass, const char* key, const char* text, CompassSettings& settings, BoardSettings& boardSettings) {
+    for (int i = 0; i < SETTING_COUNT; i++) {
+        const SettingEntry& setting = SETTINGS[i];
+        if (strcasecmp(setting.key, key) != 0) continue;
+
+        char* end = NULL;
+        long value = strtol(text, &end, 10);
+        if (end == text || *end != '\0' || value < setting.minValue || value > setting.maxValue) {
+            publishLog(compass, "%s: expected %ld-%ld, got %s", setting.key,
+                (long)setting.minValue, (long)setting.maxValue, text);
+            return false;
+        }
+
+        if (setting.compassField != NULL) {
+            settings.*setting.compassField = value;
+        } else {
+            boardSettings.*setting.boardField = value;
+        }
+        return true;
+    }
+    publishLog(compass, "Unknown setting: %s", key);
+    return false;
+}
+
+void handleConfig(Compass& compass, char* text) {
+    // key=value pairs separated by spaces, commas or newlines; a flat JSON
+    // object ({"tolerance": 8, ...}) tokenizes the same way. Keys left out
+    // keep their current values. Nothing is applied unless every pair is
+    // valid
+    const char* delimiters = " ,;\t\r\n{}\":=";
+    CompassSettings updated = compass.settings;
+    BoardSettings updatedBoard = board;
+    int pairs = 0;
+
+    char* save = NULL;
+    for (char* key = strtok_r(text, delimiters, &save); key != NULL; key = strtok_r(NULL, delimiters, &save)) {
+        char* value = strtok_r(NULL, delimiters, &save);
+        if (value == NULL) {
+            publishLog(compass, "Config rejected: no value for %s", key);
+            return;
+        }
+        if (!parseSetting(compass, key, value, updated, updatedBoard)) {
+            publishLog(compass, "Config rejected");
+            return;
+        }
+        pairs++;
+    }
+
+    // An empty retained message just clears the topic
+    if (pairs == 0) return;
+
+    // Commands and config are both handled on the loop task, so the new
+    // values take effect between samples, all at once
+    applySettings(compass, updated);
+    applyBoardSettings(updatedBoard);
+    saveSettings(compass);
+    publishLog(compass, "Config applied: tolerance=%ld threshold=%ld debounce=%ld heartbeat=%ld loop=%ld output=%ld pulse=%ld",
+        (long)compass.settings.tolerance,
+        (long)compass.settings.angleThreshold,
+        (long)compass.settings.debounceMs,
+        (long)board.heartbeatMs,
+        (long)board.loopDelayMs,
+        (long)compass.settings.outputMode,
+        (long)compass.settings.pulseMs);
+}
+
+void applySettings(Compass& compass, const CompassSettings& settings) {
+    bool retune = (settings.tolerance != compass.settings.tolerance);
+    bool outputChanged = (settings.outputMode != compass.settings.outputMode);
+    compass.settings = settings;
+
+    // A new output mode starts from off
+    if (outputChanged && pipeline::outputRelease(compass.output)) {
+        schedulerCancel(compass.outputJob);
+        driveSolveOutput(compass);
+    }
+
+    // A running dwell finishes on the new debounce time
+    if (compass.dwell.active) {
+        schedulerAt(compass.dwellJob, compass.dwell.startUs + (int64_t)compass.settings.debounceMs * 1000);
+    }
+
+    if (retune && &compass == &compasses[0] && adcHandle != NULL) {
+        retuneTargetMonitor();
+    }
+    armTargetMonitor(compass);
+}
+
+void applyBoardSettings(const BoardSettings& settings) {
+    bool heartbeatChanged = (settings.heartbeatMs != board.heartbeatMs);
+    bool loopChanged = (settings.loopDelayMs != board.loopDelayMs);
+    board = settings;
+
+    // Changed periods start over from now
+    if (heartbeatChanged) {
+        schedulerEvery(heartbeatJob, (int64_t)board.heartbeatMs * 1000);
+    }
+    if (loopChanged) {
+        applySamplePeriod(samplingPeriodFor(samplingMode));
+        if (SOAK_MODE) {
+            schedulerEvery(soakJob, realMicros((int64_t)board.loopDelayMs * 1000));
+        }
+    }
+}
+
+// ============================================
+// SETTINGS STORAGE (NVS)
+// ============================================
+
+bool settingsValid(const CompassSettings& settings, const BoardSettings& boardSettings) {
+    for (int i = 0; i < SETTING_COUNT; i++) {
+        const SettingEntry& setting = SETTINGS[i];
+        int32_t value = (setting.compassField != NULL)
+            ? settings.*setting.compassField
+            : boardSettings.*setting.boardField;
+        if (value < setting.minValue || value > setting.maxValue) return false;
+    }
+    return true;
+}
+
+void loadSettings() {
+    // Stored blobs that don't match the current layout or ranges are
+    // ignored, leaving the compiled-in defaults
+    if (!preferences.begin(SETTINGS_NAMESPACE, true)) return;
+
+    BoardSettings storedBoard = board;
+    if (preferences.getBytesLength(BOARD_SETTINGS_KEY) == sizeof(storedBoard)) {
+        preferences.getBytes(BOARD_SETTINGS_KEY, &storedBoard, sizeof(storedBoard));
+    }
+    if (settingsValid(compasses[0].settings, storedBoard)) {  // Compass half is still the defaults
+        board = storedBoard;
+    }
+
+    for (int i = 0; i < COMPASS_COUNT; i++) {
+        char key[8];
+        snprintf(key, sizeof(key), "c%d", i);
+        CompassSettings stored;
+        if (preferences.getBytesLength(key) == sizeof(stored) &&
+            preferences.getBytes(key, &stored, sizeof(stored)) == sizeof(stored) &&
+            settingsValid(stored, board)) {
+            compasses[i].settings = stored;
+            Serial.print(compasses[i].config->deviceName);
+            Serial.println(": settings restored from NVS");
+        }
+    }
+    preferences.end();
+}
+
+void saveSettings(Compass& compass) {
+    // The retained config is re-delivered on every reconnect; only write
+    // flash when something actually changed
+    if (!preferences.begin(SETTINGS_NAMESPACE, false)) return;
+
+    char key[8];
+    snprintf(key, sizeof(key), "c%d", (int)(&compass - compasses));
+    CompassSettings stored;
+    if (preferences.getBytes(key, &stored, sizeof(stored)) != sizeof(stored) ||
+        memcmp(&stored, &compass.settings, sizeof(stored)) != 0) {
+        preferences.putBytes(key, &compass.settings, sizeof(compass.settings));
+    }
+
+    BoardSettings storedBoard;
+    if (preferences.getBytes(BOARD_SETTINGS_KEY, &storedBoard, sizeof(storedBoard)) != sizeof(storedBoard) ||
+        memcmp(&storedBoard, &board, sizeof(storedBoard)) != 0) {
+        preferences.putBytes(BOARD_SETTINGS_KEY, &board, sizeof(board));
+    }
+    preferences.end();
+}
+
+void publishStatus(Compass& compass) {
+    StatusSnapshot snapshot;
+    snapshot.compass = &compass;
+    snapshot.ip = WiFi.localIP();
+    snapshot.rssi = WiFi.RSSI();
+    snapshot.heapFree = ESP.getFreeHeap();
+    snapshot.uptimeSeconds = nowMicros() / 1000000;
+
+    if (publishStreamed(compass.topicStatus, writeStatus, &snapshot) > 0) {
+        Serial.println("Status published");
+    }
+}
+
+void writeStatus(StreamWriter& out, const void* context) {
+    const StatusSnapshot& snapshot = *(const StatusSnapshot*)context;
+    const Compass& compass = *snapshot.compass;
+    JsonWriter json;
+    jsonBegin(json, out);
+    jsonString(json, "device", compass.config->deviceName);
+    jsonString(json, "version", VERSION);
+    jsonString(json, "room", ROOM_NAME);
+    jsonInt(json, "angle", compass.currentAngle);
+    jsonInt(json, "velocity", pipeline::velocityToDegreesPerS(compass.tracker.velocity, (int64_t)samplePeriodMs * 1000));
+    jsonString(json, "direction", angleToDirection(compass.currentAngle));
+    jsonString(json, "target", compass.config->targetName);
+    jsonInt(json, "targetAngle", compass.config->targetDirection);
+    jsonInt(json, "tolerance", compass.settings.tolerance);
+    jsonBool(json, "solved", compass.dwell.solved);
+    if (compass.config->outputPin >= 0) {
+        jsonBool(json, "output", compass.output.on);
+    }
+    jsonString(json, "sampling", SAMPLING_MODE_NAMES[samplingMode]);
+    jsonInt(json, "samplePeriodMs", samplePeriodMs);
+    jsonIp(json, "ip", snapshot.ip);
+    jsonInt(json, "uptime", snapshot.uptimeSeconds);
+    jsonInt(json, "rssi", snapshot.rssi);
+    jsonInt(json, "heapFree", snapshot.heapFree);
+    jsonInt(json, "heapMin", health.minFreeHeap);
+    jsonInt(json, "heapFrag", health.maxFragmentation);
+    jsonInt(json, "reconnects", health.mqttConnects > 0 ? health.mqttConnects - 1 : 0);
+    jsonInt(json, "publishDrops", health.publishDrops);
+    jsonInt(json, "loopAvgUs", health.loopPasses > 0 ? health.totalLoopUs / health.loopPasses : 0);
+    jsonInt(json, "loopMaxUs", health.maxLoopUs);
+    jsonInt(json, "timingFaults", health.clockFaults + health.sampleGaps + health.loopOverruns);
+    jsonInt(json, "firMismatches", health.firMismatches);
+    jsonEnd(json);
+}
+
+bool publishMessage(const char* topic, const char* payload, bool retained) {
+    TRACE_BEGIN(TRACE_PUBLISH, strlen(payload));
+    bool sent = mqtt.publish(topic, payload, retained);
+    TRACE_END(TRACE_PUBLISH, strlen(payload));
+    if (!sent) {
+        health.publishDrops++;
+        return false;
+    }
+    return true;
+}
+
+void publishLog(Compass& compass, const char* format, ...) {
+    char message[128];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    publishMessage(compass.topicLog, message);
+    Serial.print("Log: ");
+    Serial.println(message);
+}
+
+void sendHeartbeat(Compass& compass) {
+    // Watchtower Protocol standard heartbeat format:
+    // ONLINE | {name} | v{version} | Solved:{YES|NO} | Direction:{dir} | Angle:{deg} | Uptime:{ms}ms
+    // Everything up to "Solved:" is already in the packet template
+    PacketTemplate& packet = compass.heartbeatPacket;
+    char* payload = packetPayload(packet);
+    if (payload == NULL) {
+        health.publishDrops++;
+        return;
+    }
+    char* p = payload;
+    p = appendText(p, compass.dwell.solved ? "YES" : "NO");
+    p = appendText(p, " | Direction:");
+    p = appendText(p, angleToDirection(compass.currentAngle));
+    p = appendText(p, " | Angle:");
+    p += formatInt(p, compass.currentAngle);
+    p = appendText(p, " | Uptime:");
+    p += formatUnsigned(p, (uint64_t)(nowMicros() / 1000));
+    p = appendText(p, "ms");
+    *p = '\0';
+
+    sendPacketTemplate(packet, p - payload);
+    Serial.print("Heartbeat: ");
+    Serial.println(payload - packet.prefixLength);
+}
+
+// ============================================
+// PACKET TEMPLATES
+// ============================================
+
+// "00" "01" ... "99": two digits per table lookup
+static const char DIGIT_PAIRS[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+bool buildPacketTemplate(PacketTemplate& packet, const char* topic, const char* payloadPrefix, bool retained, size_t variableMax) {
+    // Callers write up to variableMax bytes straight into the buffer, so
+    // the room is checked here, before anything is written
+    size_t topicLength = strlen(topic);
+    size_t prefixLength = strlen(payloadPrefix);
+    if (PACKET_HEADER_RESERVE + 2 + topicLength + prefixLength + variableMax > (size_t)PACKET_TEMPLATE_BYTES) {
+        Serial.print("Packet template too long, not sent: ");
+        Serial.println(topic);
+        packet.variableOffset = 0;
+        packet.variableMax = 0;
+        return false;
+    }
+
+    uint8_t* p = packet.buffer + PACKET_HEADER_RESERVE;
+    *p++ = topicLength >> 8;
+    *p++ = topicLength & 0xFF;
+    memcpy(p, topic, topicLength);
+    p += topicLength;
+    memcpy(p, payloadPrefix, prefixLength);
+    p += prefixLength;
+
+    packet.headerByte = 0x30 | (retained ? 0x01 : 0x00);  // PUBLISH, QoS 0
+    packet.fixedLength = p - (packet.buffer + PACKET_HEADER_RESERVE);
+    packet.prefixLength = prefixLength;
+    packet.variableOffset = p - packet.buffer;
+    packet.variableMax = variableMax;
+    return true;
+}
+
+char* packetPayload(PacketTemplate& packet) {
+    // NULL if the template didn't fit
+    if (packet.variableOffset == 0) return NULL;
+    return (char*)packet.buffer + packet.variableOffset;
+}
+
+bool sendPacketTemplate(PacketTemplate& packet, size_t variableLength) {
+    if (!mqtt.connected() || packet.variableOffset == 0 || variableLength > packet.variableMax) {
+        health.publishDrops++;
+        return false;
+    }
+
+    // Remaining length is a 1-4 byte varint; write the fixed header right
+    // up against the topic so the packet is contiguous
+    size_t remaining = packet.fixedLength + variableLength;
+    uint8_t lengthBytes[4];
+    int count = 0;
+    do {
+        uint8_t digit = remaining % 128;
+        remaining /= 128;
+        if (remaining > 0) {
+            digit |= 0x80;
+        }
+        lengthBytes[count++] = digit;
+    } while (remaining > 0);
+
+    uint8_t* start = packet.buffer + PACKET_HEADER_RESERVE - 1 - count;
+    start[0] = packet.headerByte;
+    memcpy(start + 1, lengthBytes, count);
+
+    size_t total = (packet.buffer + PACKET_HEADER_RESERVE - start) + packet.fixedLength + variableLength;
+    TRACE_BEGIN(TRACE_PUBLISH, total);
+    size_t written = wifiClient.write(start, total);
+    TRACE_END(TRACE_PUBLISH, total);
+    if (written != total) {
+        health.publishDrops++;
+        return false;
+    }
+    return true;
+}
+
+char* appendText(char* out, const char* text) {
+    size_t length = strlen(text);
+    memcpy(out, text, length);
+    return out + length;
+}
+
+template <typename T>
+size_t formatUnsigned(char* out, T value) {
+    // Fill from the right two digits at a time, then copy out
+    char digits[20];
+    char* p = digits + sizeof(digits);
+    while (value >= 100) {
+        unsigned pair = value % 100;
+        value /= 100;
+        p -= 2;
+        memcpy(p, &DIGIT_PAIRS[pair * 2], 2);
+    }
+    if (value >= 10) {
+        p -= 2;
+        memcpy(p, &DIGIT_PAIRS[value * 2], 2);
+    } else {
+        *--p = '0' + value;
+    }
+
+    size_t length = digits + sizeof(digits) - p;
+    memcpy(out, p, length);
+    return length;
+}
+
+size_t formatInt(char* out, int32_t value) {
+    if (value < 0) {
+        *out = '-';
+        return 1 + formatUnsigned(out + 1, (uint32_t)(-(int64_t)value));
+    }
+    return formatUnsigned(out, (uint32_t)value);
+}
+
+// ============================================
+// JSON WRITER
+// ============================================
+
+void streamBegin(StreamWriter& out, bool streaming) {
+    out.streaming = streaming;
+    out.length = 0;
+    out.chunkUsed = 0;
+}
+
+void streamWrite(StreamWriter& out, const uint8_t* data, size_t length) {
+    out.length += length;
+    if (!out.streaming) return;
+
+    while (length > 0) {
+        if (out.chunkUsed == STREAM_CHUNK_BYTES) {
+            mqtt.write(out.chunk, out.chunkUsed);
+            out.chunkUsed = 0;
+        }
+        size_t count = STREAM_CHUNK_BYTES - out.chunkUsed;
+        if (count > length) {
+            count = length;
+        }
+        memcpy(out.chunk + out.chunkUsed, data, count);
+        out.chunkUsed += count;
+        data += count;
+        length -= count;
+    }
+}
+
+void streamFlush(StreamWriter& out) {
+    if (out.streaming && out.chunkUsed > 0) {
+        mqtt.write(out.chunk, out.chunkUsed);
+    }
+    out.chunkUsed = 0;
+}
+
+// Measure, then stream straight into the client. Returns the message
+// length, or 0 if the client had no room (counted in publishDrops)
+size_t publishStreamed(const char* topic, StreamRender render, const void* context) {
+    StreamWriter out;
+    streamBegin(out, false);
+    render(out, context);
+    size_t length = out.length;
+    if (!mqtt.beginPublish(topic, length, false)) {
+        health.publishDrops++;
+        return 0;
+    }
+    TRACE_BEGIN(TRACE_PUBLISH, length);
+    streamBegin(out, true);
+    render(out, context);
+    streamFlush(out);
+    mqtt.endPublish();
+    TRACE_END(TRACE_PUBLISH, length);
+    return length;
+}
+
+// One JSON object, written through a stream
+void jsonBegin(JsonWriter& json, StreamWriter& out) {
+    json.out = &out;
+    json.firstField = true;
+    jsonRaw(json, "{", 1);
+}
+
+void jsonEnd(JsonWriter& json) {
+    jsonRaw(json, "}", 1);
+}
+
+void jsonRaw(JsonWriter& json, const char* text, size_t length) {
+    streamWrite(*json.out, (const uint8_t*)text, length);
+}
+
+void jsonKey(JsonWriter& json, const char* key) {
+    // NULL key = array element
+    if (!json.firstField) {
+        jsonRaw(json, ",", 1);
+    }
+    if (key != NULL) {
+        jsonRaw(json, "\"", 1);
+        jsonRaw(json, key, strlen(key));
+        jsonRaw(json, "\":", 2);
+    }
+    json.firstField = false;
+}
+
+void jsonBeginObject(JsonWriter& json, const char* key) {
+    jsonKey(json, key);
+    jsonRaw(json, "{", 1);
+    json.firstField = true;
+}
+
+void jsonEndObject(JsonWriter& json) {
+    jsonRaw(json, "}", 1);
+    json.firstField = false;
+}
+
+void jsonBeginArray(JsonWriter& json, const char* key) {
+    jsonKey(json, key);
+    jsonRaw(json, "[", 1);
+    json.firstField = true;
+}
+
+void jsonEndArray(JsonWriter& json) {
+    jsonRaw(json, "]", 1);
+    json.firstField = false;
+}
+
+void jsonFixed(JsonWriter& json, const char* key, float value, int decimals) {
+    char text[24];
+    int length = snprintf(text, sizeof(text), "%.*f", decimals, value);
+    jsonKey(json, key);
+    jsonRaw(json, text, length);
+}
+
+void jsonString(JsonWriter& json, const char* key, const char* value) {
+    jsonKey(json, key);
+    jsonRaw(json, "\"", 1);
+    for (const char* p = value; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') {
+            jsonRaw(json, "\\", 1);
+        }
+        jsonRaw(json, p, 1);
+    }
+    jsonRaw(json, "\"", 1);
+}
+
+void jsonInt(JsonWriter& json, const char* key, int64_t value) {
+    char digits[21];
+    size_t length = 0;
+    if (value < 0) {
+        digits[length++] = '-';
+        value = -value;
+    }
+    length += formatUnsigned(digits + length, (uint64_t)value);
+    jsonKey(json, key);
+    jsonRaw(json, digits, length);
+}
+
+void jsonBool(JsonWriter& json, const char* key, bool value) {
+    jsonKey(json, key);
+    jsonRaw(json, value ? "true" : "false", value ? 4 : 5);
+}
+
+void jsonIp(JsonWriter& json, const char* key, uint32_t ip) {
+    // Dotted quad, first octet in the low byte (lwIP order)
+    char text[16];
+    char* p = text;
+    for (int i = 0; i < 4; i++) {
+        if (i > 0) {
+            *p++ = '.';
+        }
+        p += formatUnsigned(p, (ip >> (8 * i)) & 0xFF);
+    }
+    jsonKey(json, key);
+    jsonRaw(json, "\"", 1);
+    jsonRaw(json, text, p - text);
+    jsonRaw(json, "\"", 1);
+}
+
+// ============================================
+// COMPASS FUNCTIONS
+// ============================================
+
+int64_t realMicros(int64_t us) {
+    // Converts a real-time duration to clock time (differs only in soak mode)
+    return us * SOAK_CLOCK_SCALE;
+}
+
+int64_t IRAM_ATTR nowMicros() {
+    // 64-bit microsecond monotonic clock; wraps after ~292,000 years
+    // (virtual and accelerated in soak mode)
+    return SOAK_CLOCK_OFFSET_US + esp_timer_get_time() * SOAK_CLOCK_SCALE;
+}
+
+#if SOAK_MODE
+// Libraries time themselves with millis() (PubSubClient's keepalive and
+// socket timeouts). The soak build links with -Wl,--wrap=millis, so they
+// run on the soak clock too and go through the 32-bit rollover with it
+extern "C" unsigned long __wrap_millis() {
+    return (uint32_t)(nowMicros() / 1000);
+}
+#endif
+
+bool IRAM_ATTR onAdcFrameDone(adc_continuous_handle_t handle, const adc_continuous_evt_data_t* data, void* context) {
+    adcFrameStamps[adcStampHead % ADC_STAMP_SLOTS] = nowMicros();
+    adcStampHead = adcStampHead + 1;
+    return false;
+}
+
+bool IRAM_ATTR onAdcPoolOverflow(adc_continuous_handle_t handle, const adc_continuous_evt_data_t* data, void* context) {
+    // The frame just stamped never reached the pool, so drop its stamp
+    adcStampHead = adcStampHead - 1;
+    return false;
+}
+
+void pollADC() {
+    if (adcHandle == NULL) {
+        // One-shot fallback: one sample per loop, stamped at read time
+        for (int c = 0; c < COMPASS_COUNT; c++) {
+            queueSample(compasses[c], nowMicros(), analogRead(compasses[c].config->potPin));
+        }
+        return;
+    }
+
+    const uint32_t conversionsPerFrame = ADC_CONVERSIONS_PER_FRAME * COMPASS_COUNT;
+    const int64_t conversionPeriodUs = 1000000LL * SOAK_CLOCK_SCALE / (ADC_SAMPLE_FREQ_HZ * COMPASS_COUNT);
+    const uint32_t conversionsPerSample = ADC_SAMPLE_FREQ_HZ * samplePeriodMs / 1000;  // Per angle sample
+
+    // Drain everything the DMA has queued since the last poll
+    uint8_t frame[ADC_FRAME_BYTES];
+    uint32_t length = 0;
+    while (adc_continuous_read(adcHandle, frame, sizeof(frame), &length, 0) == ESP_OK) {
+        for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= length; i += SOC_ADC_DIGI_RESULT_BYTES) {
+            // Each frame carries the time it completed; conversions within
+            // it are evenly spaced before that
+            if (adcFrameConversion == 0 && adcStampTail != adcStampHead) {
+                adcFrameStampUs = adcFrameStamps[adcStampTail % ADC_STAMP_SLOTS];
+                adcStampTail++;
+            }
+            int64_t timestampUs = adcFrameStampUs - (int64_t)(conversionsPerFrame - 1 - adcFrameConversion) * conversionPeriodUs;
+            adcFrameConversion = (adcFrameConversion + 1) % conversionsPerFrame;
+
+            const adc_digi_output_data_t* result = (const adc_digi_output_data_t*)&frame[i];
+            for (int c = 0; c < COMPASS_COUNT; c++) {
+                Compass& compass = compasses[c];
+                if (compass.adcChannel != result->type2.channel) continue;
+
+                filterConversion(compass, timestampUs, result->type2.data, conversionsPerSample);
+                break;
+            }
+        }
+    }
+}
+
+void setupFir(Compass& compass) {
+    // A comb with nulls at every multiple of MAINS_HZ
+    pipeline::firCoefficients(compass.firCoeffs, FIR_WINDOW, FIR_TAPS);
+    dsps_fird_init_s16(&compass.fir, compass.firCoeffs, compass.firDelay, FIR_TAPS, FIR_DECIMATION, 0, 0);
+    compass.firBlockCount = 0;
+    compass.firPrimed = false;
+}
+
+void checkFirKernel() {
+    // The host tools replay conversion traces through pipeline::firStep(),
+    // so the S3 kernel has to agree with it output for output. A fixed
+    // vector through both: ramps to both rails, a step and LCG noise
+    const uint32_t outputs = 32;
+    static fir_s16_t fir;
+    alignas(16) static int16_t coeffs[FIR_TAPS];
+    alignas(16) static int16_t delay[FIR_TAPS + 8];
+    static int16_t block[FIR_DECIMATION];
+    static pipeline::Fir reference;
+
+    pipeline::firCoefficients(coeffs, FIR_WINDOW, FIR_TAPS);
+    dsps_fird_init_s16(&fir, coeffs, delay, FIR_TAPS, FIR_DECIMATION, 0, 0);
+    pipeline::firInit(reference, FIR_WINDOW, FIR_DECIMATION);
+
+    const uint32_t quarter = outputs * FIR_DECIMATION / 4;
+    uint32_t seed = 12345;
+    uint32_t mismatches = 0;
+    for (uint32_t n = 0; n < outputs * FIR_DECIMATION; n++) {
+        seed = seed * 1664525 + 1013904223;
+        int raw;
+        if (n < quarter) {
+            raw = n * 4095 / quarter;  // Ramp up to the top rail
+        } else if (n < 2 * quarter) {
+            raw = 4095 - (seed >> 31) * 16;  // Top rail, 16-count noise
+        } else if (n < 3 * quarter) {
+            raw = (seed >> 31) * 16;  // Step to the bottom rail
+        } else {
+            raw = 1536 + (seed >> 22);  // Mid-range, 1024-count noise
+        }
+        if (n == 0) {
+            for (uint32_t i = 0; i < FIR_TAPS + 8; i++) {
+                delay[i] = pipeline::firInput(raw);
+            }
+        }
+        block[n % FIR_DECIMATION] = pipeline::firInput(raw);
+        if (pipeline::firStep(reference, raw)) {
+            int16_t filtered;
+            dsps_fird_s16(&fir, block, &filtered, 1);
+            if (pipeline::firOutputRaw(filtered) != reference.output) {
+                if (mismatches == 0) {
+                    Serial.printf("FIR self-test: output %lu kernel %d, reference %d\n",
+                        (unsigned long)(n / FIR_DECIMATION), pipeline::firOutputRaw(filtered), reference.output);
+                }
+                mismatches++;
+            }
+        }
+    }
+    health.firMismatches = mismatches;
+    if (mismatches == 0) {
+        Serial.println("FIR self-test: kernel matches the reference");
+    } else {
+        Serial.printf("FIR self-test: %lu of %lu outputs differ, host replays won't match\n",
+            (unsigned long)mismatches, (unsigned long)outputs);
+    }
+}
+
+void filterConversion(Compass& compass, int64_t timestampUs, int raw, uint32_t conversionsPerSample) {
+    int16_t scaled = pipeline::firInput(raw);
+    if (!compass.firPrimed) {
+        // Start from a full window of the first value, not a ramp up from 0
+        for (uint32_t i = 0; i < FIR_TAPS + 8; i++) {
+            compass.firDelay[i] = scaled;
+        }
+        compass.firOutput = raw;
+        compass.firOutputUs = timestampUs;
+        compass.firPrimed = true;
+    }
+    if (compass.noiseRaw != NULL && compass.noiseCount < NOISE_POINTS) {
+        compass.noiseRaw[compass.noiseCount++] = raw;
+    }
+
+    compass.firBlock[compass.firBlockCount++] = scaled;
+    if (compass.firBlockCount == FIR_DECIMATION) {
+        // One output per FIR_DECIMATION conversions
+        int16_t filtered;
+        dsps_fird_s16(&compass.fir, compass.firBlock, &filtered, 1);
+        compass.firBlockCount = 0;
+        compass.firOutput = pipeline::firOutputRaw(filtered);
+        compass.firOutputUs = timestampUs;
+        if (compass.noiseFiltered != NULL && compass.noiseFilteredCount < NOISE_POINTS / FIR_DECIMATION) {
+            compass.noiseFiltered[compass.noiseFilteredCount++] = compass.firOutput;
+        }
+    }
+
+    // The angle sample is the newest filter output
+    compass.conversionsSinceSample++;
+    if (compass.conversionsSinceSample >= conversionsPerSample) {
+        queueSample(compass, compass.firOutputUs, compass.firOutput);
+        compass.conversionsSinceSample = 0;
+    }
+}
+
+void queueSample(Compass& compass, int64_t timestampUs, int raw) {
+    // If the loop fell behind, drop the oldest sample
+    if (compass.sampleHead - compass.sampleTail >= SAMPLE_QUEUE_LENGTH) {
+        compass.sampleTail++;
+    }
+    RawSample& slot = compass.samples[compass.sampleHead % SAMPLE_QUEUE_LENGTH];
+    slot.timestampUs = timestampUs;
+    slot.raw = SOAK_MODE ? soakPotRaw(compass, raw) : raw;
+    compass.sampleHead++;
+}
+
+void setupTargetMonitor() {
+    // Raw window matching the target direction +/- tolerance under the
+    // same 0-4095 -> 0-359 mapping readCompassAngle() uses
+    const Compass& compass = compasses[0];
+    int lowAngle = (compass.config->targetDirection - compass.settings.tolerance + 360) % 360;
+    int highAngle = (compass.config->targetDirection + compass.settings.tolerance) % 360;
+    int rawLow = (lowAngle * 4095 + 358) / 359;
+    int rawHigh = ((highAngle + 1) * 4095 - 1) / 359;
+    if (rawHigh > 4095) {
+        rawHigh = 4095;
+    }
+
+    adc_monitor_evt_cbs_t callbacks = {};
+
+    adc_monitor_config_t fromBelow = {};
+    fromBelow.adc_unit = ADC_UNIT_1;
+    fromBelow.channel = compasses[0].adcChannel;
+    fromBelow.h_threshold = rawLow - 1;  // Fires at raw >= rawLow
+    fromBelow.l_threshold = -1;
+    callbacks.on_over_high_thresh = onTargetMonitor;
+    if (adc_new_continuous_monitor(adcHandle, &fromBelow, &monitorFromBelow) != ESP_OK ||
+        adc_continuous_monitor_register_event_callbacks(monitorFromBelow, &callbacks, NULL) != ESP_OK) {
+        monitorFromBelow = NULL;
+    }
+
+    adc_monitor_config_t fromAbove = {};
+    fromAbove.adc_unit = ADC_UNIT_1;
+    fromAbove.channel = compasses[0].adcChannel;
+    fromAbove.h_threshold = -1;
+    fromAbove.l_threshold = rawHigh + 1;  // Fires at raw <= rawHigh
+    callbacks.on_over_high_thresh = NULL;
+    callbacks.on_below_low_thresh = onTargetMonitor;
+    if (adc_new_continuous_monitor(adcHandle, &fromAbove, &monitorFromAbove) != ESP_OK ||
+        adc_continuous_monitor_register_event_callbacks(monitorFromAbove, &callbacks, NULL) != ESP_OK) {
+        monitorFromAbove = NULL;
+    }
+
+    if (monitorFromBelow != NULL && monitorFromAbove != NULL) {
+        Serial.print("Target monitor armed on raw window ");
+        Serial.print(rawLow);
+        Serial.print("-");
+        Serial.println(rawHigh);
+    } else {
+        Serial.println("Target monitor unavailable, polling only");
+    }
+}
+
+void stopADC() {
+    // Stops the scan and discards the conversions in flight
+    adc_continuous_stop(adcHandle);
+    adc_continuous_flush_pool(adcHandle);
+    adcStampTail = adcStampHead;
+    adcFrameConversion = 0;
+    for (int i = 0; i < COMPASS_COUNT; i++) {
+        compasses[i].conversionsSinceSample = 0;
+        compasses[i].firBlockCount = 0;
+    }
+}
+
+void retuneTargetMonitor() {
+    // Monitor thresholds are fixed at creation, and monitors can only be
+    // created with the scan stopped
+    stopADC();
+
+    if (monitorFromBelow != NULL) {
+        if (monitorFromBelowOn) {
+            adc_continuous_monitor_disable(monitorFromBelow);
+        }
+        adc_del_continuous_monitor(monitorFromBelow);
+        monitorFromBelow = NULL;
+    }
+    if (monitorFromAbove != NULL) {
+        if (monitorFromAboveOn) {
+            adc_continuous_monitor_disable(monitorFromAbove);
+        }
+        adc_del_continuous_monitor(monitorFromAbove);
+        monitorFromAbove = NULL;
+    }
+    monitorFromBelowOn = false;
+    monitorFromAboveOn = false;
+
+    setupTargetMonitor();
+    adc_continuous_start(adcHandle);
+}
+
+bool IRAM_ATTR onTargetMonitor(adc_monitor_handle_t monitor, const adc_monitor_evt_data_t* data, void* context) {
+    // Keep the first hit; the loop disables the monitors once it runs
+    if (!monitorTriggered) {
+        monitorHitUs = nowMicros();
+        monitorTriggered = true;
+    }
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(loopTask, &woken);
+    return woken == pdTRUE;
+}
+
+void armTargetMonitor(Compass& compass) {
+    if (monitorFromBelow == NULL || monitorFromAbove == NULL) return;
+
+    // Enable only the edge(s) the compass can cross into the window from
+    bool fromBelow = false;
+    bool fromAbove = false;
+    if (!compass.dwell.solved && !compass.dwell.active && compass.lastSampleUs != 0 && nowMicros() >= monitorRearmUs) {
+        int lowAngle = compass.config->targetDirection - compass.settings.tolerance;
+        int highAngle = compass.config->targetDirection + compass.settings.tolerance;
+        if (lowAngle < 0 || highAngle > 359) {
+            // Window wraps through 0, so outside it both edges face us
+            fromBelow = true;
+            fromAbove = true;
+        } else {
+            fromBelow = compass.currentAngle < lowAngle;
+            fromAbove = compass.currentAngle > highAngle;
+        }
+    }
+
+    if (fromBelow != monitorFromBelowOn) {
+        if (fromBelow) {
+            adc_continuous_monitor_enable(monitorFromBelow);
+        } else {
+            adc_continuous_monitor_disable(monitorFromBelow);
+        }
+        monitorFromBelowOn = fromBelow;
+    }
+    if (fromAbove != monitorFromAboveOn) {
+        if (fromAbove) {
+            adc_continuous_monitor_enable(monitorFromAbove);
+        } else {
+            adc_continuous_monitor_disable(monitorFromAbove);
+        }
+        monitorFromAboveOn = fromAbove;
+    }
+}
+
+bool readCompassAngle(Compass& compass, AngleSample& sample) {
+    if (compass.sampleTail == compass.sampleHead) {
+        return false;
+    }
+    TRACE_BEGIN(TRACE_READ_ANGLE, &compass - compasses);
+
+    // Read potentiometer (0-4095)
+    const RawSample& next = compass.samples[compass.sampleTail % SAMPLE_QUEUE_LENGTH];
+    compass.sampleTail++;
+    int rawValue = next.raw;
+
+    // DEBUG: Print raw ADC value only when it changes. Off by default: at
+    // fast sampling these prints alone would hold up the loop
+    if (DEBUG_RAW_ADC && abs(rawValue - compass.lastRawValue) >= 10) {
+        Serial.print("DEBUG Raw ADC (");
+        Serial.print(compass.config->deviceName);
+        Serial.print("): ");
+        Serial.println(rawValue);
+        compass.lastRawValue = rawValue;
+    }
+
+    // Track position and velocity, then map to 0-359 degrees
+    pipeline::trackerStep(compass.tracker, rawValue, compass.filterAlpha, compass.config->trackerBeta);
+    int angle = pipeline::rawToAngle(pipeline::trackerRaw(compass.tracker));
+
+    sample.timestampUs = next.timestampUs;
+    sample.raw = rawValue;
+    sample.angle = angle;
+    sample.velocity = compass.tracker.velocity;
+    sample.degreesPerS = pipeline::velocityToDegreesPerS(sample.velocity, (int64_t)samplePeriodMs * 1000);
+    TRACE_END(TRACE_READ_ANGLE, &compass - compasses);
+    return true;
+}
+
+const char* angleToDirection(int angle) {
+    // Convert angle to 8-point compass direction
+    // N=0, NE=45, E=90, SE=135, S=180, SW=225, W=270, NW=315
+
+    return pipeline::directionName(angle);
+}
+
+void checkPuzzleState(Compass& compass, const AngleSample& sample) {
+    // Check if compass is pointing to target direction; debounce timed on
+    // sample timestamps
+    pipeline::DwellParams params;
+    params.target = compass.config->targetDirection;
+    params.tolerance = compass.settings.tolerance;
+    params.debounceUs = (int64_t)compass.settings.debounceMs * 1000;
+    params.settleUs = (int64_t)MONITOR_SETTLE_SAMPLES * samplePeriodMs * 1000;
+    params.settleVelocity = pipeline::degreesPerSToVelocity(SETTLE_SPEED, (int64_t)samplePeriodMs * 1000);
+
+    // Read before dwellStep(): a cancelled dwell that is still marked as
+    // from the monitor was never confirmed, so no candidate went out
+    bool unconfirmed = compass.dwell.fromMonitor;
+    pipeline::DwellEvent event = pipeline::dwellStep(compass.dwell, params, compass.currentAngle, sample.velocity, sample.timestampUs);
+    uint32_t actions = pipeline::solveActions(event, unconfirmed);
+
+    if (actions & pipeline::SOLVE_CANDIDATE) {
+        // Settled on the target: let show control pre-arm
+        publishSolveStage(compass, "candidate");
+    }
+    if (actions & pipeline::SOLVE_DWELL_START) {
+        recordHistory(compass, sample.timestampUs, HISTORY_DWELL_START);
+        schedulerAt(compass.dwellJob, compass.dwell.startUs + params.debounceUs);
+    }
+    if (actions & pipeline::SOLVE_DWELL_CANCEL) {
+        // Reset debounce timer if moved away
+        recordHistory(compass, sample.timestampUs, HISTORY_DWELL_CANCEL);
+        schedulerCancel(compass.dwellJob);
+    }
+    if (actions & pipeline::SOLVE_MONITOR_HOLDOFF) {
+        // Hum at the window edge: keep the monitor quiet for a while
+        // instead of looping hit, cancel, re-arm
+        compass.dwell.fromMonitor = false;
+        monitorRearmUs = sample.timestampUs + (int64_t)MONITOR_HOLDOFF_MS * 1000;
+    }
+    if (actions & pipeline::SOLVE_CANCELLED) {
+        publishSolveStage(compass, "cancelled");
+    }
+    if (actions & pipeline::SOLVE_TRIGGERED) {
+        // PUZZLE SOLVED! The local output goes first, before anything
+        // that touches the network
+        if (compass.config->outputPin >= 0 &&
+            pipeline::outputSolved(compass.output, compass.settings.outputMode,
+                (int64_t)compass.settings.pulseMs * 1000, sample.timestampUs)) {
+            driveSolveOutput(compass);
+            if (compass.settings.outputMode == pipeline::OUTPUT_PULSE) {
+                schedulerAt(compass.outputJob, compass.output.offUs);
+            }
+        }
+        schedulerCancel(compass.dwellJob);
+        compass.puzzleWasSolved = true;
+        TRACE_INSTANT(TRACE_SOLVED, &compass - compasses);
+        recordHistory(compass, sample.timestampUs, HISTORY_SOLVED);
+        if (compass.sessionActive) {
+            publishSessionStats(compass, sample.timestampUs);
+            endSession(compass, SESSION_SOLVED);
+        }
+
+        Serial.println("========================================");
+        Serial.print("PUZZLE SOLVED! ");
+        Serial.print(compass.config->deviceName);
+        Serial.print(" points to ");
+        Serial.print(compass.config->targetName);
+        Serial.println("!");
+        Serial.println("========================================");
+
+        // Publish to Gravity Games topic
+        publishMessage(compass.topicSolved, "triggered");
+        publishSolveStage(compass, "triggered");
+
+        // Publish to status
+        publishMessage(compass.topicStatus, "SOLVED");
+        publishLog(compass, "PUZZLE SOLVED - %s aligned to %s", compass.config->deviceName, compass.config->targetName);
+    }
+}
+
+void setupSolveOutput(Compass& compass) {
+    if (compass.config->outputPin < 0) return;
+
+    // A warm restart keeps a latched output on; a pulse isn't repeated.
+    // The level goes into the GPIO output register first, so the line
+    // doesn't glitch when it becomes an output. digitalWrite() only works
+    // once pinMode() has claimed the pin, so it can't do this part
+    compass.output.on = compass.dwell.solved && compass.settings.outputMode == pipeline::OUTPUT_LATCH;
+    gpio_set_level((gpio_num_t)compass.config->outputPin, solveOutputLevel(compass));
+    pinMode(compass.config->outputPin, OUTPUT);
+    driveSolveOutput(compass);
+}
+
+int solveOutputLevel(const Compass& compass) {
+    return compass.output.on == SOLVE_OUTPUT_ACTIVE_HIGH ? HIGH : LOW;
+}
+
+void driveSolveOutput(Compass& compass) {
+    if (compass.config->outputPin < 0) return;
+    digitalWrite(compass.config->outputPin, solveOutputLevel(compass));
+}
+
+void runOutputEnd(TimerJob& job) {
+    Compass& compass = *(Compass*)job.context;
+    if (pipeline::outputExpire(compass.output, compass.settings.outputMode, nowMicros())) {
+        driveSolveOutput(compass);
+    }
+}
+
+void publishSolveStage(Compass& compass, const char* stage) {
+    // Early warning on the solve topic: "candidate" when a dwell starts,
+    // "cancelled" if it ends without a solve, then "triggered". The Solved
+    // topic keeps carrying "triggered" only, for existing subscribers
+    if (!SOLVE_CANDIDATES) return;
+    publishMessage(compass.topicSolve, stage);
+    Serial.print(compass.config->deviceName);
+    Serial.print(": solve ");
+    Serial.println(stage);
+}
+
+// ============================================
+// NOISE ANALYSIS
+// ============================================
+
+void cmdNoise(Compass& compass, const CommandArgs& args) {
+    // NOISE: capture about a second of raw conversions and publish their
+    // spectrum on the status topic. Best with nobody touching the compass;
+    // motion shows up as low-frequency energy
+    if (adcHandle == NULL) {
+        publishLog(compass, "Noise analysis needs the continuous ADC");
+        return;
+    }
+    if (compass.noiseRaw != NULL) {
+        publishLog(compass, "Noise capture already running");
+        return;
+    }
+    compass.noiseCount = 0;
+    compass.noiseFilteredCount = 0;
+    compass.noiseFiltered = (int16_t*)malloc(NOISE_POINTS / FIR_DECIMATION * sizeof(int16_t));
+    compass.noiseRaw = (int16_t*)malloc(NOISE_POINTS * sizeof(int16_t));
+    if (compass.noiseRaw == NULL || compass.noiseFiltered == NULL) {
+        finishNoise(compass);
+        publishLog(compass, "Noise capture: out of memory");
+        return;
+    }
+    publishLog(compass, "Noise capture started: %lu conversions at %lu Hz",
+        (unsigned long)NOISE_POINTS, (unsigned long)ADC_SAMPLE_FREQ_HZ);
+}
+
+void finishNoise(Compass& compass) {
+    free(compass.noiseRaw);
+    free(compass.noiseFiltered);
+    compass.noiseRaw = NULL;
+    compass.noiseFiltered = NULL;
+}
+
+float noiseRms(const int16_t* values, uint32_t count) {
+    float mean = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        mean += values[i];
+    }
+    mean /= count;
+    float sum = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        float deviation = values[i] - mean;
+        sum += deviation * deviation;
+    }
+    return sqrtf(sum / count);
+}
+
+void analyzeNoise(Compass& compass) {
+    static bool fftReady = false;
+    if (!fftReady) {
+        fftReady = (dsps_fft2r_init_fc32(NULL, NOISE_POINTS) == ESP_OK);
+    }
+
+    // Interleaved complex input, then magnitudes in place
+    float* data = (float*)heap_caps_aligned_alloc(16, NOISE_POINTS * 2 * sizeof(float), MALLOC_CAP_DEFAULT);
+    float* window = (float*)malloc(NOISE_POINTS * sizeof(float));
+    if (data == NULL || window == NULL || !fftReady) {
+        heap_caps_free(data);
+        free(window);
+        finishNoise(compass);
+        publishLog(compass, "Noise analysis failed: out of memory");
+        return;
+    }
+
+    NoiseReport report = {};
+    report.rawRms = noiseRms(compass.noiseRaw, NOISE_POINTS);
+    report.filteredRms = noiseRms(compass.noiseFiltered, compass.noiseFilteredCount);
+
+    // Hann window on the raw conversions with the mean removed
+    float mean = 0;
+    for (uint32_t i = 0; i < NOISE_POINTS; i++) {
+        mean += compass.noiseRaw[i];
+    }
+    mean /= NOISE_POINTS;
+    dsps_wind_hann_f32(window, NOISE_POINTS);
+    float windowSum = 0;
+    for (uint32_t i = 0; i < NOISE_POINTS; i++) {
+        data[2 * i] = (compass.noiseRaw[i] - mean) * window[i];
+        data[2 * i + 1] = 0;
+        windowSum += window[i];
+    }
+    finishNoise(compass);
+
+    dsps_fft2r_fc32(data, NOISE_POINTS);
+    dsps_bit_rev_fc32(data, NOISE_POINTS);
+
+    // Peak amplitude per bin, in counts
+    const uint32_t bins = NOISE_POINTS / 2;
+    for (uint32_t k = 0; k < bins; k++) {
+        float re = data[2 * k];
+        float im = data[2 * k + 1];
+        data[k] = 2.0f * sqrtf(re * re + im * im) / windowSum;
+    }
+
+    // Strongest local maxima, skipping the lowest bins (drift and motion)
+    const float binHz = (float)ADC_SAMPLE_FREQ_HZ / NOISE_POINTS;
+    for (uint32_t k = 2; k + 1 < bins; k++) {
+        if (data[k] < data[k - 1] || data[k] < data[k + 1]) continue;
+        int slot = report.peakCount;
+        while (slot > 0 && report.peakAmplitude[slot - 1] < data[k]) {
+            if (slot < NOISE_PEAKS) {
+                report.peakHz[slot] = report.peakHz[slot - 1];
+                report.peakAmplitude[slot] = report.peakAmplitude[slot - 1];
+            }
+            slot--;
+        }
+        if (slot < NOISE_PEAKS) {
+            report.peakHz[slot] = k * binHz;
+            report.peakAmplitude[slot] = data[k];
+            if (report.peakCount < NOISE_PEAKS) {
+                report.peakCount++;
+            }
+        }
+    }
+    for (uint32_t k = 1; k < bins; k++) {
+        float& band = report.band[k * NOISE_BANDS / bins];
+        if (data[k] > band) {
+            band = data[k];
+        }
+    }
+    heap_caps_free(data);
+    free(window);
+
+    // {"event":"noise","rateHz":..,"points":..,"mainsHz":..,"rms":..,
+    //  "filteredRms":..,"peaks":[{"hz":..,"amp":..},..],"bands":[..]}
+    publishStreamed(compass.topicStatus, writeNoiseReport, &report);
+}
+
+void writeNoiseReport(StreamWriter& out, const void* context) {
+    const NoiseReport& report = *(const NoiseReport*)context;
+    JsonWriter json;
+    jsonBegin(json, out);
+    jsonString(json, "event", "noise");
+    jsonInt(json, "rateHz", ADC_SAMPLE_FREQ_HZ);
+    jsonInt(json, "points", NOISE_POINTS);
+    jsonInt(json, "mainsHz", MAINS_HZ);
+    jsonFixed(json, "rms", report.rawRms, 2);
+    jsonFixed(json, "filteredRms", report.filteredRms, 2);
+    jsonBeginArray(json, "peaks");
+    for (int i = 0; i < report.peakCount; i++) {
+        jsonBeginObject(json, NULL);
+        jsonFixed(json, "hz", report.peakHz[i], 1);
+        jsonFixed(json, "amp", report.peakAmplitude[i], 2);
+        jsonEndObject(json);
+    }
+    jsonEndArray(json);
+    jsonBeginArray(json, "bands");
+    for (int i = 0; i < NOISE_BANDS; i++) {
+        jsonFixed(json, NULL, report.band[i], 2);
+    }
+    jsonEndArray(json);
+    jsonEnd(json);
+}
+
+// ============================================
+// SAMPLING PROFILER
+// ============================================
+
+void cmdProfile(Compass& compass, const CommandArgs& args) {
+    // PROFILE START [hz] | STOP | DUMP, or alone for progress. STOP also
+    // dumps the histogram on the profile topic. Profiles the core the loop
+    // runs on, whichever compass the command came in on
+    const char* action = (args.count > 1) ? args.tokens[1] : "";
+    if (strcasecmp(action, "START") == 0) {
+        uint32_t hz = PROFILE_DEFAULT_HZ;
+        if (args.count > 2) {
+            hz = strtoul(args.tokens[2], NULL, 10);
+            if (hz == 0 || hz > PROFILE_MAX_HZ) {
+                publishLog(compass, "Usage: PROFILE START [1-%lu Hz]", (unsigned long)PROFILE_MAX_HZ);
+                return;
+            }
+        }
+        if (profiler.running) {
+            publishLog(compass, "Profiler already running");
+        } else if (startProfile(hz)) {
+            publishLog(compass, "Profiler started at %lu Hz", (unsigned long)hz);
+        } else {
+            publishLog(compass, "Profiler failed to start");
+        }
+    } else if (strcasecmp(action, "STOP") == 0) {
+        if (!profiler.running) {
+            publishLog(compass, "Profiler not running");
+            return;
+        }
+        stopProfile();
+        publishProfile(compass);
+    } else if (strcasecmp(action, "DUMP") == 0) {
+        if (profiler.slots == NULL) {
+            publishLog(compass, "No profile yet");
+            return;
+        }
+        publishProfile(compass);
+    } else if (args.count == 1) {
+        int64_t endUs = profiler.running ? nowMicros() : profiler.stopUs;
+        publishLog(compass, "Profiler %s: %lu samples over %lu ms, %lu in interrupts, %lu dropped",
+            profiler.running ? "running" : "stopped", (unsigned long)profiler.samples,
+            (unsigned long)((endUs - profiler.startUs) / 1000), (unsigned long)profiler.inInterrupt,
+            (unsigned long)profiler.dropped);
+    } else {
+        publishLog(compass, "Usage: PROFILE [START [hz] | STOP | DUMP]");
+    }
+}
+
+bool startProfile(uint32_t hz) {
+    if (profiler.slots == NULL) {
+        profiler.slots = (ProfileSlot*)heap_caps_calloc(PROFILE_SLOTS, sizeof(ProfileSlot), MALLOC_CAP_INTERNAL);
+        if (profiler.slots == NULL) return false;
+    }
+    if (profiler.timer == NULL) {
+        // Created from the loop, so the interrupt is allocated on its core
+        gptimer_config_t config = {};
+        config.clk_src = GPTIMER_CLK_SRC_DEFAULT;
+        config.direction = GPTIMER_COUNT_UP;
+        config.resolution_hz = 1000000;
+        gptimer_event_callbacks_t callbacks = {};
+        callbacks.on_alarm = onProfileTick;
+        if (gptimer_new_timer(&config, &profiler.timer) != ESP_OK) {
+            profiler.timer = NULL;
+            return false;
+        }
+        if (gptimer_register_event_callbacks(profiler.timer, &callbacks, NULL) != ESP_OK) {
+            gptimer_del_timer(profiler.timer);
+            profiler.timer = NULL;
+            return false;
+        }
+    }
+
+    memset(profiler.slots, 0, PROFILE_SLOTS * sizeof(ProfileSlot));
+    profiler.samples = 0;
+    profiler.inInterrupt = 0;
+    profiler.dropped = 0;
+    profiler.hz = hz;
+
+    gptimer_alarm_config_t alarm = {};
+    alarm.alarm_count = 1000000 / hz;
+    alarm.reload_count = 0;
+    alarm.flags.auto_reload_on_alarm = 1;
+    gptimer_set_raw_count(profiler.timer, 0);
+    if (gptimer_set_alarm_action(profiler.timer, &alarm) != ESP_OK ||
+        gptimer_enable(profiler.timer) != ESP_OK) {
+        return false;
+    }
+    profiler.startUs = nowMicros();
+    profiler.running = (gptimer_start(profiler.timer) == ESP_OK);
+    if (!profiler.running) {
+        gptimer_disable(profiler.timer);
+    }
+    return profiler.running;
+}
+
+void stopProfile() {
+    gptimer_stop(profiler.timer);
+    gptimer_disable(profiler.timer);
+    profiler.running = false;
+    profiler.stopUs = nowMicros();
+}
+
+bool IRAM_ATTR onProfileTick(gptimer_handle_t timer, const gptimer_alarm_event_data_t* data, void* context) {
+    profiler.samples++;
+    // Only the outermost interrupt saves the task's frame, at the top of its
+    // stack; pxTopOfStack is the first field of the TCB
+    BaseType_t core = xPortGetCoreID();
+    if (port_interruptNesting[core] > 1) {
+        profiler.inInterrupt++;
+        return false;
+    }
+    const XtExcFrame* frame = *(XtExcFrame* const*)xTaskGetCurrentTaskHandleForCore(core);
+    uint32_t pc = (uint32_t)frame->pc;
+
+    uint32_t slot = ((pc >> 2) * 2654435761u) >> 16;
+    for (int probe = 0; probe < PROFILE_PROBES; probe++) {
+        ProfileSlot& entry = profiler.slots[(slot + probe) & (PROFILE_SLOTS - 1)];
+        if (entry.pc == pc) {
+            entry.count++;
+            return false;
+        }
+        if (entry.pc == 0) {
+            entry.pc = pc;
+            entry.count = 1;
+            return false;
+        }
+    }
+    profiler.dropped++;
+    return false;
+}
+
+void writeProfile(StreamWriter& out, const void* context) {
+    // Header: "CP", format version, 0, then u32 LE: entry count, rate (Hz),
+    // duration (ms), samples, samples in interrupts, samples dropped. Then
+    // per entry: PC and count (u32 LE each)
+    int64_t endUs = profiler.running ? nowMicros() : profiler.stopUs;
+    uint32_t entries = *(const uint32_t*)context;
+    uint32_t fields[6] = { entries, profiler.hz, (uint32_t)((endUs - profiler.startUs) / 1000),
+        profiler.samples, profiler.inInterrupt, profiler.dropped };
+    uint8_t header[4 + sizeof(fields)] = { 'C', 'P', PROFILE_FORMAT_VERSION, 0 };
+    memcpy(header + 4, fields, sizeof(fields));
+    streamWrite(out, header, sizeof(header));
+
+    for (uint32_t i = 0; i < PROFILE_SLOTS; i++) {
+        const ProfileSlot& entry = profiler.slots[i];
+        if (entry.pc == 0) continue;
+        streamWrite(out, (const uint8_t*)&entry, sizeof(entry));
+    }
+}
+
+void publishProfile(Compass& compass) {
+    // Rendered twice by publishStreamed(); a running profile keeps
+    // counting between the passes, so it's dumped from a stopped copy
+    bool resume = profiler.running;
+    if (resume) {
+        stopProfile();
+    }
+    uint32_t entries = 0;
+    for (uint32_t i = 0; i < PROFILE_SLOTS; i++) {
+        if (profiler.slots[i].pc != 0) entries++;
+    }
+
+    size_t length = publishStreamed(compass.topicProfile, writeProfile, &entries);
+    if (length > 0) {
+        publishLog(compass, "Profile: %lu samples, %lu PCs, %lu bytes",
+            (unsigned long)profiler.samples, (unsigned long)entries, (unsigned long)length);
+    }
+    if (resume) {
+        // Same profile carries on: counts and start time are kept
+        gptimer_enable(profiler.timer);
+        profiler.running = (gptimer_start(profiler.timer) == ESP_OK);
+    }
+}
+
+// ============================================
+// EVENT TRACE
+// ============================================
+
+void setupTrace() {
+    if (!TRACE_EVENTS) return;
+    uint32_t events = TRACE_PSRAM_EVENTS;
+    traceRing = (TraceEvent*)heap_caps_malloc(events * sizeof(TraceEvent), MALLOC_CAP_SPIRAM);
+    if (traceRing == NULL) {
+        events = TRACE_INTERNAL_EVENTS;
+        traceRing = (TraceEvent*)malloc(events * sizeof(TraceEvent));
+    }
+    traceCapacity = (traceRing != NULL) ? events : 0;
+    traceHead = 0;
+}
+
+void traceEvent(uint8_t phase, uint8_t id, uint32_t arg) {
+    if (traceCapacity == 0) return;
+
+    TraceEvent& event = traceRing[traceHead & (traceCapacity - 1)];
+    event.timeUs = (uint32_t)nowMicros();
+    event.phase = phase;
+    event.id = id;
+    event.arg = (arg > UINT16_MAX) ? UINT16_MAX : arg;
+    traceHead++;
+}
+
+void writeTrace(StreamWriter& out, const void* context) {
+    // Header: "CT", format version, name count, then u32 LE: event count,
+    // events ever recorded, dump time (us). Then the event names, each
+    // NUL-terminated and indexed by event id, then per event: time (u32
+    // LE, us), phase, id, arg (u16 LE)
+    const TraceRange& range = *(const TraceRange*)context;
+    uint32_t count = range.head - range.first;
+    uint8_t header[16] = { 'C', 'T', TRACE_FORMAT_VERSION, TRACE_COMMANDS + COMMAND_COUNT };
+    memcpy(header + 4, &count, sizeof(count));
+    memcpy(header + 8, &range.head, sizeof(range.head));
+    memcpy(header + 12, &range.nowUs, sizeof(range.nowUs));
+    streamWrite(out, header, sizeof(header));
+
+    for (int i = 0; i < TRACE_COMMANDS; i++) {
+        streamWrite(out, (const uint8_t*)TRACE_NAMES[i], strlen(TRACE_NAMES[i]) + 1);
+    }
+    for (int i = 0; i < COMMAND_COUNT; i++) {
+        streamWrite(out, (const uint8_t*)COMMANDS[i].name, strlen(COMMANDS[i].name) + 1);
+    }
+    for (uint32_t i = range.first; i != range.head; i++) {
+        streamWrite(out, (const uint8_t*)&traceRing[i & (traceCapacity - 1)], sizeof(TraceEvent));
+    }
+}
+
+void cmdTrace(Compass& compass, const CommandArgs& args) {
+    // TRACE DUMP: the whole ring as one binary message on the trace topic;
+    // TRACE CLEAR empties it, TRACE alone logs how full it is. The dump
+    // shows everything up to this command, which is still open
+    if (traceCapacity == 0) {
+        publishLog(compass, "Trace unavailable");
+        return;
+    }
+    const char* action = (args.count > 1) ? args.tokens[1] : "";
+    uint32_t first = (traceHead > traceCapacity) ? traceHead - traceCapacity : 0;
+    if (strcasecmp(action, "DUMP") == 0) {
+        // Snapshot the range: anything traced while streaming waits for the
+        // next dump
+        TraceRange range = { first, traceHead, (uint32_t)nowMicros() };
+        size_t length = publishStreamed(compass.topicTrace, writeTrace, &range);
+        if (length > 0) {
+            publishLog(compass, "Trace: %lu events, %lu bytes", (unsigned long)(range.head - first), (unsigned long)length);
+        }
+    } else if (strcasecmp(action, "CLEAR") == 0) {
+        traceHead = 0;
+        publishLog(compass, "Trace cleared");
+    } else if (args.count == 1) {
+        publishLog(compass, "Trace: %lu of %lu events, %lu recorded",
+            (unsigned long)(traceHead - first), (unsigned long)traceCapacity, (unsigned long)traceHead);
+    } else {
+        publishLog(compass, "Usage: TRACE [DUMP | CLEAR]");
+    }
+}
+
+// ============================================
+// ANGLE HISTORY
+// ============================================
+
+void setupHistory(Compass& compass) {
+    size_t entries = HISTORY_PSRAM_ENTRIES;
+    compass.history = (HistoryEntry*)heap_caps_malloc(entries * sizeof(HistoryEntry), MALLOC_CAP_SPIRAM);
+    if (compass.history == NULL) {
+        entries = HISTORY_INTERNAL_ENTRIES;
+        compass.history = (HistoryEntry*)malloc(entries * sizeof(HistoryEntry));
+    }
+    compass.historyCapacity = (compass.history != NULL) ? entries : 0;
+    compass.historyHead = 0;
+}
+
+void recordHistory(Compass& compass, int64_t timestampUs, HistoryKind kind) {
+    if (compass.historyCapacity == 0) return;
+
+    HistoryEntry& entry = compass.history[compass.historyHead % compass.historyCapacity];
+    entry.timeMs = (uint32_t)(timestampUs / 1000);
+    entry.angle = compass.currentAngle;
+    entry.kind = kind;
+    entry.reserved = 0;
+    compass.historyHead++;
+}
+
+uint32_t historyWindowStart(const Compass& compass, uint32_t nowMs, uint32_t windowMs) {
+    // Oldest entry still in the ring and no older than the window
+    uint32_t oldest = (compass.historyHead > compass.historyCapacity) ? compass.historyHead - compass.historyCapacity : 0;
+    uint32_t first = compass.historyHead;
+    while (first > oldest) {
+        const HistoryEntry& entry = compass.history[(first - 1) % compass.historyCapacity];
+        if (nowMs - entry.timeMs > windowMs) break;
+        first--;
+    }
+    return first;
+}
+
+void streamVarint(StreamWriter& out, uint32_t value) {
+    uint8_t bytes[5];
+    size_t count = 0;
+    do {
+        bytes[count] = value & 0x7f;
+        value >>= 7;
+        if (value != 0) {
+            bytes[count] |= 0x80;
+        }
+        count++;
+    } while (value != 0);
+    streamWrite(out, bytes, count);
+}
+
+void writeHistory(StreamWriter& out, const void* context) {
+    // Header: "CH", format version, 0, entry count (u32 LE), dump time (u32
+    // LE, ms). Then per entry: varint time delta (ms, the first one from 0)
+    // and varint (zigzag(angle delta) << 3 | kind)
+    const HistoryRange& range = *(const HistoryRange*)context;
+    const Compass& compass = *range.compass;
+    uint32_t count = compass.historyHead - range.first;
+    uint8_t header[12] = { 'C', 'H', HISTORY_FORMAT_VERSION, 0 };
+    memcpy(header + 4, &count, sizeof(count));
+    memcpy(header + 8, &range.nowMs, sizeof(range.nowMs));
+    streamWrite(out, header, sizeof(header));
+
+    uint32_t previousMs = 0;
+    int previousAngle = 0;
+    for (uint32_t i = range.first; i != compass.historyHead; i++) {
+        const HistoryEntry& entry = compass.history[i % compass.historyCapacity];
+        int delta = entry.angle - previousAngle;
+        uint32_t zigzag = (delta < 0) ? ((uint32_t)(-delta) << 1) - 1 : (uint32_t)delta << 1;
+        streamVarint(out, entry.timeMs - previousMs);
+        streamVarint(out, (zigzag << 3) | entry.kind);
+        previousMs = entry.timeMs;
+        previousAngle = entry.angle;
+    }
+}
+
+void cmdHistory(Compass& compass, const CommandArgs& args) {
+    // HISTORY [minutes]: binary dump on the history topic, streamed so it
+    // never needs a buffer the size of the message
+    if (compass.historyCapacity == 0) {
+        publishLog(compass, "History unavailable");
+        return;
+    }
+    uint32_t minutes = HISTORY_MINUTES;
+    if (args.count > 1) {
+        minutes = strtoul(args.tokens[1], NULL, 10);
+        if (minutes == 0) {
+            publishLog(compass, "Usage: HISTORY [minutes]");
+            return;
+        }
+    }
+
+    uint32_t nowMs = (uint32_t)(nowMicros() / 1000);
+    uint32_t first = historyWindowStart(compass, nowMs, minutes * 60000);
+
+    HistoryRange range = { &compass, first, nowMs };
+    size_t length = publishStreamed(compass.topicHistory, writeHistory, &range);
+    if (length > 0) {
+        publishLog(compass, "History: %lu entries, %lu bytes", (unsigned long)(compass.historyHead - first), (unsigned long)length);
+    }
+}
+
+// ============================================
+// SESSION LOG (LittleFS)
+// ============================================
+
+void sessionPath(char* path, size_t size, int segment) {
+    snprintf(path, size, "%s/%d.bin", SESSION_DIR, segment);
+}
+
+void setupSessionLog() {
+    if (!LittleFS.begin(true)) {
+        Serial.println("LittleFS unavailable, sessions not logged");
+        return;
+    }
+    LittleFS.mkdir(SESSION_DIR);
+
+    // Carry on after the segment holding the newest record
+    bool found = false;
+    for (int i = 0; i < SESSION_SEGMENTS; i++) {
+        char path[32];
+        sessionPath(path, sizeof(path), i);
+        File file = LittleFS.open(path, "r");
+        if (!file) continue;
+
+        int records = file.size() / sizeof(SessionRecord);
+        SessionRecord last;
+        if (records > 0 && file.seek((records - 1) * sizeof(SessionRecord)) &&
+            file.read((uint8_t*)&last, sizeof(last)) == sizeof(last) &&
+            (!found || last.sequence >= sessionNextSequence)) {
+            sessionSegment = i;
+            sessionSegmentRecords = records;
+            sessionNextSequence = last.sequence + 1;
+            found = true;
+        }
+        file.close();
+    }
+
+    sessionQueue = xQueueCreate(SESSION_QUEUE_LENGTH, sizeof(SessionRecord));
+    sessionLock = xSemaphoreCreateMutex();
+    if (sessionQueue == NULL || sessionLock == NULL ||
+        xTaskCreate(sessionWriter, "sessions", 4096, NULL, tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
+        sessionQueue = NULL;
+        Serial.println("Session writer unavailable, sessions not logged");
+        return;
+    }
+    Serial.print("Session log: ");
+    Serial.print(sessionNextSequence);
+    Serial.println(" sessions recorded");
+}
+
+void sessionWriter(void* parameter) {
+    // Low-priority task: collects records and writes them in one append per
+    // batch, so the loop only ever does a non-blocking queue send
+    SessionRecord batch[SESSION_BATCH_RECORDS];
+    int count = 0;
+    TickType_t firstQueued = 0;
+    const TickType_t flushTicks = pdMS_TO_TICKS(SESSION_FLUSH_DELAY);
+
+    for (;;) {
+        TickType_t wait = portMAX_DELAY;
+        if (count > 0) {
+            TickType_t waited = xTaskGetTickCount() - firstQueued;
+            wait = (waited >= flushTicks) ? 0 : flushTicks - waited;
+        }
+
+        SessionRecord record;
+        bool flush = true;
+        if (xQueueReceive(sessionQueue, &record, wait) == pdTRUE && record.outcome != SESSION_FLUSH) {
+            if (count == 0) {
+                firstQueued = xTaskGetTickCount();
+            }
+            record.sequence = sessionNextSequence++;
+            batch[count++] = record;
+            flush = (count == SESSION_BATCH_RECORDS);
+        }
+
+        if (flush && count > 0) {
+            appendSessions(batch, count);
+            count = 0;
+        }
+    }
+}
+
+void appendSessions(const SessionRecord* records, int count) {
+    xSemaphoreTake(sessionLock, portMAX_DELAY);
+    while (count > 0) {
+        const char* mode = "a";
+        if (sessionSegmentRecords == SESSION_SEGMENT_RECORDS) {
+            // Segment full: move on, overwriting the oldest
+            sessionSegment = (sessionSegment + 1) % SESSION_SEGMENTS;
+            sessionSegmentRecords = 0;
+            mode = "w";
+        }
+
+        int space = SESSION_SEGMENT_RECORDS - sessionSegmentRecords;
+        int n = (count < space) ? count : space;
+        char path[32];
+        sessionPath(path, sizeof(path), sessionSegment);
+        File file = LittleFS.open(path, mode);
+        if (!file) break;
+        file.write((const uint8_t*)records, n * sizeof(SessionRecord));
+        file.close();
+
+        sessionSegmentRecords += n;
+        records += n;
+        count -= n;
+    }
+    xSemaphoreGive(sessionLock);
+}
+
+void startSession(Compass& compass) {
+    time_t now = time(NULL);
+    compass.sessionActive = true;
+    compass.sessionStartUs = nowMicros();
+    compass.sessionStartTime = (now >= CLOCK_VALID_AFTER) ? (uint32_t)now : 0;
+    memset(&compass.stats, 0, sizeof(compass.stats));
+}
+
+void publishSessionStats(Compass& compass, int64_t endUs) {
+    // {"event":"session","solveMs":..,"passes":..,"nearTargetMs":..,
+    //  "travel":..,"sectorMs":{"N":..,...}} on the status topic
+    SessionSummary summary = { &compass, endUs };
+    publishStreamed(compass.topicStatus, writeSessionStats, &summary);
+}
+
+void writeSessionStats(StreamWriter& out, const void* context) {
+    const SessionSummary& summary = *(const SessionSummary*)context;
+    const Compass& compass = *summary.compass;
+    const pipeline::SessionStats& stats = compass.stats;
+    JsonWriter json;
+    jsonBegin(json, out);
+    jsonString(json, "event", "session");
+    jsonInt(json, "solveMs", (summary.endUs - compass.sessionStartUs) / 1000);
+    jsonInt(json, "passes", stats.passes);
+    jsonInt(json, "nearTargetMs", stats.nearTargetMs);
+    jsonInt(json, "travel", stats.travelDegrees);
+    jsonBeginObject(json, "sectorMs");
+    for (int i = 0; i < 8; i++) {
+        jsonInt(json, pipeline::DIRECTION_NAMES[i], stats.sectorMs[i]);
+    }
+    jsonEndObject(json);
+    jsonEnd(json);
+}
+
+void endSession(Compass& compass, SessionOutcome outcome) {
+    compass.sessionActive = false;
+    if (sessionQueue == NULL) return;
+
+    SessionRecord record = {};
+    record.startTime = compass.sessionStartTime;
+    record.durationMs = (uint32_t)((nowMicros() - compass.sessionStartUs) / 1000);
+    record.compass = &compass - compasses;
+    record.outcome = outcome;
+    if (xQueueSend(sessionQueue, &record, 0) != pdTRUE) {
+        sessionDrops++;
+    }
+}
+
+void flushSessionLog() {
+    if (sessionQueue == NULL) return;
+
+    SessionRecord marker = {};
+    marker.outcome = SESSION_FLUSH;
+    xQueueSend(sessionQueue, &marker, 0);
+}
+
+uint32_t readSessions(SessionRecord* records, uint32_t skip, uint32_t count) {
+    // Copies count records, after skipping the oldest skip, into records.
+    // Segments are read oldest first: the one after the current segment,
+    // round to the current one. Called with sessionLock held
+    uint32_t copied = 0;
+    for (int s = 1; s <= SESSION_SEGMENTS && copied < count; s++) {
+        char path[32];
+        sessionPath(path, sizeof(path), (sessionSegment + s) % SESSION_SEGMENTS);
+        File file = LittleFS.open(path, "r");
+        if (!file) continue;
+
+        uint32_t available = file.size() / sizeof(SessionRecord);
+        if (skip >= available) {
+            skip -= available;
+            file.close();
+            continue;
+        }
+        file.seek(skip * sizeof(SessionRecord));
+        available -= skip;
+        skip = 0;
+
+        uint32_t n = count - copied;
+        if (n > available) n = available;
+        size_t bytes = file.read((uint8_t*)(records + copied), n * sizeof(SessionRecord));
+        file.close();
+        copied += bytes / sizeof(SessionRecord);
+        if (bytes != n * sizeof(SessionRecord)) break;
+    }
+    return copied;
+}
+
+void writeSessions(StreamWriter& out, const void* context) {
+    // Header: "CS", format version, record size, record count (u32 LE),
+    // then the records oldest first
+    const SessionRange& range = *(const SessionRange*)context;
+    uint8_t header[8] = { 'C', 'S', SESSION_FORMAT_VERSION, sizeof(SessionRecord) };
+    memcpy(header + 4, &range.count, sizeof(range.count));
+    streamWrite(out, header, sizeof(header));
+    streamWrite(out, (const uint8_t*)range.records, range.count * sizeof(SessionRecord));
+}
+
+void cmdSessions(Compass& compass, const CommandArgs& args) {
+    // SESSIONS [count]: the newest records (default all) as one binary
+    // message on the sessions topic. Records still batched in RAM aren't
+    // included until the writer flushes them
+    if (sessionQueue == NULL) {
+        publishLog(compass, "Session log unavailable");
+        return;
+    }
+
+    // The records are copied out under the lock and streamed after it is
+    // released, so the writer task never waits on the network
+    xSemaphoreTake(sessionLock, portMAX_DELAY);
+    uint32_t total = 0;
+    for (int i = 0; i < SESSION_SEGMENTS; i++) {
+        char path[32];
+        sessionPath(path, sizeof(path), i);
+        File file = LittleFS.open(path, "r");
+        if (file) {
+            total += file.size() / sizeof(SessionRecord);
+            file.close();
+        }
+    }
+    uint32_t count = total;
+    if (args.count > 1) {
+        uint32_t requested = strtoul(args.tokens[1], NULL, 10);
+        if (requested < count) {
+            count = requested;
+        }
+    }
+
+    size_t bytes = (count > 0) ? count * sizeof(SessionRecord) : 1;
+    SessionRecord* records = (SessionRecord*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM);
+    if (records == NULL) {
+        records = (SessionRecord*)malloc(bytes);
+    }
+    if (records == NULL) {
+        xSemaphoreGive(sessionLock);
+        publishLog(compass, "Sessions: no memory for %lu records", (unsigned long)count);
+        return;
+    }
+    SessionRange range = { records, readSessions(records, total - count, count) };
+    xSemaphoreGive(sessionLock);
+
+    bool sent = (publishStreamed(compass.topicSessions, writeSessions, &range) > 0);
+    free(records);
+
+    if (sent) {
+        publishLog(compass, "Sessions: %lu of %lu records (%lu dropped)", (unsigned long)range.count, (unsigned long)total, (unsigned long)sessionDrops);
+    }
+}
+
+// ============================================
+// WARM RESTART
+// ============================================
+
+uint32_t snapshotCrc(const WarmSnapshot& snapshot) {
+    return esp_rom_crc32_le(0, (const uint8_t*)&snapshot, offsetof(WarmSnapshot, crc));
+}
+
+bool restoreSnapshot() {
+    // RTC memory is random after power-on, and a snapshot from other
+    // firmware may have a different layout
+    bool valid = warmSnapshot.magic == WARM_SNAPSHOT_MAGIC &&
+        strncmp(warmSnapshot.version, FIRMWARE_VERSION, sizeof(warmSnapshot.version)) == 0 &&
+        warmSnapshot.crc == snapshotCrc(warmSnapshot);
+    if (!valid) {
+        memset(&warmSnapshot, 0, sizeof(warmSnapshot));
+        warmSnapshot.magic = WARM_SNAPSHOT_MAGIC;
+        strncpy(warmSnapshot.version, FIRMWARE_VERSION, sizeof(warmSnapshot.version) - 1);
+        return false;
+    }
+
+    for (int i = 0; i < COMPASS_COUNT; i++) {
+        Compass& compass = compasses[i];
+        const CompassSnapshot& saved = warmSnapshot.compasses[i];
+        compass.tracker.primed = saved.trackerPrimed;
+        compass.tracker.position = saved.trackerPosition;
+        compass.tracker.velocity = saved.trackerVelocity;
+        compass.lastRawValue = saved.lastRawValue;
+        compass.currentAngle = saved.currentAngle;
+        compass.report.lastAngle = saved.lastReportedAngle;
+        compass.dwell.solved = saved.puzzleSolved;
+        compass.puzzleWasSolved = saved.puzzleWasSolved;
+        memcpy(compass.recentRequests, saved.recentRequests, sizeof(compass.recentRequests));
+        compass.recentRequestHead = saved.recentRequestHead;
+
+        Serial.print(compass.config->deviceName);
+        Serial.print(": resumed at ");
+        Serial.print(compass.currentAngle);
+        Serial.println(compass.dwell.solved ? " deg, solved" : " deg");
+    }
+    return true;
+}
+
+void saveSnapshot() {
+    // Called after every sampling pass; the network cache is kept as is
+    for (int i = 0; i < COMPASS_COUNT; i++) {
+        const Compass& compass = compasses[i];
+        CompassSnapshot& saved = warmSnapshot.compasses[i];
+        saved.trackerPrimed = compass.tracker.primed;
+        saved.trackerPosition = compass.tracker.position;
+        saved.trackerVelocity = compass.tracker.velocity;
+        saved.lastRawValue = compass.lastRawValue;
+        saved.currentAngle = compass.currentAngle;
+        saved.lastReportedAngle = compass.report.lastAngle;
+        saved.puzzleSolved = compass.dwell.solved;
+        saved.puzzleWasSolved = compass.puzzleWasSolved;
+        memcpy(saved.recentRequests, compass.recentRequests, sizeof(saved.recentRequests));
+        saved.recentRequestHead = compass.recentRequestHead;
+    }
+    warmSnapshot.crc = snapshotCrc(warmSnapshot);
+}
+
+void cacheNetwork() {
+    NetworkCache& network = warmSnapshot.network;
+    const uint8_t* bssid = WiFi.BSSID();
+    if (bssid == NULL) return;
+
+    memcpy(network.bssid, bssid, sizeof(network.bssid));
+    network.channel = WiFi.channel();
+    network.valid = 1;
+    warmSnapshot.crc = snapshotCrc(warmSnapshot);
+}
+
+bool connectCachedWiFi() {
+    // Only after a warm restart: the access point is the one we had moments
+    // ago. Falls back to a normal scan if it fails
+    NetworkCache& network = warmSnapshot.network;
+    if (!warmRestart || !network.valid) return false;
+
+    Serial.print(" (cached)");
+    WiFi.begin(WIFI_SSID, WIFI_PASSWORD, network.channel, network.bssid);
+
+    int attempts = 0;
+    while (WiFi.status() != WL_CONNECTED && attempts < WARM_WIFI_ATTEMPTS) {
+        delay(500);
+        Serial.print(".");
+        attempts++;
+    }
+    if (WiFi.status() == WL_CONNECTED) return true;
+
+    // Scan for the full connect
+    network.valid = 0;
+    warmSnapshot.crc = snapshotCrc(warmSnapshot);
+    WiFi.disconnect();
+    return false;
+}
+
+// ============================================
+// BOOT PROFILE
+// ============================================
+
+void startBootProfile() {
+    // RTC memory is random after power-on; a valid profile means this is a
+    // soft reset (RESET command, panic, watchdog)
+    if (bootProfile.magic == BOOT_PROFILE_MAGIC) {
+        lastBoot = bootProfile;
+        lastBoot.version[sizeof(lastBoot.version) - 1] = '\0';
+        lastBootValid = true;
+    } else {
+        bootProfile.bootCount = 0;
+    }
+
+    uint32_t bootCount = bootProfile.bootCount + 1;
+    memset(&bootProfile, 0, sizeof(bootProfile));
+    bootProfile.magic = BOOT_PROFILE_MAGIC;
+    bootProfile.bootCount = bootCount;
+    bootProfile.resetReason = esp_reset_reason();
+    strncpy(bootProfile.version, FIRMWARE_VERSION, sizeof(bootProfile.version) - 1);
+}
+
+void markBootPhase(BootPhase phase) {
+    // First time only; later reconnects aren't part of the boot
+    if (bootProfile.phaseUs[phase] == 0) {
+        bootProfile.phaseUs[phase] = (uint32_t)esp_timer_get_time();
+    }
+}
+
+void onWiFiEvent(arduino_event_id_t event, arduino_event_info_t info) {
+    // Runs on the WiFi event task; each phase is a single word write
+    if (event == ARDUINO_EVENT_WIFI_STA_CONNECTED) {
+        markBootPhase(BOOT_WIFI_ASSOCIATED);
+    } else if (event == ARDUINO_EVENT_WIFI_STA_GOT_IP) {
+        markBootPhase(BOOT_DHCP);
+    }
+}
+
+const char* resetReasonName(uint32_t reason) {
+    switch (reason) {
+        case ESP_RST_POWERON: return "power-on";
+        case ESP_RST_EXT: return "external";
+        case ESP_RST_SW: return "software";
+        case ESP_RST_PANIC: return "panic";
+        case ESP_RST_INT_WDT:
+        case ESP_RST_TASK_WDT:
+        case ESP_RST_WDT: return "watchdog";
+        case ESP_RST_DEEPSLEEP: return "deep-sleep";
+        case ESP_RST_BROWNOUT: return "brownout";
+        default: return "other";
+    }
+}
+
+void publishBootProfile(Compass& compass) {
+    publishStreamed(compass.topicStatus, writeBootProfile, NULL);
+}
+
+void writeBootProfile(StreamWriter& out, const void* context) {
+    // {"event":"boot","version":..,"bootCount":..,"reset":..,"serialMs":..,
+    //  ..., "lastVersion":..,"lastReachedMs":..,"lastStalledAfter":..}
+    // Phases not reached are left out
+    JsonWriter json;
+    jsonBegin(json, out);
+    jsonString(json, "event", "boot");
+    jsonString(json, "version", bootProfile.version);
+    jsonInt(json, "bootCount", bootProfile.bootCount);
+    jsonString(json, "reset", resetReasonName(bootProfile.resetReason));
+    jsonBool(json, "warm", warmRestart);
+    for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+        if (bootProfile.phaseUs[i] != 0) {
+            jsonInt(json, BOOT_PHASE_NAMES[i], bootProfile.phaseUs[i] / 1000);
+        }
+    }
+
+    if (lastBootValid) {
+        // Last phase the previous boot finished, and when
+        int reached = -1;
+        for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+            if (lastBoot.phaseUs[i] != 0 && (reached < 0 || lastBoot.phaseUs[i] > lastBoot.phaseUs[reached])) {
+                reached = i;
+            }
+        }
+        jsonString(json, "lastVersion", lastBoot.version);
+        if (reached >= 0) {
+            jsonInt(json, "lastReachedMs", lastBoot.phaseUs[reached] / 1000);
+        }
+        if (lastBoot.phaseUs[BOOT_SUBSCRIBED] == 0) {
+            jsonString(json, "lastStalledAfter", reached >= 0 ? BOOT_PHASE_NAMES[reached] : "reset");
+        }
+    }
+    jsonEnd(json);
+}
+
+// ============================================
+// HEALTH MONITOR
+// ============================================
+
+void updateHealth(int64_t busyUs) {
+    // Called once per loop pass: heap high-water, fragmentation and the time
+    // spent running jobs
+    uint32_t freeHeap = ESP.getFreeHeap();
+    if (freeHeap < health.minFreeHeap) {
+        health.minFreeHeap = freeHeap;
+    }
+    if (freeHeap > 0) {
+        uint32_t fragmentation = 100 - (uint32_t)((uint64_t)ESP.getMaxAllocHeap() * 100 / freeHeap);
+        if (fragmentation > health.maxFragmentation) {
+            health.maxFragmentation = fragmentation;
+        }
+    }
+
+    busyUs /= SOAK_CLOCK_SCALE;
+    if (busyUs > health.maxLoopUs) {
+        health.maxLoopUs = busyUs;
+    }
+    health.totalLoopUs += busyUs;
+    health.loopPasses++;
+}
+
+void checkSampleTiming(Compass& compass, const AngleSample& sample) {
+    // The gap spanning a change of sampling mode is judged on the longer
+    // of the two periods
+    int32_t periodMs = samplePeriodMs;
+    if (compass.lastSampleUs < samplePeriodChangedUs && previousSamplePeriodMs > periodMs) {
+        periodMs = previousSamplePeriodMs;
+    }
+    const int64_t samplePeriodUs = (int64_t)periodMs * 1000 * SOAK_CLOCK_SCALE;
+
+    if (compass.lastSampleUs != 0) {
+        if (sample.timestampUs <= compass.lastSampleUs) {
+            health.clockFaults++;
+        } else if (sample.timestampUs - compass.lastSampleUs > 3 * samplePeriodUs) {
+            health.sampleGaps++;
+        }
+    }
+    compass.lastSampleUs = sample.timestampUs;
+}
+
+// ============================================
+// MOTION-AWARE SAMPLING
+// ============================================
+
+void trackMotion(Compass& compass, const AngleSample& sample) {
+    // A touch is net movement away from where the compass settled, so slow
+    // turns count but a degree or two of jitter doesn't
+    if (compass.restAngle < 0 || pipeline::angleDistance(sample.angle, compass.restAngle) >= MOTION_DEGREES) {
+        compass.restAngle = sample.angle;
+        compass.lastMotionUs = sample.timestampUs;
+    }
+
+    // Spin speed straight from the angle tracker
+    if (abs(sample.degreesPerS) >= FAST_DEGREES_PER_S) {
+        compass.lastFastUs = sample.timestampUs;
+    }
+}
+
+void updateSamplingMode() {
+    // The most active compass sets the pace; a running dwell keeps at least
+    // the normal rate so leaving the target is seen promptly
+    int64_t now = nowMicros();
+    SamplingMode mode = SAMPLING_IDLE;
+    for (int i = 0; i < COMPASS_COUNT; i++) {
+        const Compass& compass = compasses[i];
+        if (compass.lastFastUs != 0 && now - compass.lastFastUs < (int64_t)FAST_HOLD_MS * 1000) {
+            mode = SAMPLING_FAST;
+        } else if (mode == SAMPLING_IDLE &&
+                   (compass.restAngle < 0 || compass.dwell.active ||
+                    now - compass.lastMotionUs < (int64_t)IDLE_AFTER_MS * 1000)) {
+            mode = SAMPLING_ACTIVE;
+        }
+    }
+    if (mode == samplingMode) return;
+
+    samplingMode = mode;
+    applySamplePeriod(samplingPeriodFor(mode));
+    Serial.print("Sampling: ");
+    Serial.print(SAMPLING_MODE_NAMES[mode]);
+    Serial.print(" (");
+    Serial.print(samplePeriodMs);
+    Serial.println(" ms)");
+}
+
+int32_t samplingPeriodFor(SamplingMode mode) {
+    // Fast is never slower than "loop", idle never faster
+    switch (mode) {
+        case SAMPLING_FAST:
+            return board.loopDelayMs < (int32_t)SAMPLE_FAST_MS ? board.loopDelayMs : SAMPLE_FAST_MS;
+        case SAMPLING_IDLE:
+            return board.loopDelayMs > (int32_t)SAMPLE_IDLE_MS ? board.loopDelayMs : SAMPLE_IDLE_MS;
+        default:
+            return board.loopDelayMs;
+    }
+}
+
+void applySamplePeriod(int32_t periodMs) {
+    if (periodMs == samplePeriodMs) return;
+
+    for (int i = 0; i < COMPASS_COUNT; i++) {
+        pipeline::trackerRescale(compasses[i].tracker, (int64_t)samplePeriodMs * 1000, (int64_t)periodMs * 1000);
+    }
+    previousSamplePeriodMs = samplePeriodMs;
+    samplePeriodMs = periodMs;
+    samplePeriodChangedUs = nowMicros();
+    schedulerEvery(sampleJob, realMicros((int64_t)samplePeriodMs * 1000));
+}
+
+// ============================================
+// SOAK MODE
+// ============================================
+
+int soakPotRaw(Compass& compass, int raw) {
+    // Synthetic player: mostly small wobbles, occasional spins, and now and
+    // then parking on the target long enough to solve
+    static int position[COMPASS_COUNT];
+    static int parkedSamples[COMPASS_COUNT];
+    int index = &compass - compasses;
+
+    if (parkedSamples[index] > 0) {
+        parkedSamples[index]--;
+        return position[index];
+    }
+
+    long roll = random(1000);
+    if (roll < 5) {
+        position[index] = map(compass.config->targetDirection, 0, 359, 0, 4095);
+        parkedSamples[index] = random(10, 200);
+    } else if (roll < 50) {
+        position[index] = random(4096);
+    } else {
+        position[index] = constrain(position[index] + (int)random(-40, 41), 0, 4095);
+    }
+    return position[index];
+}
+
+void soakChaos() {
+    static int64_t nextDisconnectUs = 0;
+    static int64_t nextCommandUs = 0;
+    static int64_t nextReportUs = 0;
+    int64_t now = nowMicros();
+
+    // Drop the broker session every few virtual minutes
+    if (now >= nextDisconnectUs) {
+        if (nextDisconnectUs != 0) {
+            mqtt.disconnect();
+        }
+        nextDisconnectUs = now + random(60, 600) * 1000000LL;
+    }
+
+    // Inject a random Watchtower command (never RESET)
+    if (now >= nextCommandUs) {
+        if (nextCommandUs != 0) {
+            static const char* SCRIPTS[] = {"PING", "status", "PUZZLE_RESET", "BOGUS", "PING;STATUS", "SET threshold 3", "SET tolerance x"};
+            char text[64];
+            strncpy(text, SCRIPTS[random(sizeof(SCRIPTS) / sizeof(SCRIPTS[0]))], sizeof(text) - 1);
+            text[sizeof(text) - 1] = '\0';
+            handleCommand(compasses[random(COMPASS_COUNT)], text);
+        }
+        nextCommandUs = now + random(5, 120) * 1000000LL;
+    }
+
+    if (now >= nextReportUs) {
+        publishLog(compasses[0],
+            "SOAK uptime:%llus heapFree:%lu heapMin:%lu heapFrag:%lu%% clockFaults:%lu sampleGaps:%lu loopOverruns:%lu maxLoop:%lldus",
+            (unsigned long long)(now / 1000000),
+            (unsigned long)ESP.getFreeHeap(),
+            (unsigned long)health.minFreeHeap,
+            (unsigned long)health.maxFragmentation,
+            (unsigned long)health.clockFaults,
+            (unsigned long)health.sampleGaps,
+            (unsigned long)health.loopOverruns,
+            (long long)health.maxLoopUs);
+        nextReportUs = now + (int64_t)SOAK_REPORT_INTERVAL * 1000;
+    }
+}
@@ -0,0 +1,12 @@
+// ============================================
+// COMPASS FIRMWARE
+// The puzzle controller shared by the compass props. Each PlatformIO
+// project only supplies config/PropConfig.h (device name, pot and output
+// pins, target and the COMPASSES table) and calls these from setup() and
+// loop().
+// ============================================
+
+#pragma once
+
+void compassSetup();
+void compassLoop();
@@ -0,0 +1,428 @@
+// ============================================
+// COMPASS PIPELINE
+// Sensing and puzzle logic shared by the compass firmware and the host
+// tools in tools/. Plain integer code with no Arduino dependencies, so a
+// trace replayed on a PC goes through exactly the steps the prop runs.
+// ============================================
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+namespace pipeline {
+
+const int RAW_MAX = 4095;  // 12-bit ADC
+const int ANGLE_MAX = 359;
+const int FILTER_ALPHA_ONE = 256;  // Tracker gains are Q8
+const int FILTER_ALPHA_DEFAULT = 128;  // Position gain
+const int TRACKER_BETA_DEFAULT = 32;  // Velocity gain
+const int TRACKER_BETA_MAX = 128;  // Stable for every alpha
+const int SETTLE_SPEED_DEFAULT = 45;  // Degrees/s still counted as settled
+
+// ============================================
+// MAINS FIR
+// Lighting dimmers couple mains hum into the pot wiring. Conversions go
+// through a decimating FIR whose window spans a whole number of mains
+// cycles: equal weights, so a comb with a null on every harmonic. The
+// firmware runs it with esp-dsp's S3 SIMD kernel (dsps_fird_s16); firStep()
+// is a scalar model of the same arithmetic, written from esp-dsp's ANSI
+// version (the firmware checks the S3 kernel against it at boot, see
+// checkFirKernel()): Q15 taps oldest sample first, input
+// shifted up FIR_INPUT_SHIFT, a 0x7fff rounding term and a 15-bit shift,
+// then rounded back to ADC counts.
+// ============================================
+
+const uint32_t FIR_MAX_TAPS = 128;
+const int FIR_INPUT_SHIFT = 3;  // 12-bit raw to 15 bits for Q15 arithmetic
+const int32_t FIR_ROUNDING = 0x7fff;  // dsps_fird_init_s16() with shift 0
+
+// Shortest window of whole mains cycles in whole conversions (50 = 3 cycles
+// of 60 Hz at 1 kHz)
+constexpr uint32_t mainsWindow(uint32_t conversionHz, uint32_t mainsHz, uint32_t cycles = 1) {
+    return (cycles * conversionHz) % mainsHz == 0 ? cycles * conversionHz / mainsHz : mainsWindow(conversionHz, mainsHz, cycles + 1);
+}
+
+// The S3 kernel works in blocks of 8 taps; the padding taps are zero
+constexpr uint32_t firTaps(uint32_t window) {
+    return (window + 7) & ~7u;
+}
+
+// Equal Q15 weights across the window, summing to exactly 1.0
+inline void firCoefficients(int16_t* coeffs, uint32_t window, uint32_t taps) {
+    for (uint32_t i = 0; i < taps; i++) {
+        coeffs[i] = (i < window) ? (int16_t)(32768 * (i + 1) / window - 32768 * i / window) : 0;
+    }
+}
+
+inline int16_t firInput(int raw) {
+    return (int16_t)(raw << FIR_INPUT_SHIFT);
+}
+
+// Kernel output back to ADC counts, rounded
+inline int firOutputRaw(int16_t filtered) {
+    return (filtered + (1 << (FIR_INPUT_SHIFT - 1))) >> FIR_INPUT_SHIFT;
+}
+
+struct Fir {
+    int16_t coeffs[FIR_MAX_TAPS];
+    int16_t delay[FIR_MAX_TAPS];
+    uint32_t taps;
+    uint32_t decimation;  // Conversions per output
+    uint32_t pos;  // Oldest sample in the delay line
+    uint32_t blockCount;
+    bool primed;  // false until the first conversion
+    int output;  // Latest output, 0-4095
+};
+
+inline void firInit(Fir& fir, uint32_t window, uint32_t decimation) {
+    fir.taps = firTaps(window);
+    fir.decimation = decimation;
+    firCoefficients(fir.coeffs, window, fir.taps);
+    fir.pos = 0;
+    fir.blockCount = 0;
+    fir.primed = false;
+    fir.output = 0;
+}
+
+// One conversion in; true when it completes a block of decimation
+// conversions and fir.output is new. The first conversion fills the delay
+// line, so the output starts at that value rather than ramping up from 0.
+inline bool firStep(Fir& fir, int raw) {
+    int16_t scaled = firInput(raw);
+    if (!fir.primed) {
+        for (uint32_t i = 0; i < fir.taps; i++) {
+            fir.delay[i] = scaled;
+        }
+        fir.output = raw;
+        fir.primed = true;
+    }
+    fir.delay[fir.pos] = scaled;
+    fir.pos = (fir.pos + 1 == fir.taps) ? 0 : fir.pos + 1;
+    if (++fir.blockCount < fir.decimation) {
+        return false;
+    }
+    fir.blockCount = 0;
+
+    int64_t acc = FIR_ROUNDING;
+    uint32_t n = 0;
+    for (uint32_t k = fir.pos; k < fir.taps; k++) {
+        acc += (int32_t)fir.coeffs[n++] * fir.delay[k];
+    }
+    for (uint32_t k = 0; k < fir.pos; k++) {
+        acc += (int32_t)fir.coeffs[n++] * fir.delay[k];
+    }
+    fir.output = firOutputRaw((int16_t)(acc >> 15));
+    return true;
+}
+
+// ============================================
+// ANGLE TRACKER
+// Alpha-beta filter on the raw ADC value: predicts each sample from the
+// last position and velocity, then corrects both by a share of the error.
+// It follows a turn without the lag an equally quiet plain average has, and
+// its velocity tells a compass sweeping through the target from one
+// stopped on it. Position is Q8 ADC counts, velocity Q8 counts per sample.
+// With beta 0 it is the plain exponential average at alpha.
+// ============================================
+
+struct Tracker {
+    bool primed;  // false until the first sample
+    int32_t position;
+    int32_t velocity;
+};
+
+inline void trackerStep(Tracker& tracker, int raw, int alphaQ8, int betaQ8) {
+    int32_t measured = raw << 8;
+    if (!tracker.primed) {
+        tracker.primed = true;
+        tracker.position = measured;
+        tracker.velocity = 0;
+        return;
+    }
+    int32_t predicted = tracker.position + tracker.velocity;
+    int32_t residual = measured - predicted;
+    tracker.position = predicted + ((residual * alphaQ8) >> 8);
+    tracker.velocity += (residual * betaQ8) >> 8;
+}
+
+// Tracked position in whole ADC counts, rounded
+inline int trackerRaw(const Tracker& tracker) {
+    return (tracker.position + 128) >> 8;
+}
+
+// Velocity is per sample, so it has to follow a change of sample period
+inline void trackerRescale(Tracker& tracker, int64_t oldPeriodUs, int64_t newPeriodUs) {
+    tracker.velocity = (int32_t)((int64_t)tracker.velocity * newPeriodUs / oldPeriodUs);
+}
+
+// Tracker velocity to degrees per second, and back
+inline int velocityToDegreesPerS(int32_t velocity, int64_t periodUs) {
+    return (int)((int64_t)velocity * ANGLE_MAX * 1000000 / ((int64_t)RAW_MAX * 256 * periodUs));
+}
+
+inline int32_t degreesPerSToVelocity(int degreesPerS, int64_t periodUs) {
+    return (int32_t)((int64_t)degreesPerS * RAW_MAX * 256 * periodUs / ((int64_t)ANGLE_MAX * 1000000));
+}
+
+// Tracked ADC value to 0-359 degrees, as map() + constrain()
+inline int rawToAngle(int filtered) {
+    int angle = filtered * ANGLE_MAX / RAW_MAX;
+    if (angle < 0) return 0;
+    if (angle > ANGLE_MAX) return ANGLE_MAX;
+    return angle;
+}
+
+const char* const DIRECTION_NAMES[8] = {"N", "NE", "E", "SE", "S", "SW", "W", "NW"};
+
+// 8-point compass sector: N=0, NE=1, ... NW=7. Each covers 45 degrees
+// centred on its direction.
+inline int directionIndex(int angle) {
+    return ((angle + 22) % 360) / 45;
+}
+
+inline const char* directionName(int angle) {
+    return DIRECTION_NAMES[directionIndex(angle)];
+}
+
+// Shortest way round the dial between two angles (0-180)
+inline int angleDistance(int angle, int target) {
+    int diff = abs(angle - target);
+    if (diff > 180) {
+        diff = 360 - diff;
+    }
+    return diff;
+}
+
+// Direction updates go out once the angle has moved this far from the
+// last one reported (-1 before the first report), and no faster than
+// REPORT_MIN_US apart: a change held back by the cap goes out on a later
+// sample. Start lastReportUs at -REPORT_MIN_US so the first can go at once
+const int64_t REPORT_MIN_US = 20000;  // Direction reports at most 50Hz
+
+inline bool shouldReport(int angle, int lastReported, int threshold, int64_t timestampUs, int64_t lastReportUs) {
+    return abs(angle - lastReported) >= threshold && timestampUs - lastReportUs >= REPORT_MIN_US;
+}
+
+// The last report, for reportStep()
+struct ReportState {
+    int lastAngle;  // -1 before the first report
+    int64_t lastUs;
+};
+
+inline void reportReset(ReportState& report) {
+    report.lastAngle = -1;
+    report.lastUs = -REPORT_MIN_US;
+}
+
+// true if this sample's angle is reported; it becomes the last report
+inline bool reportStep(ReportState& report, int angle, int threshold, int64_t timestampUs) {
+    if (!shouldReport(angle, report.lastAngle, threshold, timestampUs, report.lastUs)) {
+        return false;
+    }
+    report.lastAngle = angle;
+    report.lastUs = timestampUs;
+    return true;
+}
+
+// ============================================
+// DWELL / SOLVE
+// The compass must stay within tolerance of the target for the debounce
+// time, measured on sample timestamps. A dwell only starts, and only
+// completes, while the compass is settled: turning slower than
+// settleVelocity. Sweeping through the window doesn't count.
+// ============================================
+
+struct DwellParams {
+    int target;
+    int tolerance;
+    int64_t debounceUs;
+    int64_t settleUs;  // Grace after a dwell started by the ADC monitor
+    int32_t settleVelocity;  // Tracker units, see degreesPerSToVelocity()
+};
+
+struct DwellState {
+    bool solved;
+    bool active;  // At target, waiting out the debounce time
+    bool fromMonitor;  // Started from an ADC monitor hit, not a sample
+    int64_t startUs;
+};
+
+enum DwellEvent {
+    DWELL_NONE,
+    DWELL_STARTED,
+    DWELL_CONFIRMED,  // First settled sample inside a monitor-started dwell
+    DWELL_CANCELLED,
+    DWELL_SOLVED
+};
+
+inline DwellEvent dwellStep(DwellState& state, const DwellParams& params, int angle, int32_t velocity, int64_t timestampUs) {
+    bool isAtTarget = angleDistance(angle, params.target) <= params.tolerance;
+    bool settled = abs(velocity) <= params.settleVelocity;
+
+    if (isAtTarget) {
+        if (state.solved || !settled) {
+            return DWELL_NONE;
+        }
+        if (!state.active) {
+            state.active = true;
+            state.fromMonitor = false;
+            state.startUs = timestampUs;
+            return DWELL_STARTED;
+        }
+        if (timestampUs - state.startUs >= params.debounceUs) {
+            state.solved = true;
+            state.active = false;
+            return DWELL_SOLVED;
+        }
+        // A monitor hit is one raw conversion; the filtered sample agreeing
+        // makes it a real entry
+        if (state.fromMonitor) {
+            state.fromMonitor = false;
+            return DWELL_CONFIRMED;
+        }
+        return DWELL_NONE;
+    }
+
+    // Samples averaged across a monitor-detected entry still lag behind
+    // it; they don't count as leaving
+    if (state.active && state.fromMonitor && timestampUs < state.startUs + params.settleUs) {
+        return DWELL_NONE;
+    }
+    if (!state.active) {
+        return DWELL_NONE;
+    }
+    state.active = false;
+    return DWELL_CANCELLED;
+}
+
+// What each dwell event publishes and records, in the order the firmware
+// sends it. unconfirmed: read before dwellStep(), the dwell was started by
+// the ADC monitor and no sample has confirmed it yet
+enum SolveAction : uint32_t {
+    SOLVE_CANDIDATE = 1 << 0,  // "candidate" on the solve topic
+    SOLVE_DWELL_START = 1 << 1,  // History entry; arm the debounce deadline
+    SOLVE_DWELL_CANCEL = 1 << 2,  // History entry; drop the deadline
+    SOLVE_MONITOR_HOLDOFF = 1 << 3,  // Unconfirmed monitor hit: quiet the monitor
+    SOLVE_CANCELLED = 1 << 4,  // "cancelled" on the solve topic
+    SOLVE_TRIGGERED = 1 << 5  // Output, history, session stats and the solved messages
+};
+
+inline uint32_t solveActions(DwellEvent event, bool unconfirmed) {
+    switch (event) {
+        case DWELL_STARTED:
+            return SOLVE_CANDIDATE | SOLVE_DWELL_START;
+        case DWELL_CONFIRMED:
+            return SOLVE_CANDIDATE;
+        case DWELL_CANCELLED:
+            return SOLVE_DWELL_CANCEL | (unconfirmed ? SOLVE_MONITOR_HOLDOFF : SOLVE_CANCELLED);
+        case DWELL_SOLVED:
+            return SOLVE_TRIGGERED;
+        case DWELL_NONE:
+            break;
+    }
+    return 0;
+}
+
+// ============================================
+// SOLVE OUTPUT
+// A GPIO line switched by the solve itself, not by a message round trip:
+// a timed pulse, or latched until PUZZLE_RESET. Each call returns true
+// when the line has to change to state.on.
+// ============================================
+
+enum OutputMode {
+    OUTPUT_NONE,
+    OUTPUT_PULSE,
+    OUTPUT_LATCH
+};
+
+struct OutputState {
+    bool on;
+    int64_t offUs;  // Pulse end
+};
+
+inline bool outputSolved(OutputState& state, int mode, int64_t pulseUs, int64_t timestampUs) {
+    if (mode == OUTPUT_NONE || state.on) {
+        return false;
+    }
+    state.on = true;
+    state.offUs = timestampUs + pulseUs;
+    return true;
+}
+
+// Ends a pulse once its time is up
+inline bool outputExpire(OutputState& state, int mode, int64_t timestampUs) {
+    if (!state.on || mode == OUTPUT_LATCH || timestampUs < state.offUs) {
+        return false;
+    }
+    state.on = false;
+    return true;
+}
+
+// PUZZLE_RESET, or the output being switched off
+inline bool outputRelease(OutputState& state) {
+    if (!state.on) {
+        return false;
+    }
+    state.on = false;
+    return true;
+}
+
+// ============================================
+// SESSION STATS
+// Gameplay statistics from a puzzle reset to the solve, updated in O(1)
+// per sample and published once at the solve.
+// ============================================
+
+// Zeroed at the start of a session
+struct SessionStats {
+    bool started;  // false until the session's first sample
+    int64_t lastSampleUs;
+    bool inWindow;  // Last sample was within tolerance of the target
+    bool nearTarget;  // ... within twice the tolerance
+    int sector;  // DIRECTION_NAMES index of the last sample
+    int travelAnchor;  // Angle travel was last counted from
+    uint32_t passes;  // Entries into the target window
+    uint32_t travelDegrees;
+    uint32_t nearTargetMs;
+    uint32_t sectorMs[8];  // Time pointing at each of the 8 directions
+};
+
+inline void sessionStep(SessionStats& stats, int angle, int target, int tolerance, int threshold, int64_t timestampUs) {
+    int distance = angleDistance(angle, target);
+    bool inWindow = (distance <= tolerance);
+
+    if (!stats.started) {
+        stats.started = true;
+        stats.travelAnchor = angle;
+        stats.passes = inWindow ? 1 : 0;
+    } else {
+        // Time since the previous sample goes to where it was pointing
+        uint32_t elapsedMs = (uint32_t)((timestampUs - stats.lastSampleUs) / 1000);
+        stats.sectorMs[stats.sector] += elapsedMs;
+        if (stats.nearTarget) {
+            stats.nearTargetMs += elapsedMs;
+        }
+        if (inWindow && !stats.inWindow) {
+            stats.passes++;
+        }
+
+        // Travel counts in steps of the report threshold, so sensor jitter
+        // doesn't add up to phantom rotation
+        int moved = angle - stats.travelAnchor;
+        if (moved > 180) moved -= 360;
+        if (moved < -180) moved += 360;
+        if (abs(moved) >= threshold) {
+            stats.travelDegrees += abs(moved);
+            stats.travelAnchor = angle;
+        }
+    }
+
+    stats.lastSampleUs = timestampUs;
+    stats.inWindow = inWindow;
+    stats.nearTarget = (distance <= 2 * tolerance);
+    stats.sector = directionIndex(angle);
+}
+
+}  // namespace pipeline
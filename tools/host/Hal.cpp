@@ -0,0 +1,1134 @@
+// ============================================
+// HOST HAL: clock, tasks, ADC, GPIO, heap, flash and the rest of the
+// Arduino core and ESP-IDF calls the firmware makes. The network is in
+// Network.cpp. See HostHal.h
+// ============================================
+
+#define HOST_HAL_INTERNAL  // Real malloc/free in here
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <Preferences.h>
+#include <driver/gpio.h>
+#include <driver/gptimer.h>
+#include <esp_adc/adc_continuous.h>
+#include <esp_adc/adc_monitor.h>
+#include <esp_dsp.h>
+#include <esp_heap_caps.h>
+#include <esp_rom_crc.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HostHal.h"
+
+// ============================================
+// CLOCK
+// ============================================
+
+namespace {
+
+const int64_t BOOT_US = 30000;  // Bootloader and startup before app_main()
+
+std::atomic<int64_t> clockUs(BOOT_US);
+
+struct HostEvent {
+    int64_t us;
+    uint64_t order;  // Same time: in the order they were scheduled
+    std::function<void()> run;
+};
+
+struct LaterEvent {
+    bool operator()(const HostEvent& a, const HostEvent& b) const {
+        return a.us != b.us ? a.us > b.us : a.order > b.order;
+    }
+};
+
+std::priority_queue<HostEvent, std::vector<HostEvent>, LaterEvent> events;
+uint64_t eventOrder = 0;
+std::atomic<uint32_t> loopNotify(0);
+
+int64_t nextAdcFrameUs();
+void completeAdcFrame();
+
+// Moves the clock to targetUs, completing ADC frames and running harness
+// events on the way. Stops early once the loop task has been notified, if
+// it is waiting for that
+void advance(int64_t targetUs, bool wakeOnNotify) {
+    for (;;) {
+        int64_t next = targetUs;
+        int64_t frameUs = nextAdcFrameUs();
+        if (frameUs < next) {
+            next = frameUs;
+        }
+        if (!events.empty() && events.top().us < next) {
+            next = events.top().us;
+        }
+        if (next == INT64_MAX) {
+            fprintf(stderr, "host: loop task blocked forever\n");
+            abort();
+        }
+        if (next > clockUs) {
+            clockUs = next;
+        }
+
+        if (frameUs <= clockUs) {
+            completeAdcFrame();
+        }
+        while (!events.empty() && events.top().us <= clockUs) {
+            std::function<void()> run = events.top().run;
+            events.pop();
+            run();
+        }
+
+        if ((wakeOnNotify && loopNotify > 0) || clockUs >= targetUs) return;
+    }
+}
+
+// Wall clock: seconds since boot until SNTP syncs, as newlib counts them
+bool clockSynced = false;
+time_t syncEpoch = 0;
+int64_t syncUs = 0;
+
+}  // namespace
+
+int64_t esp_timer_get_time() {
+    return clockUs;
+}
+
+extern "C" unsigned long millis() {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+extern "C" unsigned long micros() {
+    return (uint32_t)esp_timer_get_time();
+}
+
+void delay(uint32_t ms) {
+    advance(clockUs + (int64_t)ms * 1000, false);
+}
+
+// Linked with --wrap=time: the firmware's time() reads the virtual clock
+extern "C" time_t __wrap_time(time_t* out) {
+    int64_t us = clockUs;
+    time_t now = clockSynced ? syncEpoch + (time_t)((us - syncUs) / 1000000) : (time_t)(us / 1000000);
+    if (out != nullptr) {
+        *out = now;
+    }
+    return now;
+}
+
+void configTime(long gmtOffsetSec, int daylightOffsetSec, const char* server1, const char* server2, const char* server3) {
+    // The harness decides when the answer arrives (host::syncClock)
+}
+
+// ============================================
+// TASKS
+// ============================================
+
+namespace {
+
+// A TCB whose first word points at a saved frame, as the profiler expects
+struct HostTask {
+    void* topOfStack;
+};
+
+HostTask loopTaskTcb = { nullptr };
+thread_local HostTask* currentTask = &loopTaskTcb;
+
+struct HostQueue {
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<std::vector<uint8_t>> items;
+    size_t length;
+    size_t itemSize;
+};
+
+struct HostSemaphore {
+    std::mutex lock;
+    std::condition_variable changed;
+    bool taken = false;
+};
+
+}  // namespace
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+    return currentTask;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandleForCore(BaseType_t core) {
+    return &loopTaskTcb;
+}
+
+BaseType_t xPortGetCoreID() {
+    return 1;
+}
+
+extern "C" {
+volatile unsigned port_interruptNesting[portNUM_PROCESSORS] = {};
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char* name, uint32_t stackDepth, void* parameter,
+    UBaseType_t priority, TaskHandle_t* created) {
+    // Other tasks are threads. They only block on queues and mutexes,
+    // which time out on the virtual clock
+    HostTask* tcb = new HostTask{ nullptr };
+    std::thread([tcb, task, parameter]() {
+        currentTask = tcb;
+        task(parameter);
+    }).detach();
+    if (created != nullptr) {
+        *created = tcb;
+    }
+    return pdPASS;
+}
+
+TickType_t xTaskGetTickCount() {
+    return (TickType_t)(clockUs / 1000);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    advance((clockUs / 1000 + ticks) * 1000, false);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+    // The loop task's sleep: the clock runs to the tick it would wake on
+    if (loopNotify == 0 && ticks > 0) {
+        int64_t targetUs = (ticks == portMAX_DELAY) ? INT64_MAX : (clockUs / 1000 + ticks) * 1000;
+        advance(targetUs, true);
+    }
+    uint32_t value = loopNotify;
+    if (value > 0) {
+        loopNotify = clearOnExit ? 0 : value - 1;
+    }
+    return value;
+}
+
+void xTaskNotifyGive(TaskHandle_t task) {
+    loopNotify++;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higherPriorityTaskWoken) {
+    loopNotify++;
+    if (higherPriorityTaskWoken != nullptr) {
+        *higherPriorityTaskWoken = pdTRUE;
+    }
+}
+
+namespace {
+
+// Waits on a condition for up to ticks of virtual time. The other thread
+// polls the clock, which only the loop task moves
+template <typename Ready>
+bool waitTicks(std::unique_lock<std::mutex>& lock, std::condition_variable& changed, TickType_t ticks, Ready ready) {
+    TickType_t start = xTaskGetTickCount();
+    while (!ready()) {
+        if (ticks != portMAX_DELAY && xTaskGetTickCount() - start >= ticks) return false;
+        changed.wait_for(lock, std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+}  // namespace
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+    HostQueue* queue = new HostQueue;
+    queue->length = length;
+    queue->itemSize = itemSize;
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t handle, const void* item, TickType_t ticks) {
+    HostQueue& queue = *(HostQueue*)handle;
+    std::unique_lock<std::mutex> lock(queue.lock);
+    if (!waitTicks(lock, queue.changed, ticks, [&] { return queue.items.size() < queue.length; })) return pdFALSE;
+    const uint8_t* bytes = (const uint8_t*)item;
+    queue.items.emplace_back(bytes, bytes + queue.itemSize);
+    queue.changed.notify_all();
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t handle, void* item, TickType_t ticks) {
+    HostQueue& queue = *(HostQueue*)handle;
+    std::unique_lock<std::mutex> lock(queue.lock);
+    if (!waitTicks(lock, queue.changed, ticks, [&] { return !queue.items.empty(); })) return pdFALSE;
+    memcpy(item, queue.items.front().data(), queue.itemSize);
+    queue.items.pop_front();
+    queue.changed.notify_all();
+    return pdTRUE;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return new HostSemaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t handle, TickType_t ticks) {
+    HostSemaphore& semaphore = *(HostSemaphore*)handle;
+    std::unique_lock<std::mutex> lock(semaphore.lock);
+    if (!waitTicks(lock, semaphore.changed, ticks, [&] { return !semaphore.taken; })) return pdFALSE;
+    semaphore.taken = true;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t handle) {
+    HostSemaphore& semaphore = *(HostSemaphore*)handle;
+    std::lock_guard<std::mutex> lock(semaphore.lock);
+    semaphore.taken = false;
+    semaphore.changed.notify_all();
+    return pdTRUE;
+}
+
+// ============================================
+// HEAP
+// ============================================
+
+namespace {
+
+const size_t INTERNAL_HEAP_BYTES = 240 * 1024;  // S3 free internal RAM with WiFi and MQTT up
+const size_t PSRAM_HEAP_BYTES = 8 * 1024 * 1024;
+const size_t MALLOC_INTERNAL_MAX = 4096;  // CONFIG_SPIRAM_MALLOC_ALWAYSINTERNAL: larger malloc()s try PSRAM first
+
+// First fit over a fixed region, merging neighbours on free, so the
+// largest free block (ESP.getMaxAllocHeap()) shows fragmentation
+class Arena {
+public:
+    void reset(size_t bytes) {
+        ::free(base);
+        base = bytes > 0 ? (uint8_t*)::malloc(bytes) : nullptr;
+        size = bytes;
+        freeBlocks.clear();
+        usedBlocks.clear();
+        if (bytes > 0) {
+            freeBlocks[0] = bytes;
+        }
+        used = 0;
+        peak = 0;
+    }
+
+    void* allocate(size_t bytes, size_t alignment) {
+        bytes = (bytes + 7) & ~(size_t)7;
+        if (bytes == 0) {
+            bytes = 8;
+        }
+        for (auto block = freeBlocks.begin(); block != freeBlocks.end(); ++block) {
+            size_t start = block->first;
+            size_t end = start + block->second;
+            size_t aligned = (((uintptr_t)base + start + alignment - 1) & ~(uintptr_t)(alignment - 1)) - (uintptr_t)base;
+            if (aligned + bytes > end) continue;
+
+            freeBlocks.erase(block);
+            if (aligned > start) {
+                freeBlocks[start] = aligned - start;
+            }
+            if (aligned + bytes < end) {
+                freeBlocks[aligned + bytes] = end - aligned - bytes;
+            }
+            usedBlocks[aligned] = bytes;
+            used += bytes;
+            if (used > peak) {
+                peak = used;
+            }
+            return base + aligned;
+        }
+        return nullptr;
+    }
+
+    bool owns(const void* pointer) const {
+        return base != nullptr && pointer >= base && pointer < base + size;
+    }
+
+    void release(void* pointer) {
+        size_t offset = (uint8_t*)pointer - base;
+        auto block = usedBlocks.find(offset);
+        if (block == usedBlocks.end()) {
+            fprintf(stderr, "host: free() of %p, not an allocation\n", pointer);
+            abort();
+        }
+        size_t bytes = block->second;
+        usedBlocks.erase(block);
+        used -= bytes;
+
+        auto next = freeBlocks.lower_bound(offset);
+        if (next != freeBlocks.end() && next->first == offset + bytes) {
+            bytes += next->second;
+            next = freeBlocks.erase(next);
+        }
+        if (next != freeBlocks.begin()) {
+            auto previous = std::prev(next);
+            if (previous->first + previous->second == offset) {
+                previous->second += bytes;
+                return;
+            }
+        }
+        freeBlocks[offset] = bytes;
+    }
+
+    size_t largestFree() const {
+        size_t largest = 0;
+        for (const auto& block : freeBlocks) {
+            largest = std::max(largest, block.second);
+        }
+        return largest;
+    }
+
+    uint8_t* base = nullptr;
+    size_t size = 0;
+    size_t used = 0;
+    size_t peak = 0;
+
+private:
+    std::map<size_t, size_t> freeBlocks;  // Offset -> bytes
+    std::map<size_t, size_t> usedBlocks;
+};
+
+std::mutex heapLock;
+Arena internalHeap;
+Arena psramHeap;
+bool heapReady = false;
+bool psramPresent = true;
+uint32_t heapAllocations = 0;
+uint32_t heapFailures = 0;
+
+void setupHeap() {
+    if (heapReady) return;
+    internalHeap.reset(INTERNAL_HEAP_BYTES);
+    psramHeap.reset(psramPresent ? PSRAM_HEAP_BYTES : 0);
+    heapReady = true;
+}
+
+void* heapAllocate(size_t bytes, size_t alignment, unsigned caps) {
+    std::lock_guard<std::mutex> lock(heapLock);
+    setupHeap();
+    void* pointer = nullptr;
+    if (caps & MALLOC_CAP_SPIRAM) {
+        pointer = psramHeap.allocate(bytes, alignment);
+    } else if (caps & MALLOC_CAP_INTERNAL) {
+        pointer = internalHeap.allocate(bytes, alignment);
+    } else if (bytes > MALLOC_INTERNAL_MAX) {
+        pointer = psramHeap.allocate(bytes, alignment);
+        if (pointer == nullptr) {
+            pointer = internalHeap.allocate(bytes, alignment);
+        }
+    } else {
+        pointer = internalHeap.allocate(bytes, alignment);
+        if (pointer == nullptr) {
+            pointer = psramHeap.allocate(bytes, alignment);
+        }
+    }
+    if (pointer != nullptr) {
+        heapAllocations++;
+    } else if (psramPresent || !(caps & MALLOC_CAP_SPIRAM)) {
+        heapFailures++;  // Not the firmware asking a board without PSRAM, before it falls back
+    }
+    return pointer;
+}
+
+}  // namespace
+
+void* hostMalloc(size_t size) {
+    return heapAllocate(size, 8, MALLOC_CAP_DEFAULT);
+}
+
+void hostFree(void* pointer) {
+    if (pointer == nullptr) return;
+    std::lock_guard<std::mutex> lock(heapLock);
+    if (internalHeap.owns(pointer)) {
+        internalHeap.release(pointer);
+    } else if (psramHeap.owns(pointer)) {
+        psramHeap.release(pointer);
+    } else {
+        fprintf(stderr, "host: free() of %p, outside the heap\n", pointer);
+        abort();
+    }
+}
+
+void* heap_caps_malloc(size_t size, unsigned caps) {
+    return heapAllocate(size, 8, caps);
+}
+
+void* heap_caps_calloc(size_t count, size_t size, unsigned caps) {
+    void* pointer = heapAllocate(count * size, 8, caps);
+    if (pointer != nullptr) {
+        memset(pointer, 0, count * size);
+    }
+    return pointer;
+}
+
+void* heap_caps_aligned_alloc(size_t alignment, size_t size, unsigned caps) {
+    return heapAllocate(size, alignment, caps);
+}
+
+void heap_caps_free(void* pointer) {
+    hostFree(pointer);
+}
+
+// ============================================
+// ESP, SERIAL AND ARDUINO CORE
+// ============================================
+
+namespace {
+
+bool serialEcho = false;
+std::mt19937 randomEngine(1);
+
+}  // namespace
+
+EspClass ESP;
+HardwareSerial Serial;
+
+uint64_t EspClass::getEfuseMac() {
+    return 0x5c3b2a18f0dcULL;
+}
+
+uint32_t EspClass::getFreeHeap() {
+    std::lock_guard<std::mutex> lock(heapLock);
+    setupHeap();
+    return internalHeap.size - internalHeap.used;
+}
+
+uint32_t EspClass::getMaxAllocHeap() {
+    std::lock_guard<std::mutex> lock(heapLock);
+    setupHeap();
+    return internalHeap.largestFree();
+}
+
+void EspClass::restart() {
+    // Harnesses don't send RESET: globals would carry over into a second
+    // compassSetup()
+    fflush(stdout);
+    fprintf(stderr, "host: ESP.restart()\n");
+    _Exit(3);
+}
+
+esp_reset_reason_t esp_reset_reason() {
+    return ESP_RST_POWERON;
+}
+
+size_t Print::printf(const char* format, ...) {
+    char text[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (length < 0) return 0;
+    return write((const uint8_t*)text, std::min((size_t)length, sizeof(text) - 1));
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+    if (serialEcho) {
+        fwrite(buffer, 1, size, stdout);
+    }
+    return size;
+}
+
+long random(long howbig) {
+    if (howbig <= 0) return 0;
+    return (long)(randomEngine() % (uint32_t)howbig);
+}
+
+long random(long howsmall, long howbig) {
+    if (howsmall >= howbig) return howsmall;
+    return random(howbig - howsmall) + howsmall;
+}
+
+long map(long x, long inMin, long inMax, long outMin, long outMax) {
+    long run = inMax - inMin;
+    if (run == 0) return -1;
+    return (x - inMin) * (outMax - outMin) / run + outMin;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buffer, uint32_t length) {
+    crc = ~crc;
+    for (uint32_t i = 0; i < length; i++) {
+        crc ^= buffer[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+// ============================================
+// GPIO
+// ============================================
+
+namespace {
+
+const int GPIO_COUNT = 49;
+
+std::vector<host::PinWrite> gpioLog;
+int gpioLevel[GPIO_COUNT] = {};
+bool gpioOutput[GPIO_COUNT] = {};
+uint32_t gpioMisuses = 0;
+std::map<int, int> potLevels;  // GPIO -> raw
+
+void setLevel(int pin, int level) {
+    gpioLevel[pin] = level ? HIGH : LOW;
+    gpioLog.push_back({ clockUs, pin, gpioLevel[pin], gpioOutput[pin] });
+}
+
+}  // namespace
+
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level) {
+    if (gpio < 0 || gpio >= GPIO_COUNT) return ESP_ERR_INVALID_ARG;
+    setLevel(gpio, level);
+    return ESP_OK;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (pin >= GPIO_COUNT) return;
+    gpioOutput[pin] = (mode == OUTPUT);
+}
+
+void digitalWrite(uint8_t pin, uint8_t level) {
+    // The core only writes pins it has set up
+    if (pin >= GPIO_COUNT || !gpioOutput[pin]) {
+        gpioMisuses++;
+        return;
+    }
+    setLevel(pin, level);
+}
+
+int analogRead(uint8_t pin) {
+    auto pot = potLevels.find(pin);
+    return pot != potLevels.end() ? pot->second : 0;
+}
+
+void analogReadResolution(uint8_t bits) {}
+void analogSetPinAttenuation(uint8_t pin, adc_attenuation_t attenuation) {}
+
+// ============================================
+// CONTINUOUS ADC AND MONITORS
+// ============================================
+
+struct adc_continuous_ctx_t {
+    uint32_t frameBytes;
+    uint32_t poolFrames;
+    std::vector<adc_digi_pattern_config_t> pattern;
+    uint32_t sampleHz;
+    adc_continuous_evt_cbs_t callbacks;
+    void* context;
+    bool running;
+    int64_t startUs;
+    uint64_t framesDone;
+    uint32_t patternIndex;
+    std::deque<std::vector<uint8_t>> pool;
+};
+
+struct adc_monitor_t {
+    adc_continuous_ctx_t* scan;
+    adc_monitor_config_t config;
+    adc_monitor_evt_cbs_t callbacks;
+    void* context;
+    bool enabled;
+};
+
+namespace {
+
+const int MONITOR_COUNT = 2;
+
+adc_continuous_ctx_t* adcScan = nullptr;
+adc_monitor_t* monitors[MONITOR_COUNT] = {};
+
+int channelGpio(int channel) {
+    return channel + 1;  // ADC1 channel n is GPIO n+1 on the S3
+}
+
+uint32_t conversionsPerFrame(const adc_continuous_ctx_t& scan) {
+    return scan.frameBytes / SOC_ADC_DIGI_RESULT_BYTES;
+}
+
+int64_t nextAdcFrameUs() {
+    if (adcScan == nullptr || !adcScan->running || adcScan->sampleHz == 0) return INT64_MAX;
+    uint64_t conversions = (adcScan->framesDone + 1) * conversionsPerFrame(*adcScan);
+    return adcScan->startUs + (int64_t)(conversions * 1000000 / adcScan->sampleHz);
+}
+
+void completeAdcFrame() {
+    // DMA finished a frame: the conversion interrupt, the monitors on its
+    // conversions, then the pool (full: the overflow callback, frame lost)
+    adc_continuous_ctx_t& scan = *adcScan;
+    std::vector<uint8_t> frame(scan.frameBytes);
+    std::vector<std::pair<adc_monitor_t*, bool>> hits;
+    for (uint32_t i = 0; i < conversionsPerFrame(scan); i++) {
+        const adc_digi_pattern_config_t& slot = scan.pattern[scan.patternIndex];
+        scan.patternIndex = (scan.patternIndex + 1) % scan.pattern.size();
+        int raw = constrain(analogRead(channelGpio(slot.channel)), 0, 4095);
+
+        adc_digi_output_data_t result = {};
+        result.type2.data = raw;
+        result.type2.channel = slot.channel;
+        result.type2.unit = slot.unit;
+        memcpy(&frame[i * SOC_ADC_DIGI_RESULT_BYTES], &result, sizeof(result));
+
+        for (adc_monitor_t* monitor : monitors) {
+            if (monitor == nullptr || !monitor->enabled || monitor->config.channel != slot.channel) continue;
+            if (monitor->config.h_threshold >= 0 && raw > monitor->config.h_threshold) {
+                hits.push_back({ monitor, true });
+            }
+            if (monitor->config.l_threshold >= 0 && raw < monitor->config.l_threshold) {
+                hits.push_back({ monitor, false });
+            }
+        }
+    }
+    scan.framesDone++;
+
+    adc_continuous_evt_data_t data = { frame.data(), scan.frameBytes };
+    if (scan.callbacks.on_conv_done != nullptr) {
+        scan.callbacks.on_conv_done(&scan, &data, scan.context);
+    }
+    for (const auto& hit : hits) {
+        adc_monitor_t* monitor = hit.first;
+        adc_monitor_evt_cb_t callback = hit.second ? monitor->callbacks.on_over_high_thresh : monitor->callbacks.on_below_low_thresh;
+        adc_monitor_evt_data_t event = { ADC_UNIT_1 };
+        if (monitor->enabled && callback != nullptr) {
+            callback(monitor, &event, monitor->context);
+        }
+    }
+    if (scan.pool.size() < scan.poolFrames) {
+        scan.pool.push_back(std::move(frame));
+    } else if (scan.callbacks.on_pool_ovf != nullptr) {
+        scan.callbacks.on_pool_ovf(&scan, &data, scan.context);
+    }
+}
+
+}  // namespace
+
+esp_err_t adc_continuous_io_to_channel(int gpio, adc_unit_t* unit, adc_channel_t* channel) {
+    if (gpio >= 1 && gpio <= 10) {
+        *unit = ADC_UNIT_1;
+        *channel = (adc_channel_t)(gpio - 1);
+    } else if (gpio >= 11 && gpio <= 20) {
+        *unit = ADC_UNIT_2;
+        *channel = (adc_channel_t)(gpio - 11);
+    } else {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_new_handle(const adc_continuous_handle_cfg_t* config, adc_continuous_handle_t* handle) {
+    if (adcScan != nullptr || config->conv_frame_size == 0 || config->conv_frame_size % SOC_ADC_DIGI_RESULT_BYTES != 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    adcScan = new adc_continuous_ctx_t{};
+    adcScan->frameBytes = config->conv_frame_size;
+    adcScan->poolFrames = config->max_store_buf_size / config->conv_frame_size;
+    *handle = adcScan;
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_config(adc_continuous_handle_t handle, const adc_continuous_config_t* config) {
+    if (handle->running || config->pattern_num == 0 || config->pattern_num > SOC_ADC_PATT_LEN_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    handle->pattern.assign(config->adc_pattern, config->adc_pattern + config->pattern_num);
+    handle->sampleHz = config->sample_freq_hz;
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_register_event_callbacks(adc_continuous_handle_t handle, const adc_continuous_evt_cbs_t* callbacks, void* context) {
+    if (handle->running) return ESP_ERR_INVALID_STATE;
+    handle->callbacks = *callbacks;
+    handle->context = context;
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_start(adc_continuous_handle_t handle) {
+    if (handle->running || handle->pattern.empty()) return ESP_ERR_INVALID_STATE;
+    handle->running = true;
+    handle->startUs = clockUs;
+    handle->framesDone = 0;
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_stop(adc_continuous_handle_t handle) {
+    if (!handle->running) return ESP_ERR_INVALID_STATE;
+    handle->running = false;
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_read(adc_continuous_handle_t handle, uint8_t* buffer, uint32_t length, uint32_t* read, uint32_t timeoutMs) {
+    // Whole frames from the pool, as the driver hands them out when the
+    // buffer holds one
+    if (handle->pool.empty()) {
+        *read = 0;
+        return ESP_ERR_TIMEOUT;
+    }
+    std::vector<uint8_t>& frame = handle->pool.front();
+    uint32_t count = std::min(length, (uint32_t)frame.size());
+    memcpy(buffer, frame.data(), count);
+    *read = count;
+    handle->pool.pop_front();
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_flush_pool(adc_continuous_handle_t handle) {
+    if (handle->running) return ESP_ERR_INVALID_STATE;
+    handle->pool.clear();
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_deinit(adc_continuous_handle_t handle) {
+    if (handle->running) return ESP_ERR_INVALID_STATE;
+    for (adc_monitor_t* monitor : monitors) {
+        if (monitor != nullptr && monitor->scan == handle) return ESP_ERR_INVALID_STATE;
+    }
+    delete handle;
+    adcScan = nullptr;
+    return ESP_OK;
+}
+
+esp_err_t adc_new_continuous_monitor(adc_continuous_handle_t handle, const adc_monitor_config_t* config, adc_monitor_handle_t* monitor) {
+    // Monitors can only be created with the scan stopped
+    if (handle->running) return ESP_ERR_INVALID_STATE;
+    for (adc_monitor_t*& slot : monitors) {
+        if (slot != nullptr) continue;
+        slot = new adc_monitor_t{ handle, *config, {}, nullptr, false };
+        *monitor = slot;
+        return ESP_OK;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t adc_continuous_monitor_register_event_callbacks(adc_monitor_handle_t monitor, const adc_monitor_evt_cbs_t* callbacks, void* context) {
+    if (monitor->enabled) return ESP_ERR_INVALID_STATE;
+    monitor->callbacks = *callbacks;
+    monitor->context = context;
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_monitor_enable(adc_monitor_handle_t monitor) {
+    if (monitor->enabled) return ESP_ERR_INVALID_STATE;
+    monitor->enabled = true;
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_monitor_disable(adc_monitor_handle_t monitor) {
+    if (!monitor->enabled) return ESP_ERR_INVALID_STATE;
+    monitor->enabled = false;
+    return ESP_OK;
+}
+
+esp_err_t adc_del_continuous_monitor(adc_monitor_handle_t monitor) {
+    if (monitor->enabled) return ESP_ERR_INVALID_STATE;
+    for (adc_monitor_t*& slot : monitors) {
+        if (slot == monitor) {
+            slot = nullptr;
+        }
+    }
+    delete monitor;
+    return ESP_OK;
+}
+
+// ============================================
+// GENERAL PURPOSE TIMER
+// ============================================
+
+esp_err_t gptimer_new_timer(const gptimer_config_t* config, gptimer_handle_t* timer) { return ESP_ERR_NOT_SUPPORTED; }
+esp_err_t gptimer_del_timer(gptimer_handle_t timer) { return ESP_ERR_INVALID_STATE; }
+esp_err_t gptimer_register_event_callbacks(gptimer_handle_t timer, const gptimer_event_callbacks_t* callbacks, void* context) { return ESP_ERR_INVALID_STATE; }
+esp_err_t gptimer_set_alarm_action(gptimer_handle_t timer, const gptimer_alarm_config_t* config) { return ESP_ERR_INVALID_STATE; }
+esp_err_t gptimer_set_raw_count(gptimer_handle_t timer, uint64_t value) { return ESP_ERR_INVALID_STATE; }
+esp_err_t gptimer_enable(gptimer_handle_t timer) { return ESP_ERR_INVALID_STATE; }
+esp_err_t gptimer_disable(gptimer_handle_t timer) { return ESP_ERR_INVALID_STATE; }
+esp_err_t gptimer_start(gptimer_handle_t timer) { return ESP_ERR_INVALID_STATE; }
+esp_err_t gptimer_stop(gptimer_handle_t timer) { return ESP_ERR_INVALID_STATE; }
+
+// ============================================
+// ESP-DSP (ANSI kernels)
+// ============================================
+
+esp_err_t dsps_fird_init_s16(fir_s16_t* fir, int16_t* coeffs, int16_t* delay, int16_t coeffs_len,
+    int16_t decim, int16_t start_pos, int16_t shift) {
+    fir->coeffs = coeffs;
+    fir->delay = delay;
+    fir->coeffs_len = coeffs_len;
+    fir->pos = 0;
+    fir->decim = decim;
+    fir->d_pos = start_pos;
+    fir->shift = shift;
+    fir->rounding_buff = nullptr;
+    fir->rounding_val = (shift >= 0 && shift < 15) ? (0x7fff >> shift) : 0;  // 0x7fff at shift 0
+    fir->free_status = 0;
+    return ESP_OK;
+}
+
+int32_t dsps_fird_s16(fir_s16_t* fir, const int16_t* input, int16_t* output, int32_t len) {
+    // Taps oldest sample first from the delay line's read position, a
+    // rounding term, and the sum shifted down by 15 - shift
+    const int finalShift = 15 - fir->shift;
+    int32_t outputs = 0;
+    for (int32_t i = 0; i < len; i++) {
+        for (int j = 0; j < fir->decim; j++) {
+            fir->delay[fir->pos] = *input++;
+            fir->pos = (fir->pos + 1 == fir->coeffs_len) ? 0 : fir->pos + 1;
+        }
+        int64_t acc = fir->rounding_val;
+        int n = 0;
+        for (int k = fir->pos; k < fir->coeffs_len; k++) {
+            acc += (int32_t)fir->coeffs[n++] * fir->delay[k];
+        }
+        for (int k = 0; k < fir->pos; k++) {
+            acc += (int32_t)fir->coeffs[n++] * fir->delay[k];
+        }
+        output[outputs++] = (int16_t)(acc >> finalShift);
+    }
+    return outputs;
+}
+
+esp_err_t dsps_fft2r_init_fc32(float* fft_table_buff, int table_size) {
+    return (table_size > 0 && (table_size & (table_size - 1)) == 0) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t dsps_fft2r_fc32(float* data, int N) {
+    // Radix-2 decimation in frequency, in place: natural order in,
+    // bit-reversed order out (dsps_bit_rev_fc32() puts it straight)
+    for (int span = N / 2; span >= 1; span /= 2) {
+        for (int start = 0; start < N; start += 2 * span) {
+            for (int k = 0; k < span; k++) {
+                double angle = -M_PI * k / span;
+                float c = (float)cos(angle);
+                float s = (float)sin(angle);
+                float* a = &data[2 * (start + k)];
+                float* b = &data[2 * (start + k + span)];
+                float re = a[0] - b[0];
+                float im = a[1] - b[1];
+                a[0] += b[0];
+                a[1] += b[1];
+                b[0] = re * c - im * s;
+                b[1] = re * s + im * c;
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t dsps_bit_rev_fc32(float* data, int N) {
+    for (int i = 1, j = 0; i < N; i++) {
+        int bit = N >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            std::swap(data[2 * i], data[2 * j]);
+            std::swap(data[2 * i + 1], data[2 * j + 1]);
+        }
+    }
+    return ESP_OK;
+}
+
+void dsps_wind_hann_f32(float* window, int len) {
+    for (int i = 0; i < len; i++) {
+        window[i] = 0.5f - 0.5f * cosf(2 * (float)M_PI * i / (len - 1));
+    }
+}
+
+// ============================================
+// FLASH: LITTLEFS AND NVS
+// ============================================
+
+namespace fs {
+
+struct FileState {
+    std::vector<uint8_t>* data;
+    size_t position;
+    bool writable;
+};
+
+}  // namespace fs
+
+fs::LittleFSFS LittleFS;
+
+namespace {
+
+// The writer task and the loop both touch the files
+std::mutex flashLock;
+std::map<std::string, std::vector<uint8_t>> files;
+std::map<std::string, std::vector<uint8_t>> nvs;  // "namespace/key"
+
+}  // namespace
+
+bool fs::LittleFSFS::begin(bool formatOnFail, const char* basePath, uint8_t maxOpenFiles, const char* partitionLabel) {
+    return true;
+}
+
+bool fs::LittleFSFS::mkdir(const char* path) {
+    return true;
+}
+
+fs::File fs::LittleFSFS::open(const char* path, const char* mode, bool create) {
+    std::lock_guard<std::mutex> lock(flashLock);
+    auto file = files.find(path);
+    if (mode[0] == 'r') {
+        if (file == files.end()) return File();
+        return File(std::make_shared<FileState>(FileState{ &file->second, 0, false }));
+    }
+    std::vector<uint8_t>& data = files[path];
+    if (mode[0] == 'w') {
+        data.clear();
+    }
+    return File(std::make_shared<FileState>(FileState{ &data, data.size(), true }));
+}
+
+size_t fs::File::write(const uint8_t* buffer, size_t size) {
+    if (!state || !state->writable) return 0;
+    std::lock_guard<std::mutex> lock(flashLock);
+    std::vector<uint8_t>& data = *state->data;
+    if (data.size() < state->position + size) {
+        data.resize(state->position + size);
+    }
+    memcpy(data.data() + state->position, buffer, size);
+    state->position += size;
+    return size;
+}
+
+size_t fs::File::read(uint8_t* buffer, size_t size) {
+    if (!state) return 0;
+    std::lock_guard<std::mutex> lock(flashLock);
+    const std::vector<uint8_t>& data = *state->data;
+    size_t count = state->position < data.size() ? std::min(size, data.size() - state->position) : 0;
+    memcpy(buffer, data.data() + state->position, count);
+    state->position += count;
+    return count;
+}
+
+bool fs::File::seek(uint32_t position) {
+    if (!state) return false;
+    std::lock_guard<std::mutex> lock(flashLock);
+    if (position > state->data->size()) return false;
+    state->position = position;
+    return true;
+}
+
+size_t fs::File::size() {
+    if (!state) return 0;
+    std::lock_guard<std::mutex> lock(flashLock);
+    return state->data->size();
+}
+
+void fs::File::close() {
+    state.reset();
+}
+
+bool Preferences::begin(const char* name, bool readOnly, const char* partitionLabel) {
+    // A read-only namespace that was never written doesn't open, as in NVS
+    std::lock_guard<std::mutex> lock(flashLock);
+    std::string prefix = std::string(name) + "/";
+    auto key = nvs.lower_bound(prefix);
+    if (readOnly && (key == nvs.end() || key->first.compare(0, prefix.size(), prefix) != 0)) return false;
+    strncpy(space, name, sizeof(space) - 1);
+    open = true;
+    this->readOnly = readOnly;
+    return true;
+}
+
+void Preferences::end() {
+    open = false;
+}
+
+size_t Preferences::putBytes(const char* key, const void* value, size_t length) {
+    if (!open || readOnly) return 0;
+    std::lock_guard<std::mutex> lock(flashLock);
+    const uint8_t* bytes = (const uint8_t*)value;
+    nvs[std::string(space) + "/" + key].assign(bytes, bytes + length);
+    return length;
+}
+
+size_t Preferences::getBytes(const char* key, void* buffer, size_t maxLength) {
+    if (!open) return 0;
+    std::lock_guard<std::mutex> lock(flashLock);
+    auto entry = nvs.find(std::string(space) + "/" + key);
+    if (entry == nvs.end() || entry->second.size() > maxLength) return 0;
+    memcpy(buffer, entry->second.data(), entry->second.size());
+    return entry->second.size();
+}
+
+size_t Preferences::getBytesLength(const char* key) {
+    if (!open) return 0;
+    std::lock_guard<std::mutex> lock(flashLock);
+    auto entry = nvs.find(std::string(space) + "/" + key);
+    return entry != nvs.end() ? entry->second.size() : 0;
+}
+
+// ============================================
+// HARNESS INTERFACE
+// ============================================
+
+namespace host {
+
+void setSeed(uint32_t seed) {
+    randomEngine.seed(seed);
+}
+
+void setPsram(bool present) {
+    std::lock_guard<std::mutex> lock(heapLock);
+    psramPresent = present;
+    heapReady = false;
+}
+
+void setSerialEcho(bool echo) {
+    serialEcho = echo;
+}
+
+int64_t now() {
+    return clockUs;
+}
+
+void at(int64_t us, std::function<void()> event) {
+    events.push({ us, eventOrder++, std::move(event) });
+}
+
+void syncClock(time_t epoch) {
+    clockSynced = true;
+    syncEpoch = epoch;
+    syncUs = clockUs;
+}
+
+void setPot(int gpio, int raw) {
+    potLevels[gpio] = raw;
+}
+
+const std::vector<PinWrite>& pinWrites() {
+    return gpioLog;
+}
+
+int pinLevel(int pin) {
+    return gpioLevel[pin];
+}
+
+bool pinOutput(int pin) {
+    return gpioOutput[pin];
+}
+
+uint32_t pinMisuses() {
+    return gpioMisuses;
+}
+
+HeapStats heap() {
+    std::lock_guard<std::mutex> lock(heapLock);
+    setupHeap();
+    HeapStats stats;
+    stats.internalUsed = internalHeap.used;
+    stats.internalPeak = internalHeap.peak;
+    stats.internalLargestFree = internalHeap.largestFree();
+    stats.psramUsed = psramHeap.used;
+    stats.psramPeak = psramHeap.peak;
+    stats.allocations = heapAllocations;
+    stats.failures = heapFailures;
+    return stats;
+}
+
+}  // namespace host
@@ -0,0 +1,99 @@
+// ============================================
+// HOST HAL
+// Runs lib/CompassFirmware natively. tools/host/include has stand-ins for
+// the Arduino core, ESP-IDF, esp-dsp, LittleFS and PubSubClient headers
+// the firmware includes; Hal.cpp and Network.cpp implement them on a
+// virtual esp_timer clock.
+//
+// The clock only moves while the loop task sleeps (ulTaskNotifyTake,
+// delay), straight to the next thing due: an ADC frame, a monitor hit or
+// an event the harness scheduled with at(). Firmware work takes no virtual
+// time, so a day of uptime runs in seconds and a run with the same seed
+// and events does the same thing every time. The broker is a fake in this
+// process: it hands what the firmware publishes to onPublish() and delivers
+// what the harness sends, with a persistent session like Mosquitto's.
+//
+// This header is for harnesses; it doesn't include the stand-ins.
+// ============================================
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace host {
+
+// Board setup, before compassSetup()
+void setSeed(uint32_t seed);  // random()
+void setPsram(bool present);  // Default: 8MB, as on the N8R8 boards
+void setSerialEcho(bool echo);  // Firmware serial console to stdout
+
+// Clock
+int64_t now();  // esp_timer_get_time()
+void at(int64_t us, std::function<void()> event);  // Runs on the loop task once the clock gets there
+void syncClock(time_t epoch);  // SNTP answers: time() reads epoch now, counting on from here
+
+// ADC: the level every later conversion of the pot on this GPIO reads
+void setPot(int gpio, int raw);
+
+// GPIO: every change of the output register, from gpio_set_level() or
+// digitalWrite(). digitalWrite() on a pin pinMode() hasn't claimed does
+// nothing, as on the ESP32 Arduino core, and is counted in misuses
+struct PinWrite {
+    int64_t us;
+    int pin;
+    int level;
+    bool driven;  // Pin was an output at the time
+};
+const std::vector<PinWrite>& pinWrites();
+int pinLevel(int pin);
+bool pinOutput(int pin);
+uint32_t pinMisuses();
+
+// Broker
+struct Message {
+    int64_t us;
+    std::string topic;
+    std::string payload;
+    bool retained;
+    bool will;  // Published by the broker for a lost connection
+};
+void onPublish(std::function<void(const Message&)> handler);
+// QoS 1 to the firmware's session, queued while it is offline; retained
+// ones are kept and sent again on every subscribe
+void deliver(const std::string& topic, const std::string& payload, bool retained = false);
+void dropConnection();  // Link lost without a DISCONNECT: the will goes out
+void setWifi(bool up);  // Access point gone or back; the station reconnects by itself
+void setBroker(bool up);  // Broker refusing connections
+
+struct NetworkStats {
+    uint32_t connects;
+    uint32_t linkDrops;  // Connections lost other than by disconnect()
+    uint32_t keepaliveTimeouts;
+    uint32_t pings;  // PINGREQs: one per keepalive period on the client's millis() when idle
+    uint32_t protocolErrors;  // Malformed packets, streamed publishes of the wrong length
+    uint32_t published;
+    uint32_t delivered;
+};
+NetworkStats network();
+bool connected();
+
+// Heap: the firmware's allocations, in arenas sized like the S3's free
+// internal RAM with WiFi up and its PSRAM. Freeing a pointer that isn't a
+// live allocation stops the run
+struct HeapStats {
+    size_t internalUsed;
+    size_t internalPeak;
+    size_t internalLargestFree;
+    size_t psramUsed;
+    size_t psramPeak;
+    uint32_t allocations;
+    uint32_t failures;  // Other than MALLOC_CAP_SPIRAM with no PSRAM
+};
+HeapStats heap();
+
+}  // namespace host
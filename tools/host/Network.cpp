@@ -0,0 +1,445 @@
+// ============================================
+// HOST HAL: WiFi station, TCP client, PubSubClient and the fake broker.
+// Kept apart from Hal.cpp, which defines millis(): the client's keepalive
+// calls it through the linker, so a build linked with --wrap=millis times
+// it on the firmware's soak clock, as the real library would
+// ============================================
+
+#define HOST_HAL_INTERNAL
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include <WiFi.h>
+#include <esp_timer.h>
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+
+#include "HostHal.h"
+
+namespace {
+
+const int64_t WIFI_ASSOCIATE_US = 400000;  // begin() to associated
+const int64_t WIFI_DHCP_US = 250000;  // Associated to an address
+const uint8_t ACCESS_POINT_BSSID[6] = { 0x24, 0xa4, 0x3c, 0x11, 0x52, 0x9e };
+const int MQTT_MAX_HEADER_SIZE = 5;
+
+struct Station {
+    WiFiEventFuncCb onEvent = nullptr;
+    bool started = false;  // begin() called; reconnects on its own after that
+    bool apUp = true;
+    bool associated = false;
+    bool hasAddress = false;
+    uint32_t attempt = 0;  // Stale connect events are dropped
+};
+
+// One broker, one client session (the firmware's fixed client id, no clean
+// session)
+struct Broker {
+    std::function<void(const host::Message&)> onPublish;
+    bool up = true;
+    bool linkUp = false;
+    std::string willTopic;
+    std::string willMessage;
+    bool willRetain = false;
+    std::set<std::string> subscriptions;
+    std::deque<host::Message> inbox;  // For the client, QoS 1 kept while it is away
+    std::map<std::string, std::string> retained;
+    bool pingPending = false;
+    host::NetworkStats stats = {};
+};
+
+Station station;
+Broker broker;
+
+void stationEvent(arduino_event_id_t event) {
+    if (station.onEvent != nullptr) {
+        arduino_event_info_t info = {};
+        station.onEvent(event, info);
+    }
+}
+
+void linkDown(bool sendWill) {
+    if (!broker.linkUp) return;
+    broker.linkUp = false;
+    broker.pingPending = false;
+    if (sendWill) {
+        broker.stats.linkDrops++;
+        host::Message will = { host::now(), broker.willTopic, broker.willMessage, broker.willRetain, true };
+        if (will.retained) {
+            broker.retained[will.topic] = will.payload;
+        }
+        if (broker.onPublish) {
+            broker.onPublish(will);
+        }
+    }
+}
+
+void stationConnect() {
+    // Association, then DHCP, on the clock
+    uint32_t attempt = ++station.attempt;
+    host::at(host::now() + WIFI_ASSOCIATE_US, [attempt]() {
+        if (attempt != station.attempt || !station.apUp) return;
+        station.associated = true;
+        stationEvent(ARDUINO_EVENT_WIFI_STA_CONNECTED);
+        host::at(host::now() + WIFI_DHCP_US, [attempt]() {
+            if (attempt != station.attempt || !station.associated) return;
+            station.hasAddress = true;
+            stationEvent(ARDUINO_EVENT_WIFI_STA_GOT_IP);
+        });
+    });
+}
+
+void stationLost() {
+    station.attempt++;
+    bool wasUp = station.associated;
+    station.associated = false;
+    station.hasAddress = false;
+    linkDown(true);
+    if (wasUp) {
+        stationEvent(ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+    }
+}
+
+void route(const host::Message& message, bool fromClient) {
+    // Everything published reaches the harness; what the session
+    // subscribes to is queued for the client, the client's own QoS 0
+    // publishes only while it is connected
+    if (message.retained) {
+        if (message.payload.empty()) {
+            broker.retained.erase(message.topic);
+        } else {
+            broker.retained[message.topic] = message.payload;
+        }
+    }
+    if (fromClient) {
+        broker.stats.published++;
+        if (broker.onPublish) {
+            broker.onPublish(message);
+        }
+    }
+    if (broker.subscriptions.count(message.topic) && (broker.linkUp || !fromClient)) {
+        broker.inbox.push_back(message);
+    }
+}
+
+bool parsePublish(const uint8_t* packet, size_t size, host::Message& message) {
+    // PUBLISH, QoS 0: header byte, remaining length, topic, payload
+    if (size < 2 || (packet[0] & 0xF6) != 0x30) return false;
+    size_t remaining = 0;
+    size_t position = 1;
+    for (int shift = 0; ; shift += 7) {
+        if (position == size || shift > 21) return false;
+        uint8_t digit = packet[position++];
+        remaining |= (size_t)(digit & 0x7F) << shift;
+        if ((digit & 0x80) == 0) break;
+    }
+    if (position + remaining != size || remaining < 2) return false;
+    size_t topicLength = (packet[position] << 8) | packet[position + 1];
+    position += 2;
+    if (position + topicLength > size) return false;
+    message.us = host::now();
+    message.topic.assign((const char*)packet + position, topicLength);
+    message.payload.assign((const char*)packet + position + topicLength, size - position - topicLength);
+    message.retained = (packet[0] & 0x01) != 0;
+    message.will = false;
+    return true;
+}
+
+// A streamed publish in progress
+std::string streamTopic;
+std::string streamPayload;
+unsigned int streamLength = 0;
+bool streamRetained = false;
+bool streaming = false;
+
+}  // namespace
+
+// ============================================
+// WIFI
+// ============================================
+
+WiFiClass WiFi;
+
+bool WiFiClass::mode(int mode) {
+    return true;
+}
+
+wl_status_t WiFiClass::begin(const char* ssid, const char* passphrase, int32_t channel, const uint8_t* bssid, bool connect) {
+    station.started = true;
+    if (station.apUp && !station.associated) {
+        stationConnect();
+    }
+    return status();
+}
+
+bool WiFiClass::disconnect(bool wifiOff, bool eraseAp) {
+    station.started = false;
+    stationLost();
+    return true;
+}
+
+wl_status_t WiFiClass::status() {
+    return station.hasAddress ? WL_CONNECTED : WL_DISCONNECTED;
+}
+
+IPAddress WiFiClass::localIP() {
+    return station.hasAddress ? IPAddress(10, 1, 10, 50) : IPAddress();
+}
+
+int8_t WiFiClass::RSSI() {
+    return station.associated ? -52 : 0;
+}
+
+uint8_t* WiFiClass::BSSID() {
+    static uint8_t bssid[6];
+    if (!station.associated) return nullptr;
+    memcpy(bssid, ACCESS_POINT_BSSID, sizeof(bssid));
+    return bssid;
+}
+
+int32_t WiFiClass::channel() {
+    return 6;
+}
+
+int WiFiClass::onEvent(WiFiEventFuncCb callback) {
+    station.onEvent = callback;
+    return 1;
+}
+
+size_t WiFiClient::write(const uint8_t* buffer, size_t size) {
+    // Raw packets written past PubSubClient: only whole QoS 0 PUBLISHes
+    // are expected. Anything else is a protocol error, and a broker drops
+    // the connection on one
+    if (!broker.linkUp) return 0;
+    host::Message message;
+    if (!parsePublish(buffer, size, message)) {
+        broker.stats.protocolErrors++;
+        fprintf(stderr, "host: malformed packet of %zu bytes\n", size);
+        linkDown(true);
+        return size;
+    }
+    route(message, true);
+    return size;
+}
+
+int WiFiClient::connected() {
+    return broker.linkUp;
+}
+
+// ============================================
+// PUBSUBCLIENT
+// ============================================
+
+PubSubClient::PubSubClient(Client& client)
+    : client(&client), bufferSize(256), buffer(nullptr), clientState(MQTT_DISCONNECTED),
+      lastOutActivity(0), lastInActivity(0), pingOutstanding(false) {}
+
+PubSubClient& PubSubClient::setServer(const char* domain, uint16_t port) {
+    return *this;
+}
+
+PubSubClient& PubSubClient::setCallback(MQTT_CALLBACK_SIGNATURE) {
+    this->callback = callback;
+    return *this;
+}
+
+bool PubSubClient::setBufferSize(uint16_t size) {
+    // The library's one allocation, from the heap the firmware sees
+    uint8_t* resized = (uint8_t*)hostMalloc(size);
+    if (resized == nullptr) return false;
+    hostFree(buffer);
+    buffer = resized;
+    bufferSize = size;
+    return true;
+}
+
+bool PubSubClient::connect(const char* id, const char* user, const char* pass, const char* willTopic,
+    uint8_t willQos, bool willRetain, const char* willMessage, bool cleanSession) {
+    if (connected()) return true;
+    if (WiFi.status() != WL_CONNECTED || !broker.up) {
+        clientState = MQTT_CONNECT_FAILED;
+        return false;
+    }
+
+    broker.linkUp = true;
+    broker.willTopic = willTopic != nullptr ? willTopic : "";
+    broker.willMessage = willMessage != nullptr ? willMessage : "";
+    broker.willRetain = willRetain;
+    if (cleanSession) {
+        broker.subscriptions.clear();
+        broker.inbox.clear();
+    }
+    broker.stats.connects++;
+    clientState = MQTT_CONNECTED;
+    pingOutstanding = false;
+    lastInActivity = lastOutActivity = millis();
+    return true;
+}
+
+void PubSubClient::disconnect() {
+    // DISCONNECT: a clean close, no will
+    clientState = MQTT_DISCONNECTED;
+    linkDown(false);
+    lastInActivity = lastOutActivity = millis();
+}
+
+bool PubSubClient::connected() {
+    if (!client->connected()) {
+        if (clientState == MQTT_CONNECTED) {
+            clientState = MQTT_CONNECTION_LOST;
+        }
+        return false;
+    }
+    return clientState == MQTT_CONNECTED;
+}
+
+int PubSubClient::state() {
+    return clientState;
+}
+
+bool PubSubClient::loop() {
+    // As the library does it: keepalive on millis(), then at most one
+    // incoming packet per call
+    if (!connected()) return false;
+
+    uint32_t t = millis();
+    uint32_t keepAliveMs = MQTT_KEEPALIVE * 1000UL;
+    if ((t - lastInActivity > keepAliveMs) || (t - lastOutActivity > keepAliveMs)) {
+        if (pingOutstanding) {
+            broker.stats.keepaliveTimeouts++;
+            clientState = MQTT_CONNECTION_TIMEOUT;
+            linkDown(true);
+            return false;
+        }
+        broker.pingPending = true;  // PINGREQ; the broker answers at once
+        broker.stats.pings++;
+        lastOutActivity = t;
+        pingOutstanding = true;
+    }
+
+    if (broker.pingPending) {
+        broker.pingPending = false;
+        lastInActivity = t;
+        pingOutstanding = false;
+    } else if (!broker.inbox.empty()) {
+        host::Message message = broker.inbox.front();
+        broker.inbox.pop_front();
+        lastInActivity = t;
+        // QoS 1 is acknowledged once the callback returns
+        lastOutActivity = t;
+        broker.stats.delivered++;
+
+        // Too long for the buffer: read and dropped, as the library does
+        size_t length = 2 + message.topic.size() + 2 + message.payload.size();
+        if (length + MQTT_MAX_HEADER_SIZE > bufferSize || !callback) return true;
+        char* topic = (char*)buffer;
+        memcpy(topic, message.topic.c_str(), message.topic.size() + 1);
+        uint8_t* payload = buffer + message.topic.size() + 1;
+        memcpy(payload, message.payload.data(), message.payload.size());
+        callback(topic, payload, message.payload.size());
+    }
+    return connected();
+}
+
+bool PubSubClient::publish(const char* topic, const char* payload, bool retained) {
+    if (!connected()) return false;
+    size_t length = strlen(payload);
+    if (bufferSize < MQTT_MAX_HEADER_SIZE + 2 + strlen(topic) + length) return false;
+    route({ host::now(), topic, payload, retained, false }, true);
+    lastOutActivity = millis();
+    return true;
+}
+
+bool PubSubClient::beginPublish(const char* topic, unsigned int length, bool retained) {
+    if (!connected()) return false;
+    streamTopic = topic;
+    streamPayload.clear();
+    streamLength = length;
+    streamRetained = retained;
+    streaming = true;
+    return true;
+}
+
+size_t PubSubClient::write(const uint8_t* data, size_t size) {
+    if (!streaming || !connected()) return 0;
+    streamPayload.append((const char*)data, size);
+    return size;
+}
+
+int PubSubClient::endPublish() {
+    if (!streaming) return 0;
+    streaming = false;
+    lastOutActivity = millis();
+    if (!connected()) return 0;
+    if (streamPayload.size() != streamLength) {
+        // The broker would read the next packet out of the surplus or wait
+        // for the rest: either way the connection is gone
+        broker.stats.protocolErrors++;
+        fprintf(stderr, "host: streamed publish on %s was %zu bytes, announced %u\n",
+            streamTopic.c_str(), streamPayload.size(), streamLength);
+        linkDown(true);
+        return 0;
+    }
+    route({ host::now(), streamTopic, streamPayload, streamRetained, false }, true);
+    return 1;
+}
+
+bool PubSubClient::subscribe(const char* topic, uint8_t qos) {
+    // Retained messages on the topic come straight after SUBACK
+    if (!connected()) return false;
+    broker.subscriptions.insert(topic);
+    auto retained = broker.retained.find(topic);
+    if (retained != broker.retained.end()) {
+        broker.inbox.push_back({ host::now(), retained->first, retained->second, true, false });
+    }
+    lastOutActivity = millis();
+    return true;
+}
+
+// ============================================
+// HARNESS INTERFACE
+// ============================================
+
+namespace host {
+
+void onPublish(std::function<void(const Message&)> handler) {
+    broker.onPublish = std::move(handler);
+}
+
+void deliver(const std::string& topic, const std::string& payload, bool retained) {
+    route({ now(), topic, payload, retained, false }, false);
+}
+
+void dropConnection() {
+    linkDown(true);
+}
+
+void setWifi(bool up) {
+    if (up == station.apUp) return;
+    station.apUp = up;
+    if (!up) {
+        stationLost();
+    } else if (station.started) {
+        stationConnect();
+    }
+}
+
+void setBroker(bool up) {
+    broker.up = up;
+    if (!up) {
+        linkDown(true);
+    }
+}
+
+NetworkStats network() {
+    return broker.stats;
+}
+
+bool connected() {
+    return broker.linkUp;
+}
+
+}  // namespace host
@@ -0,0 +1,26 @@
+/**
+ * Host Compass
+ * The prop the host HAL runs lib/CompassFirmware as (compass_soak and the
+ * solve output test): one compass, with a solve output on an active-low
+ * line like a relay board's
+ */
+
+#pragma once
+
+// Device Identity
+const char* DEVICE_NAME = "HostCompass";
+
+// Hardware Pins
+const int POT_PIN = 4;  // ADC1 channel 3
+
+// Compass Configuration
+const int TARGET_DIRECTION = 315;  // NW = 315 degrees
+const char* TARGET_NAME = "NW";
+
+// Solve output wiring
+const int SOLVE_OUTPUT_PIN = 12;
+const bool SOLVE_OUTPUT_ACTIVE_HIGH = false;
+
+const CompassConfig COMPASSES[] = {
+    { DEVICE_NAME, POT_PIN, TARGET_DIRECTION, TARGET_NAME, DIRECTION_TOLERANCE, FILTER_ALPHA, TRACKER_BETA, SOLVE_OUTPUT_PIN },
+};
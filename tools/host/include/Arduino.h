@@ -0,0 +1,157 @@
+// ============================================
+// HOST HAL: Arduino core
+// Just the parts of the ESP32 Arduino core the compass firmware uses,
+// implemented in tools/host/Hal.cpp on a virtual clock. See HostHal.h
+// ============================================
+
+#pragma once
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <ctime>
+#include <functional>
+#include <memory>
+
+typedef uint8_t byte;
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_TIMEOUT 0x107
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0x01
+#define OUTPUT 0x03
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+class Printable;
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) { return write(&c, 1); }
+    virtual size_t write(const uint8_t* buffer, size_t size) = 0;
+
+    size_t print(const char* text) { return write((const uint8_t*)text, strlen(text)); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int value) { return printf("%d", value); }
+    size_t print(unsigned value) { return printf("%u", value); }
+    size_t print(long value) { return printf("%ld", value); }
+    size_t print(unsigned long value) { return printf("%lu", value); }
+    size_t print(long long value) { return printf("%lld", value); }
+    size_t print(unsigned long long value) { return printf("%llu", value); }
+    size_t print(double value, int digits = 2) { return printf("%.*f", digits, value); }
+    size_t print(const Printable& value);
+
+    size_t println() { return print("\r\n"); }
+    template <typename T>
+    size_t println(const T& value) { return print(value) + println(); }
+
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Printable {
+public:
+    virtual ~Printable() {}
+    virtual size_t printTo(Print& p) const = 0;
+};
+
+inline size_t Print::print(const Printable& value) { return value.printTo(*this); }
+
+class HardwareSerial : public Print {
+public:
+    void begin(unsigned long baud) {}
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+};
+extern HardwareSerial Serial;
+
+class EspClass {
+public:
+    uint64_t getEfuseMac();
+    uint32_t getFreeHeap();
+    uint32_t getMaxAllocHeap();
+    [[noreturn]] void restart();
+};
+extern EspClass ESP;
+
+// Core clock: millis() runs off esp_timer like the Arduino core's, and is
+// C linkage so a soak build can --wrap it
+extern "C" unsigned long millis();
+extern "C" unsigned long micros();
+void delay(uint32_t ms);
+
+int analogRead(uint8_t pin);
+void analogReadResolution(uint8_t bits);
+typedef enum { ADC_0db, ADC_2_5db, ADC_6db, ADC_11db } adc_attenuation_t;
+void analogSetPinAttenuation(uint8_t pin, adc_attenuation_t attenuation);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+long map(long x, long inMin, long inMax, long outMin, long outMax);
+
+void configTime(long gmtOffsetSec, int daylightOffsetSec, const char* server1,
+    const char* server2 = nullptr, const char* server3 = nullptr);
+
+// FreeRTOS
+typedef void* TaskHandle_t;
+typedef void* QueueHandle_t;
+typedef void* SemaphoreHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef void (*TaskFunction_t)(void*);
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS 1
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portNUM_PROCESSORS 2
+#define tskIDLE_PRIORITY 0
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))  // 1 kHz tick
+
+TaskHandle_t xTaskGetCurrentTaskHandle();
+TaskHandle_t xTaskGetCurrentTaskHandleForCore(BaseType_t core);
+BaseType_t xPortGetCoreID();
+BaseType_t xTaskCreate(TaskFunction_t task, const char* name, uint32_t stackDepth, void* parameter,
+    UBaseType_t priority, TaskHandle_t* created);
+TickType_t xTaskGetTickCount();
+void vTaskDelay(TickType_t ticks);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks);
+void xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higherPriorityTaskWoken);
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks);
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks);
+SemaphoreHandle_t xSemaphoreCreateMutex();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+
+// The firmware's heap calls go to the HAL's internal-RAM arena, so
+// ESP.getFreeHeap() and the soak health report see its own allocations
+// and nothing of the host's
+void* hostMalloc(size_t size);
+void hostFree(void* pointer);
+#ifndef HOST_HAL_INTERNAL
+#define malloc(size) hostMalloc(size)
+#define free(pointer) hostFree(pointer)
+#endif
@@ -0,0 +1,19 @@
+// HOST HAL: IPv4 address, printable like the Arduino core's
+
+#pragma once
+
+#include <Arduino.h>
+
+class IPAddress : public Printable {
+public:
+    IPAddress() : address(0) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : address(a | (b << 8) | (c << 16) | ((uint32_t)d << 24)) {}
+    operator uint32_t() const { return address; }
+    uint8_t operator[](int index) const { return (address >> (8 * index)) & 0xFF; }
+    size_t printTo(Print& p) const override {
+        return p.printf("%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+    }
+
+private:
+    uint32_t address;  // First octet in the low byte, as on the ESP32
+};
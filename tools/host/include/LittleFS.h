@@ -0,0 +1,38 @@
+// HOST HAL: LittleFS, in memory
+
+#pragma once
+
+#include <Arduino.h>
+#include <memory>
+
+namespace fs {
+
+struct FileState;
+
+class File {
+public:
+    File() {}
+    explicit File(std::shared_ptr<FileState> state) : state(state) {}
+    size_t write(const uint8_t* buffer, size_t size);
+    size_t read(uint8_t* buffer, size_t size);
+    bool seek(uint32_t position);
+    size_t size();
+    void close();
+    operator bool() const { return state != nullptr; }
+
+private:
+    std::shared_ptr<FileState> state;
+};
+
+class LittleFSFS {
+public:
+    bool begin(bool formatOnFail = false, const char* basePath = "/littlefs", uint8_t maxOpenFiles = 10,
+        const char* partitionLabel = "spiffs");
+    File open(const char* path, const char* mode = "r", bool create = false);
+    bool mkdir(const char* path);
+};
+
+}  // namespace fs
+
+extern fs::LittleFSFS LittleFS;
+using fs::File;
@@ -0,0 +1,19 @@
+// HOST HAL: NVS key/value store, in memory
+
+#pragma once
+
+#include <Arduino.h>
+
+class Preferences {
+public:
+    bool begin(const char* name, bool readOnly = false, const char* partitionLabel = nullptr);
+    void end();
+    size_t putBytes(const char* key, const void* value, size_t length);
+    size_t getBytes(const char* key, void* buffer, size_t maxLength);
+    size_t getBytesLength(const char* key);
+
+private:
+    char space[16] = {};
+    bool open = false;
+    bool readOnly = false;
+};
@@ -0,0 +1,54 @@
+// HOST HAL: PubSubClient
+// The library's interface, against the fake broker in
+// tools/host/Network.cpp. Keepalive is timed with millis() as the real
+// client does, so a --wrap=millis soak build exercises the rollover
+
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+#define MQTT_KEEPALIVE 15
+#define MQTT_SOCKET_TIMEOUT 15
+
+#define MQTT_CONNECTION_TIMEOUT -4
+#define MQTT_CONNECTION_LOST -3
+#define MQTT_CONNECT_FAILED -2
+#define MQTT_DISCONNECTED -1
+#define MQTT_CONNECTED 0
+
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char*, uint8_t*, unsigned int)> callback
+
+class PubSubClient : public Print {
+public:
+    explicit PubSubClient(Client& client);
+
+    PubSubClient& setServer(const char* domain, uint16_t port);
+    PubSubClient& setCallback(MQTT_CALLBACK_SIGNATURE);
+    bool setBufferSize(uint16_t size);
+
+    bool connect(const char* id, const char* user, const char* pass, const char* willTopic,
+        uint8_t willQos, bool willRetain, const char* willMessage, bool cleanSession);
+    void disconnect();
+    bool connected();
+    int state();
+    bool loop();
+
+    bool publish(const char* topic, const char* payload, bool retained = false);
+    bool beginPublish(const char* topic, unsigned int length, bool retained);
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int endPublish();
+
+    bool subscribe(const char* topic, uint8_t qos = 0);
+
+private:
+    Client* client;
+    std::function<void(char*, uint8_t*, unsigned int)> callback;
+    uint16_t bufferSize;
+    uint8_t* buffer;
+    int clientState;
+    uint32_t lastOutActivity;
+    uint32_t lastInActivity;
+    bool pingOutstanding;
+};
@@ -0,0 +1,55 @@
+// HOST HAL: WiFi station and TCP client
+// The client hands whole MQTT packets to the fake broker in
+// tools/host/Network.cpp
+
+#pragma once
+
+#include <Arduino.h>
+#include <IPAddress.h>
+
+#define WIFI_STA 1
+
+typedef enum {
+    WL_IDLE_STATUS = 0,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum {
+    ARDUINO_EVENT_WIFI_STA_CONNECTED = 4,
+    ARDUINO_EVENT_WIFI_STA_DISCONNECTED = 5,
+    ARDUINO_EVENT_WIFI_STA_GOT_IP = 7
+} arduino_event_id_t;
+
+typedef struct { int reason; } arduino_event_info_t;
+typedef void (*WiFiEventFuncCb)(arduino_event_id_t event, arduino_event_info_t info);
+
+class WiFiClass {
+public:
+    bool mode(int mode);
+    wl_status_t begin(const char* ssid, const char* passphrase, int32_t channel = 0,
+        const uint8_t* bssid = nullptr, bool connect = true);
+    bool disconnect(bool wifiOff = false, bool eraseAp = false);
+    wl_status_t status();
+    IPAddress localIP();
+    int8_t RSSI();
+    uint8_t* BSSID();
+    int32_t channel();
+    int onEvent(WiFiEventFuncCb callback);
+};
+extern WiFiClass WiFi;
+
+class Client : public Print {
+public:
+    virtual int connected() = 0;
+};
+
+class WiFiClient : public Client {
+public:
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int connected() override;
+    int setNoDelay(bool noDelay) { return 0; }
+};
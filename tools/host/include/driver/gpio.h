@@ -0,0 +1,10 @@
+// HOST HAL: GPIO output register
+
+#pragma once
+
+#include <stdint.h>
+
+typedef int esp_err_t;
+typedef int gpio_num_t;
+
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level);
@@ -0,0 +1,31 @@
+// HOST HAL: ADC digital threshold monitors
+
+#pragma once
+
+#include <esp_adc/adc_continuous.h>
+
+typedef struct adc_monitor_t* adc_monitor_handle_t;
+
+typedef struct {
+    adc_unit_t adc_unit;
+    adc_channel_t channel;
+    int32_t h_threshold;  // -1 = unused
+    int32_t l_threshold;  // -1 = unused
+} adc_monitor_config_t;
+
+typedef struct {
+    int unit;
+} adc_monitor_evt_data_t;
+
+typedef bool (*adc_monitor_evt_cb_t)(adc_monitor_handle_t monitor, const adc_monitor_evt_data_t* data, void* context);
+
+typedef struct {
+    adc_monitor_evt_cb_t on_over_high_thresh;
+    adc_monitor_evt_cb_t on_below_low_thresh;
+} adc_monitor_evt_cbs_t;
+
+esp_err_t adc_new_continuous_monitor(adc_continuous_handle_t handle, const adc_monitor_config_t* config, adc_monitor_handle_t* monitor);
+esp_err_t adc_continuous_monitor_register_event_callbacks(adc_monitor_handle_t monitor, const adc_monitor_evt_cbs_t* callbacks, void* context);
+esp_err_t adc_continuous_monitor_enable(adc_monitor_handle_t monitor);
+esp_err_t adc_continuous_monitor_disable(adc_monitor_handle_t monitor);
+esp_err_t adc_del_continuous_monitor(adc_monitor_handle_t monitor);
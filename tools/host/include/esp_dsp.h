@@ -0,0 +1,31 @@
+// HOST HAL: esp-dsp
+// The ANSI C versions of the kernels the firmware calls (the S3 build uses
+// the vector ones, checked against the pipeline's reference at boot)
+
+#pragma once
+
+#include <stdint.h>
+
+typedef int esp_err_t;
+
+typedef struct fir_s16_s {
+    int16_t* coeffs;
+    int16_t* delay;
+    int16_t coeffs_len;
+    int16_t pos;
+    int16_t decim;
+    int16_t d_pos;
+    int16_t shift;
+    int32_t* rounding_buff;
+    int32_t rounding_val;
+    int16_t free_status;
+} fir_s16_t;
+
+esp_err_t dsps_fird_init_s16(fir_s16_t* fir, int16_t* coeffs, int16_t* delay, int16_t coeffs_len,
+    int16_t decim, int16_t start_pos, int16_t shift);
+int32_t dsps_fird_s16(fir_s16_t* fir, const int16_t* input, int16_t* output, int32_t len);
+
+esp_err_t dsps_fft2r_init_fc32(float* fft_table_buff, int table_size);
+esp_err_t dsps_fft2r_fc32(float* data, int N);
+esp_err_t dsps_bit_rev_fc32(float* data, int N);
+void dsps_wind_hann_f32(float* window, int len);
@@ -0,0 +1,17 @@
+// HOST HAL: capability heap
+// Internal RAM and PSRAM are separate arenas in tools/host/Hal.cpp, sized
+// like an N8R8 module's; HostHal.h can leave PSRAM out
+
+#pragma once
+
+#include <stddef.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+void* heap_caps_malloc(size_t size, unsigned caps);
+void* heap_caps_calloc(size_t count, size_t size, unsigned caps);
+void* heap_caps_aligned_alloc(size_t alignment, size_t size, unsigned caps);
+void heap_caps_free(void* pointer);
@@ -0,0 +1,7 @@
+// HOST HAL: ROM CRC32 (IEEE 802.3, little endian)
+
+#pragma once
+
+#include <stdint.h>
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buffer, uint32_t length);
@@ -0,0 +1,7 @@
+// HOST HAL: esp_timer, the virtual clock every other HAL part runs on
+
+#pragma once
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time();
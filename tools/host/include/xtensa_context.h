@@ -0,0 +1,11 @@
+// HOST HAL: Xtensa exception frame (the profiler reads the saved PC)
+
+#pragma once
+
+#include <stdint.h>
+
+typedef struct {
+    long exit;
+    long pc;
+    long ps;
+} XtExcFrame;
@@ -0,0 +1,46 @@
+#include "Args.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool parseInt(const char* text, long& value) {
+    char* end;
+    errno = 0;
+    value = strtol(text, &end, 10);
+    return errno == 0 && end != text && *end == '\0';
+}
+
+static bool parseRange(const std::string& item, std::vector<int>& values) {
+    long bounds[3] = { 0, 0, 1 };
+    int parts = 0;
+    size_t start = 0;
+    while (parts < 3) {
+        size_t colon = item.find(':', start);
+        std::string part = item.substr(start, colon == std::string::npos ? std::string::npos : colon - start);
+        if (!parseInt(part.c_str(), bounds[parts++])) return false;
+        if (colon == std::string::npos) break;
+        start = colon + 1;
+    }
+    if (parts == 1) {
+        values.push_back((int)bounds[0]);
+        return true;
+    }
+    if (bounds[2] <= 0 || bounds[1] < bounds[0]) return false;
+    for (long value = bounds[0]; value <= bounds[1]; value += bounds[2]) {
+        values.push_back((int)value);
+    }
+    return true;
+}
+
+bool parseIntList(const char* text, std::vector<int>& values) {
+    std::string list(text);
+    size_t start = 0;
+    for (;;) {
+        size_t comma = list.find(',', start);
+        std::string item = list.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        if (!parseRange(item, values)) return false;
+        if (comma == std::string::npos) return true;
+        start = comma + 1;
+    }
+}
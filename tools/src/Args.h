@@ -0,0 +1,11 @@
+// Command line helpers shared by the tools
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// "5,10,15" or "lo:hi" or "lo:hi:step", appended to values
+bool parseIntList(const char* text, std::vector<int>& values);
+
+bool parseInt(const char* text, long& value);
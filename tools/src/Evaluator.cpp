@@ -0,0 +1,88 @@
+#include "Evaluator.h"
+
+#include <CompassPipeline.h>
+
+#ifdef COMPASS_HAVE_AVX2
+void evaluateAvx2(const Trace& trace, const PipelineParams* params, TraceResult* results);
+#endif
+
+void evaluateScalar(const Trace& trace, const PipelineParams& params, TraceResult& result) {
+    pipeline::DwellParams dwellParams;
+    dwellParams.target = trace.header->targetDirection;
+    dwellParams.tolerance = params.tolerance;
+    dwellParams.debounceUs = (int64_t)params.debounceMs * 1000;
+    dwellParams.settleUs = 0;  // No ADC monitor on replay
+    dwellParams.settleVelocity = pipeline::degreesPerSToVelocity(params.settleSpeed, trace.header->samplePeriodUs);
+    pipeline::DwellState dwell = {};
+
+    int64_t periodUs = trace.header->samplePeriodUs;
+    pipeline::Tracker tracker = {};
+    pipeline::ReportState report;
+    pipeline::reportReset(report);
+    result = TraceResult();
+    result.solveSample = -1;
+
+    for (uint32_t i = 0; i < trace.count; i++) {
+        // Same order as serviceCompasses(): track, report, then dwell
+        pipeline::trackerStep(tracker, trace.samples[i], params.filterAlpha, params.trackerBeta);
+        int angle = pipeline::rawToAngle(pipeline::trackerRaw(tracker));
+
+        int64_t timestampUs = (int64_t)i * periodUs;
+        if (pipeline::reportStep(report, angle, params.threshold, timestampUs)) {
+            result.reports++;
+        }
+
+        switch (pipeline::dwellStep(dwell, dwellParams, angle, tracker.velocity, timestampUs)) {
+            case pipeline::DWELL_STARTED:
+                result.dwellStarts++;
+                break;
+            case pipeline::DWELL_CANCELLED:
+                result.dwellCancels++;
+                break;
+            case pipeline::DWELL_SOLVED:
+                result.solveSample = (int32_t)i;
+                break;
+            case pipeline::DWELL_CONFIRMED:  // Only after a monitor hit, not replayed
+            case pipeline::DWELL_NONE:
+                break;
+        }
+    }
+}
+
+bool simdAvailable() {
+#ifdef COMPASS_HAVE_AVX2
+    static const bool available = __builtin_cpu_supports("avx2");
+    return available;
+#else
+    return false;
+#endif
+}
+
+void evaluateTrace(const Trace& trace, const PipelineParams* params, int count, TraceResult* results, bool useSimd) {
+#ifdef COMPASS_HAVE_AVX2
+    if (useSimd && simdAvailable()) {
+        for (int done = 0; done < count; done += EVAL_LANES) {
+            int lanes = count - done;
+            if (lanes >= EVAL_LANES) {
+                evaluateAvx2(trace, params + done, results + done);
+                continue;
+            }
+
+            // Pad the last batch with copies of its final set
+            PipelineParams padded[EVAL_LANES];
+            TraceResult paddedResults[EVAL_LANES];
+            for (int lane = 0; lane < EVAL_LANES; lane++) {
+                padded[lane] = params[done + (lane < lanes ? lane : lanes - 1)];
+            }
+            evaluateAvx2(trace, padded, paddedResults);
+            for (int lane = 0; lane < lanes; lane++) {
+                results[done + lane] = paddedResults[lane];
+            }
+        }
+        return;
+    }
+#endif
+    for (int i = 0; i < count; i++) {
+        evaluateScalar(trace, params[i], results[i]);
+    }
+}
@@ -0,0 +1,40 @@
+// ============================================
+// EVALUATOR
+// Replays traces through the firmware's tracker, direction reports and
+// dwell/solve logic (lib/CompassPipeline) for many parameter sets at once.
+// The AVX2 path runs eight parameter sets per trace pass and must match the
+// scalar path exactly.
+// ============================================
+
+#pragma once
+
+#include <stdint.h>
+
+#include "TraceFile.h"
+
+const int EVAL_LANES = 8;  // Parameter sets per AVX2 pass
+
+struct PipelineParams {
+    int filterAlpha;  // Q8, see pipeline::trackerStep()
+    int tolerance;  // DIRECTION_TOLERANCE
+    int threshold;  // ANGLE_CHANGE_THRESHOLD
+    int debounceMs;  // DEBOUNCE_TIME
+    int trackerBeta;  // Q8
+    int settleSpeed;  // Degrees/s
+};
+
+struct TraceResult {
+    int32_t solveSample;  // -1 if never solved
+    uint32_t reports;  // Direction messages published
+    uint32_t dwellStarts;
+    uint32_t dwellCancels;
+};
+
+// Runs count parameter sets over one trace. Uses AVX2 when the CPU has it
+// and useSimd is set.
+void evaluateTrace(const Trace& trace, const PipelineParams* params, int count, TraceResult* results, bool useSimd);
+
+// Reference implementation, one parameter set at a time
+void evaluateScalar(const Trace& trace, const PipelineParams& params, TraceResult& result);
+
+bool simdAvailable();
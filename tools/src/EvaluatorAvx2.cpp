@@ -0,0 +1,135 @@
+// AVX2 evaluator: one 32-bit lane per parameter set, eight sets per pass
+// over the trace. Built with -mavx2 and only called when the CPU has it.
+
+#include <immintrin.h>
+#include <limits.h>
+
+#include <CompassPipeline.h>
+
+#include "Evaluator.h"
+
+// rawToAngle() for every 12-bit value, for gathers
+static const int32_t* angleTable() {
+    static int32_t table[pipeline::RAW_MAX + 1];
+    static const bool built = [] {
+        for (int raw = 0; raw <= pipeline::RAW_MAX; raw++) {
+            table[raw] = pipeline::rawToAngle(raw);
+        }
+        return true;
+    }();
+    (void)built;
+    return table;
+}
+
+void evaluateAvx2(const Trace& trace, const PipelineParams* params, TraceResult* results) {
+    alignas(32) int32_t alpha[EVAL_LANES];
+    alignas(32) int32_t beta[EVAL_LANES];
+    alignas(32) int32_t settleVelocity[EVAL_LANES];
+    alignas(32) int32_t tolerance[EVAL_LANES];
+    alignas(32) int32_t thresholdBelow[EVAL_LANES];
+    alignas(32) int32_t debounceBelow[EVAL_LANES];
+
+    // Samples are evenly spaced, so "now - start >= debounce" becomes a
+    // whole number of samples
+    int64_t periodUs = trace.header->samplePeriodUs;
+    for (int lane = 0; lane < EVAL_LANES; lane++) {
+        int64_t debounceUs = (int64_t)params[lane].debounceMs * 1000;
+        int64_t debounceSamples = (debounceUs + periodUs - 1) / periodUs;
+        if (debounceSamples > INT_MAX) debounceSamples = INT_MAX;
+
+        alpha[lane] = params[lane].filterAlpha;
+        beta[lane] = params[lane].trackerBeta;
+        settleVelocity[lane] = pipeline::degreesPerSToVelocity(params[lane].settleSpeed, periodUs);
+        tolerance[lane] = params[lane].tolerance;
+        thresholdBelow[lane] = params[lane].threshold - 1;  // a >= b as a > b - 1
+        debounceBelow[lane] = (int32_t)debounceSamples - 1;
+    }
+
+    // Likewise the report rate cap, shared by every lane
+    int64_t reportGapSamples = (pipeline::REPORT_MIN_US + periodUs - 1) / periodUs;
+    if (reportGapSamples > INT_MAX / 2) reportGapSamples = INT_MAX / 2;
+
+    const int32_t* table = angleTable();
+    const __m256i vAlpha = _mm256_load_si256((const __m256i*)alpha);
+    const __m256i vBeta = _mm256_load_si256((const __m256i*)beta);
+    const __m256i vSettle = _mm256_load_si256((const __m256i*)settleVelocity);
+    const __m256i vTolerance = _mm256_load_si256((const __m256i*)tolerance);
+    const __m256i vThreshold = _mm256_load_si256((const __m256i*)thresholdBelow);
+    const __m256i vDebounce = _mm256_load_si256((const __m256i*)debounceBelow);
+    const __m256i vTarget = _mm256_set1_epi32(trace.header->targetDirection);
+    const __m256i vFullTurn = _mm256_set1_epi32(360);
+    const __m256i vZero = _mm256_setzero_si256();
+    const __m256i vRawMax = _mm256_set1_epi32(pipeline::RAW_MAX);
+    const __m256i vHalf = _mm256_set1_epi32(128);
+    const __m256i vReportGap = _mm256_set1_epi32((int32_t)reportGapSamples - 1);
+
+    // The first sample primes the tracker at rest; stepping it against
+    // itself is then a no-op, so the loop can start at 0
+    __m256i position = _mm256_set1_epi32(trace.count > 0 ? trace.samples[0] << 8 : 0);
+    __m256i velocity = vZero;
+    __m256i lastReported = _mm256_set1_epi32(-1);
+    __m256i lastReportSample = _mm256_set1_epi32(-(int32_t)reportGapSamples);
+    __m256i reports = vZero;
+    __m256i dwellStarts = vZero;
+    __m256i dwellCancels = vZero;
+    __m256i active = vZero;  // Lane masks: all ones = true
+    __m256i solved = vZero;
+    __m256i startSample = vZero;
+    __m256i solveSample = _mm256_set1_epi32(-1);
+
+    for (uint32_t i = 0; i < trace.count; i++) {
+        __m256i measured = _mm256_set1_epi32(trace.samples[i] << 8);
+        __m256i index = _mm256_set1_epi32((int32_t)i);
+
+        // Track and map
+        __m256i predicted = _mm256_add_epi32(position, velocity);
+        __m256i residual = _mm256_sub_epi32(measured, predicted);
+        position = _mm256_add_epi32(predicted, _mm256_srai_epi32(_mm256_mullo_epi32(residual, vAlpha), 8));
+        velocity = _mm256_add_epi32(velocity, _mm256_srai_epi32(_mm256_mullo_epi32(residual, vBeta), 8));
+        __m256i tracked = _mm256_srai_epi32(_mm256_add_epi32(position, vHalf), 8);
+        __m256i clamped = _mm256_max_epi32(_mm256_min_epi32(tracked, vRawMax), vZero);
+        __m256i angle = _mm256_i32gather_epi32((const int*)table, clamped, 4);
+        __m256i settled = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_abs_epi32(velocity), vSettle), _mm256_set1_epi32(-1));
+
+        // Direction reports
+        __m256i moved = _mm256_abs_epi32(_mm256_sub_epi32(angle, lastReported));
+        __m256i report = _mm256_and_si256(_mm256_cmpgt_epi32(moved, vThreshold),
+                                          _mm256_cmpgt_epi32(_mm256_sub_epi32(index, lastReportSample), vReportGap));
+        reports = _mm256_sub_epi32(reports, report);
+        lastReported = _mm256_blendv_epi8(lastReported, angle, report);
+        lastReportSample = _mm256_blendv_epi8(lastReportSample, index, report);
+
+        // Dwell: distance the short way round the dial
+        __m256i distance = _mm256_abs_epi32(_mm256_sub_epi32(angle, vTarget));
+        distance = _mm256_min_epi32(distance, _mm256_sub_epi32(vFullTurn, distance));
+        __m256i atTarget = _mm256_andnot_si256(_mm256_cmpgt_epi32(distance, vTolerance), _mm256_set1_epi32(-1));
+
+        __m256i pending = _mm256_and_si256(_mm256_andnot_si256(solved, atTarget), settled);
+        __m256i start = _mm256_andnot_si256(active, pending);
+        __m256i elapsed = _mm256_cmpgt_epi32(_mm256_sub_epi32(index, startSample), vDebounce);
+        __m256i complete = _mm256_and_si256(_mm256_and_si256(pending, active), elapsed);
+        __m256i cancel = _mm256_andnot_si256(atTarget, active);
+
+        dwellStarts = _mm256_sub_epi32(dwellStarts, start);
+        dwellCancels = _mm256_sub_epi32(dwellCancels, cancel);
+        startSample = _mm256_blendv_epi8(startSample, index, start);
+        solveSample = _mm256_blendv_epi8(solveSample, index, complete);
+        solved = _mm256_or_si256(solved, complete);
+        active = _mm256_andnot_si256(_mm256_or_si256(complete, cancel), _mm256_or_si256(active, start));
+    }
+
+    alignas(32) int32_t laneSolve[EVAL_LANES];
+    alignas(32) int32_t laneReports[EVAL_LANES];
+    alignas(32) int32_t laneStarts[EVAL_LANES];
+    alignas(32) int32_t laneCancels[EVAL_LANES];
+    _mm256_store_si256((__m256i*)laneSolve, solveSample);
+    _mm256_store_si256((__m256i*)laneReports, reports);
+    _mm256_store_si256((__m256i*)laneStarts, dwellStarts);
+    _mm256_store_si256((__m256i*)laneCancels, dwellCancels);
+    for (int lane = 0; lane < EVAL_LANES; lane++) {
+        results[lane].solveSample = laneSolve[lane];
+        results[lane].reports = (uint32_t)laneReports[lane];
+        results[lane].dwellStarts = (uint32_t)laneStarts[lane];
+        results[lane].dwellCancels = (uint32_t)laneCancels[lane];
+    }
+}
@@ -0,0 +1,145 @@
+#include "Sweep.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <thread>
+
+static bool loadFile(const std::string& path, const std::string& compass, TraceSet& set, std::string& error) {
+    std::unique_ptr<TraceFile> file(new TraceFile());
+    if (!file->open(path)) {
+        error = file->error();
+        return false;
+    }
+    for (const Trace& trace : file->traces()) {
+        if (!compass.empty() && traceCompass(*trace.header) != compass) continue;
+        set.traces.push_back(trace);
+        set.samples += trace.count;
+    }
+    set.bytes += file->bytes();
+    set.files.push_back(std::move(file));
+    return true;
+}
+
+bool loadTraces(const std::vector<std::string>& paths, const std::string& compass, TraceSet& set, std::string& error) {
+    for (const std::string& path : paths) {
+        std::error_code status;
+        if (!std::filesystem::is_directory(path, status)) {
+            if (!loadFile(path, compass, set, error)) return false;
+            continue;
+        }
+
+        // Directory: every .ctr file in it, in name order
+        std::vector<std::string> names;
+        for (const auto& entry : std::filesystem::directory_iterator(path, status)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".ctr") {
+                names.push_back(entry.path().string());
+            }
+        }
+        if (status) {
+            error = path + ": " + status.message();
+            return false;
+        }
+        std::sort(names.begin(), names.end());
+        for (const std::string& name : names) {
+            if (!loadFile(name, compass, set, error)) return false;
+        }
+    }
+    return true;
+}
+
+void addResult(SweepTotals& totals, const Trace& trace, const TraceResult& result) {
+    const TraceHeader& header = *trace.header;
+    totals.sessions++;
+    totals.reports += result.reports;
+    totals.dwellCancels += result.dwellCancels;
+    totals.durationUs += (uint64_t)trace.count * header.samplePeriodUs;
+
+    bool shouldSolve = (header.expectedSolve != TRACE_NO_SOLVE);
+    if (shouldSolve) {
+        totals.expectedSolves++;
+    }
+    if (result.solveSample < 0) {
+        if (shouldSolve) totals.missed++;
+    } else if (!shouldSolve || result.solveSample < header.expectedSolve) {
+        totals.falseSolves++;
+    } else {
+        totals.solved++;
+        totals.latencyUs += (uint64_t)(result.solveSample - header.expectedSolve) * header.samplePeriodUs;
+    }
+}
+
+static bool sameResult(const TraceResult& a, const TraceResult& b) {
+    return a.solveSample == b.solveSample && a.reports == b.reports &&
+        a.dwellStarts == b.dwellStarts && a.dwellCancels == b.dwellCancels;
+}
+
+SweepReport runSweep(const std::vector<Trace>& traces, const std::vector<PipelineParams>& params, const SweepOptions& options) {
+    auto started = std::chrono::steady_clock::now();
+    int threads = options.threads;
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = (int)std::min<size_t>(threads, std::max<size_t>(1, traces.size()));
+
+    // Each worker takes the next trace and runs every parameter set over
+    // it while it is still in cache; totals are merged at the end
+    std::atomic<size_t> nextTrace(0);
+    std::atomic<uint64_t> mismatches(0);
+    std::vector<std::vector<SweepTotals>> workerTotals(threads, std::vector<SweepTotals>(params.size()));
+
+    auto worker = [&](int id) {
+        std::vector<SweepTotals>& totals = workerTotals[id];
+        std::vector<TraceResult> results(params.size());
+        for (;;) {
+            size_t index = nextTrace.fetch_add(1);
+            if (index >= traces.size()) break;
+            const Trace& trace = traces[index];
+
+            evaluateTrace(trace, params.data(), (int)params.size(), results.data(), options.useSimd);
+            for (size_t p = 0; p < params.size(); p++) {
+                addResult(totals[p], trace, results[p]);
+            }
+
+            if (options.verify) {
+                for (size_t p = 0; p < params.size(); p++) {
+                    TraceResult reference;
+                    evaluateScalar(trace, params[p], reference);
+                    if (!sameResult(reference, results[p])) mismatches++;
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int id = 1; id < threads; id++) {
+        pool.emplace_back(worker, id);
+    }
+    worker(0);
+    for (std::thread& thread : pool) {
+        thread.join();
+    }
+
+    SweepReport report;
+    report.totals.resize(params.size());
+    for (const std::vector<SweepTotals>& totals : workerTotals) {
+        for (size_t p = 0; p < params.size(); p++) {
+            SweepTotals& sum = report.totals[p];
+            sum.sessions += totals[p].sessions;
+            sum.expectedSolves += totals[p].expectedSolves;
+            sum.solved += totals[p].solved;
+            sum.falseSolves += totals[p].falseSolves;
+            sum.missed += totals[p].missed;
+            sum.latencyUs += totals[p].latencyUs;
+            sum.reports += totals[p].reports;
+            sum.dwellCancels += totals[p].dwellCancels;
+            sum.durationUs += totals[p].durationUs;
+        }
+    }
+    report.mismatches = mismatches;
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    return report;
+}
@@ -0,0 +1,59 @@
+// ============================================
+// SWEEP
+// Runs a list of parameter sets over every trace in a dataset on a pool of
+// threads and totals the results per set.
+// ============================================
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Evaluator.h"
+#include "TraceFile.h"
+
+// Mapped files and the traces selected from them
+struct TraceSet {
+    std::vector<std::unique_ptr<TraceFile>> files;
+    std::vector<Trace> traces;
+    uint64_t samples = 0;
+    uint64_t bytes = 0;
+};
+
+// Maps each path (a trace file, or a directory of *.ctr files) and keeps
+// the traces from the named compass, or all of them if compass is empty
+bool loadTraces(const std::vector<std::string>& paths, const std::string& compass, TraceSet& set, std::string& error);
+
+struct SweepTotals {
+    uint32_t sessions = 0;
+    uint32_t expectedSolves = 0;  // Sessions a person judged solved
+    uint32_t solved = 0;  // Solved at or after that point
+    uint32_t falseSolves = 0;  // Solved before it, or in a session that never was
+    uint32_t missed = 0;  // Judged solved, never solved
+    uint64_t latencyUs = 0;  // Summed over correct solves
+    uint64_t reports = 0;
+    uint64_t dwellCancels = 0;
+    uint64_t durationUs = 0;
+
+    double meanLatencyMs() const { return solved > 0 ? latencyUs / 1000.0 / solved : 0; }
+    double falseSolveRate() const { return sessions > 0 ? (double)falseSolves / sessions : 0; }
+    double reportsPerMinute() const { return durationUs > 0 ? reports * 60e6 / durationUs : 0; }
+};
+
+struct SweepOptions {
+    int threads = 0;  // 0 = one per core
+    bool useSimd = true;
+    bool verify = false;  // Also run the scalar path and compare
+};
+
+struct SweepReport {
+    std::vector<SweepTotals> totals;  // One per parameter set
+    uint64_t mismatches = 0;  // SIMD results that differ from scalar
+    double seconds = 0;
+};
+
+SweepReport runSweep(const std::vector<Trace>& traces, const std::vector<PipelineParams>& params, const SweepOptions& options);
+
+// Adds one trace's result to the totals
+void addResult(SweepTotals& totals, const Trace& trace, const TraceResult& result);
@@ -0,0 +1,168 @@
+#include "TraceFile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <CompassPipeline.h>
+
+static size_t paddedSamples(uint32_t count) {
+    size_t bytes = (size_t)count * sizeof(uint16_t);
+    return (bytes + 7) & ~(size_t)7;
+}
+
+TraceFile::~TraceFile() {
+    if (mapped != nullptr) {
+        munmap((void*)mapped, mappedBytes);
+    }
+}
+
+bool TraceFile::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        errorText = path + ": " + strerror(errno);
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        errorText = path + ": " + strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    mappedBytes = (size_t)info.st_size;
+    if (mappedBytes == 0) {
+        ::close(fd);
+        return true;
+    }
+
+    void* base = mmap(nullptr, mappedBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        errorText = path + ": " + strerror(errno);
+        mappedBytes = 0;
+        return false;
+    }
+    mapped = (const uint8_t*)base;
+    madvise(base, mappedBytes, MADV_SEQUENTIAL);
+
+    // Walk the headers
+    size_t offset = 0;
+    while (offset < mappedBytes) {
+        if (mappedBytes - offset < sizeof(TraceHeader)) {
+            errorText = path + ": truncated header at byte " + std::to_string(offset);
+            return false;
+        }
+        const TraceHeader* header = (const TraceHeader*)(mapped + offset);
+        if (memcmp(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+            errorText = path + ": bad magic at byte " + std::to_string(offset);
+            return false;
+        }
+        if (header->version != TRACE_VERSION || header->headerBytes < sizeof(TraceHeader) ||
+            header->headerBytes % 8 != 0) {
+            errorText = path + ": unsupported trace version " + std::to_string(header->version);
+            return false;
+        }
+        if (header->samplePeriodUs == 0 || header->sampleCount > INT32_MAX) {
+            errorText = path + ": bad sample period or count at byte " + std::to_string(offset);
+            return false;
+        }
+        size_t length = header->headerBytes + paddedSamples(header->sampleCount);
+        if (length > mappedBytes - offset) {
+            errorText = path + ": truncated samples at byte " + std::to_string(offset);
+            return false;
+        }
+
+        Trace trace;
+        trace.header = header;
+        trace.samples = (const uint16_t*)(mapped + offset + header->headerBytes);
+        trace.count = header->sampleCount;
+        trace.recorded = header;
+        if (header->mainsHz != 0 && !filterConversions(trace, path, offset)) {
+            return false;
+        }
+        traceList.push_back(trace);
+        offset += length;
+    }
+    return true;
+}
+
+// Conversions through the reference FIR, one sample per FIR output as the
+// firmware takes them when sampling fast. The trace is repointed at the
+// output.
+bool TraceFile::filterConversions(Trace& trace, const std::string& path, size_t offset) {
+    const TraceHeader& header = *trace.recorded;
+    uint32_t conversionHz = 1000000 / header.samplePeriodUs;
+    uint32_t window = (conversionHz * header.samplePeriodUs == 1000000) ? pipeline::mainsWindow(conversionHz, header.mainsHz) : 0;
+    if (window < 2 || pipeline::firTaps(window) > pipeline::FIR_MAX_TAPS || header.firDecimation == 0) {
+        errorText = path + ": no mains FIR for the conversion trace at byte " + std::to_string(offset);
+        return false;
+    }
+
+    filtered.emplace_back();
+    Filtered& output = filtered.back();
+    pipeline::Fir fir;
+    pipeline::firInit(fir, window, header.firDecimation);
+    for (uint32_t i = 0; i < trace.count; i++) {
+        if (pipeline::firStep(fir, trace.samples[i])) {
+            output.samples.push_back((uint16_t)fir.output);
+        }
+    }
+    output.header = header;
+    output.header.samplePeriodUs = header.samplePeriodUs * header.firDecimation;
+    output.header.sampleCount = (uint32_t)output.samples.size();
+    if (header.expectedSolve != TRACE_NO_SOLVE) {
+        output.header.expectedSolve = header.expectedSolve / header.firDecimation;
+    }
+
+    trace.header = &output.header;
+    trace.samples = output.samples.data();
+    trace.count = output.header.sampleCount;
+    return true;
+}
+
+TraceWriter::~TraceWriter() {
+    close();
+}
+
+bool TraceWriter::open(const std::string& path) {
+    file = fopen(path.c_str(), "wb");
+    return file != nullptr;
+}
+
+bool TraceWriter::write(const TraceHeader& header, const uint16_t* samples) {
+    static const uint8_t zeros[8] = {};
+    size_t bytes = (size_t)header.sampleCount * sizeof(uint16_t);
+    size_t padding = paddedSamples(header.sampleCount) - bytes;
+    return fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(samples, 1, bytes, file) == bytes &&
+        fwrite(zeros, 1, padding, file) == padding;
+}
+
+bool TraceWriter::close() {
+    if (file == nullptr) return true;
+    bool ok = (fclose(file) == 0);
+    file = nullptr;
+    return ok;
+}
+
+TraceHeader makeTraceHeader(const char* compass, int targetDirection, uint32_t samplePeriodUs, uint32_t sampleCount) {
+    TraceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    header.version = TRACE_VERSION;
+    header.headerBytes = sizeof(TraceHeader);
+    memcpy(header.compass, compass, strnlen(compass, sizeof(header.compass)));
+    header.samplePeriodUs = samplePeriodUs;
+    header.sampleCount = sampleCount;
+    header.expectedSolve = TRACE_NO_SOLVE;
+    header.targetDirection = (uint16_t)targetDirection;
+    return header;
+}
+
+std::string traceCompass(const TraceHeader& header) {
+    return std::string(header.compass, strnlen(header.compass, sizeof(header.compass)));
+}
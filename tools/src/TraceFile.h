@@ -0,0 +1,104 @@
+// ============================================
+// TRACE FILES
+// Raw ADC samples recorded from a compass, one 16-bit value per sample at
+// a fixed period. A file holds any number of traces back to back:
+//
+//   TraceHeader (48 bytes, little-endian)
+//   uint16_t raw[sampleCount]
+//   zero padding to a multiple of 8 bytes
+//
+// Files are memory-mapped and read in place, so a dataset of any size
+// costs no parsing or copying.
+//
+// A trace is either angle samples (the mains FIR's output) or, when
+// mainsHz is set, raw conversions at the ADC rate. Conversion traces are
+// run through the pipeline's reference FIR on open, so every tool sees the
+// samples the firmware would have.
+// ============================================
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+const char TRACE_MAGIC[4] = { 'C', 'T', 'R', 'C' };
+const uint16_t TRACE_VERSION = 1;
+const int TRACE_NO_SOLVE = -1;  // expectedSolve for sessions that must not solve
+
+struct TraceHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t headerBytes;
+    char compass[16];  // Device name, NUL padded
+    uint32_t samplePeriodUs;
+    uint32_t sampleCount;
+    int32_t expectedSolve;  // Sample index a person judged solved, or TRACE_NO_SOLVE
+    uint16_t targetDirection;
+    uint8_t mainsHz;  // Conversion traces: mains the FIR nulls, else 0
+    uint8_t firDecimation;  // Conversion traces: conversions per FIR output
+    uint64_t startTime;  // Unix time of the first sample, 0 if unknown
+};
+static_assert(sizeof(TraceHeader) == 48, "trace header layout");
+
+// One trace inside a mapped file. For a conversion trace, header and
+// samples are the FIR output and recorded is the header in the file.
+struct Trace {
+    const TraceHeader* header;
+    const uint16_t* samples;
+    uint32_t count;
+    const TraceHeader* recorded;
+};
+
+class TraceFile {
+public:
+    TraceFile() {}
+    ~TraceFile();
+    TraceFile(const TraceFile&) = delete;
+    TraceFile& operator=(const TraceFile&) = delete;
+
+    // Maps the file, indexes its traces and filters conversion traces. On
+    // failure returns false and sets error().
+    bool open(const std::string& path);
+
+    const std::vector<Trace>& traces() const { return traceList; }
+    const std::string& error() const { return errorText; }
+    size_t bytes() const { return mappedBytes; }
+
+private:
+    bool filterConversions(Trace& trace, const std::string& path, size_t offset);
+
+    struct Filtered {
+        TraceHeader header;
+        std::vector<uint16_t> samples;
+    };
+
+    const uint8_t* mapped = nullptr;
+    size_t mappedBytes = 0;
+    std::vector<Trace> traceList;
+    std::deque<Filtered> filtered;  // Conversion traces after the FIR
+    std::string errorText;
+};
+
+// Appends traces to a file
+class TraceWriter {
+public:
+    ~TraceWriter();
+
+    bool open(const std::string& path);
+    bool write(const TraceHeader& header, const uint16_t* samples);
+    bool close();
+
+private:
+    FILE* file = nullptr;
+};
+
+// Header with the magic, version and sizes filled in
+TraceHeader makeTraceHeader(const char* compass, int targetDirection, uint32_t samplePeriodUs, uint32_t sampleCount);
+
+// Compass name from a header, without padding
+std::string traceCompass(const TraceHeader& header);
@@ -0,0 +1,151 @@
+// compass_eval: replay recorded traces through the firmware pipeline for a
+// grid of parameter sets and report how each one does
+//
+//   compass_eval --tolerance 6:14:2 --debounce 300,500,800 traces/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <CompassPipeline.h>
+
+#include "Args.h"
+#include "Sweep.h"
+
+static void usage() {
+    fprintf(stderr,
+        "usage: compass_eval [options] TRACE|DIR...\n"
+        "  --alpha LIST      tracker position gain, Q8 1-256 (default 128)\n"
+        "  --beta LIST       tracker velocity gain, Q8 0-128 (default 32)\n"
+        "  --tolerance LIST  DIRECTION_TOLERANCE, degrees (default 10)\n"
+        "  --threshold LIST  ANGLE_CHANGE_THRESHOLD, degrees (default 2)\n"
+        "  --debounce LIST   DEBOUNCE_TIME, ms (default 500)\n"
+        "  --settle N        SETTLE_SPEED, degrees/s (default 45)\n"
+        "  --compass NAME    only traces from this compass\n"
+        "  --threads N       worker threads (default: one per core)\n"
+        "  --scalar          don't use AVX2\n"
+        "  --verify          check AVX2 results against the scalar path\n"
+        "  --csv             CSV output\n"
+        "LIST is comma separated values and lo:hi[:step] ranges\n");
+}
+
+int main(int argc, char** argv) {
+    std::vector<int> alphas, betas, tolerances, thresholds, debounces;
+    long settleSpeed = pipeline::SETTLE_SPEED_DEFAULT;
+    std::vector<std::string> paths;
+    std::string compass;
+    SweepOptions options;
+    bool csv = false;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        bool ok = true;
+        long value;
+        if (strcmp(arg, "--alpha") == 0 && hasValue) {
+            ok = parseIntList(argv[++i], alphas);
+        } else if (strcmp(arg, "--beta") == 0 && hasValue) {
+            ok = parseIntList(argv[++i], betas);
+        } else if (strcmp(arg, "--tolerance") == 0 && hasValue) {
+            ok = parseIntList(argv[++i], tolerances);
+        } else if (strcmp(arg, "--threshold") == 0 && hasValue) {
+            ok = parseIntList(argv[++i], thresholds);
+        } else if (strcmp(arg, "--debounce") == 0 && hasValue) {
+            ok = parseIntList(argv[++i], debounces);
+        } else if (strcmp(arg, "--settle") == 0 && hasValue) {
+            ok = parseInt(argv[++i], settleSpeed) && settleSpeed >= 0;
+        } else if (strcmp(arg, "--compass") == 0 && hasValue) {
+            compass = argv[++i];
+        } else if (strcmp(arg, "--threads") == 0 && hasValue) {
+            ok = parseInt(argv[++i], value) && value > 0;
+            options.threads = (int)value;
+        } else if (strcmp(arg, "--scalar") == 0) {
+            options.useSimd = false;
+        } else if (strcmp(arg, "--verify") == 0) {
+            options.verify = true;
+        } else if (strcmp(arg, "--csv") == 0) {
+            csv = true;
+        } else if (arg[0] == '-') {
+            usage();
+            return 2;
+        } else {
+            paths.push_back(arg);
+        }
+        if (!ok) {
+            fprintf(stderr, "compass_eval: bad value for %s\n", arg);
+            return 2;
+        }
+    }
+    if (paths.empty()) {
+        usage();
+        return 2;
+    }
+    if (alphas.empty()) alphas.push_back(pipeline::FILTER_ALPHA_DEFAULT);
+    if (betas.empty()) betas.push_back(pipeline::TRACKER_BETA_DEFAULT);
+    if (tolerances.empty()) tolerances.push_back(10);
+    if (thresholds.empty()) thresholds.push_back(2);
+    if (debounces.empty()) debounces.push_back(500);
+    for (int alpha : alphas) {
+        if (alpha < 1 || alpha > pipeline::FILTER_ALPHA_ONE) {
+            fprintf(stderr, "compass_eval: alpha %d out of range 1-%d\n", alpha, pipeline::FILTER_ALPHA_ONE);
+            return 2;
+        }
+    }
+    for (int beta : betas) {
+        if (beta < 0 || beta > pipeline::TRACKER_BETA_MAX) {
+            fprintf(stderr, "compass_eval: beta %d out of range 0-%d\n", beta, pipeline::TRACKER_BETA_MAX);
+            return 2;
+        }
+    }
+
+    std::vector<PipelineParams> params;
+    for (int alpha : alphas) {
+        for (int beta : betas) {
+            for (int tolerance : tolerances) {
+                for (int threshold : thresholds) {
+                    for (int debounce : debounces) {
+                        params.push_back({ alpha, tolerance, threshold, debounce, beta, (int)settleSpeed });
+                    }
+                }
+            }
+        }
+    }
+
+    TraceSet set;
+    std::string error;
+    if (!loadTraces(paths, compass, set, error)) {
+        fprintf(stderr, "compass_eval: %s\n", error.c_str());
+        return 1;
+    }
+    if (set.traces.empty()) {
+        fprintf(stderr, "compass_eval: no traces\n");
+        return 1;
+    }
+
+    SweepReport report = runSweep(set.traces, params, options);
+
+    if (csv) {
+        printf("alpha,beta,tolerance,threshold,debounce_ms,sessions,solved,false_solves,missed,mean_latency_ms,reports_per_min,dwell_cancels\n");
+    } else {
+        printf("%5s %4s %4s %4s %6s | %8s %7s %6s %6s %10s %9s %8s\n",
+            "alpha", "beta", "tol", "thr", "deb", "sessions", "solved", "false", "missed", "latency ms", "rpt/min", "cancels");
+    }
+    for (size_t p = 0; p < params.size(); p++) {
+        const PipelineParams& candidate = params[p];
+        const SweepTotals& totals = report.totals[p];
+        printf(csv ? "%d,%d,%d,%d,%d,%u,%u,%u,%u,%.1f,%.2f,%llu\n" : "%5d %4d %4d %4d %6d | %8u %7u %6u %6u %10.1f %9.2f %8llu\n",
+            candidate.filterAlpha, candidate.trackerBeta, candidate.tolerance, candidate.threshold, candidate.debounceMs,
+            totals.sessions, totals.solved, totals.falseSolves, totals.missed,
+            totals.meanLatencyMs(), totals.reportsPerMinute(), (unsigned long long)totals.dwellCancels);
+    }
+
+    double evaluated = (double)set.samples * params.size();
+    fprintf(stderr, "%zu traces, %.1f MB, %zu parameter sets in %.3f s (%.0f M samples/s, %s)\n",
+        set.traces.size(), set.bytes / 1e6, params.size(), report.seconds,
+        report.seconds > 0 ? evaluated / report.seconds / 1e6 : 0,
+        options.useSimd && simdAvailable() ? "AVX2" : "scalar");
+    if (options.verify) {
+        fprintf(stderr, "verify: %llu mismatches against the scalar path\n", (unsigned long long)report.mismatches);
+        if (report.mismatches != 0) return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,185 @@
+// compass_gpio_test: drive lib/CompassFirmware on the host HAL through its
+// solve output and check what reaches the pin. The host prop's output is
+// active low, as on a relay board:
+//   - boot: the inactive level is in the output register before pinMode()
+//   - pulse mode: the solve turns the pin on, and the pulse end runs off
+//     the scheduler wheel within a tick of its deadline
+//   - latch mode: the pin stays on until PUZZLE_RESET
+//   - a config change of output mode while latched turns it off
+//
+//   compass_gpio_test [--serial]
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <CompassFirmware.h>
+
+#include "HostHal.h"
+
+// host/config/PropConfig.h
+const int POT_GPIO = 4;
+const int SOLVE_PIN = 12;
+const int ACTIVE = 0;  // SOLVE_OUTPUT_ACTIVE_HIGH false
+const int INACTIVE = 1;
+const int TARGET_RAW = 3536;  // map(315, 0, 359, 0, 4095)
+const int AWAY_RAW = 1000;
+
+const int64_t MS_US = 1000;
+const int64_t PULSE_US = 500 * MS_US;  // SOLVE_PULSE_MS
+const int64_t SAMPLE_PERIOD_US = 50 * MS_US;  // LOOP_DELAY, sampling fast while the pot moves
+const int64_t TICK_US = 1000;  // Scheduler wheel and FreeRTOS tick
+
+int failures = 0;
+std::vector<std::string> solvedTopic;
+
+void check(bool ok, const char* format, ...) __attribute__((format(printf, 2, 3)));
+void check(bool ok, const char* format, ...) {
+    char text[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    printf("%s %s\n", ok ? "ok  " : "FAIL", text);
+    if (!ok) failures++;
+}
+
+void runFor(int64_t us) {
+    int64_t endUs = host::now() + us;
+    while (host::now() < endUs) {
+        compassLoop();
+    }
+}
+
+// Writes to the solve output pin from startUs on
+std::vector<host::PinWrite> writesSince(int64_t startUs) {
+    std::vector<host::PinWrite> writes;
+    for (const host::PinWrite& write : host::pinWrites()) {
+        if (write.pin == SOLVE_PIN && write.us >= startUs) {
+            writes.push_back(write);
+        }
+    }
+    return writes;
+}
+
+// First write of level from startUs on, or -1
+int64_t firstWrite(int64_t startUs, int level) {
+    for (const host::PinWrite& write : writesSince(startUs)) {
+        if (write.level == level) return write.us;
+    }
+    return -1;
+}
+
+void command(const char* text) {
+    host::deliver("MermaidsTale/HostCompass/command", text);
+}
+
+void checkBoot() {
+    const std::vector<host::PinWrite> writes = writesSince(0);
+    check(!writes.empty() && !writes[0].driven && writes[0].level == INACTIVE,
+        "boot: inactive level set in the output register before the pin is an output");
+    check(host::pinOutput(SOLVE_PIN) && host::pinLevel(SOLVE_PIN) == INACTIVE, "boot: pin is an output, inactive");
+    bool glitch = false;
+    for (const host::PinWrite& write : writes) {
+        glitch |= write.level != INACTIVE;
+    }
+    check(!glitch, "boot: never active");
+}
+
+void checkPulse() {
+    int64_t startUs = host::now();
+    size_t solves = solvedTopic.size();
+    host::setPot(POT_GPIO, TARGET_RAW);
+    runFor(3000 * MS_US);
+
+    int64_t onUs = firstWrite(startUs, ACTIVE);
+    int64_t offUs = onUs < 0 ? -1 : firstWrite(onUs, INACTIVE);
+    check(solvedTopic.size() == solves + 1, "pulse: solved once");
+    check(onUs >= 0, "pulse: solve drives the pin active");
+    check(offUs >= 0, "pulse: pulse ends");
+    if (onUs < 0 || offUs < 0) return;
+
+    // The pulse is timed from the solving sample, which the loop reads up
+    // to a sample period after it was taken; the end waits on the wheel
+    int64_t widthUs = offUs - onUs;
+    check(widthUs > PULSE_US - SAMPLE_PERIOD_US - TICK_US && widthUs <= PULSE_US + TICK_US,
+        "pulse: %lld us long, %lld us pulse from a sample up to %lld us old", (long long)widthUs,
+        (long long)PULSE_US, (long long)SAMPLE_PERIOD_US);
+    check(writesSince(startUs).size() == 2, "pulse: one write on, one off (%zu)", writesSince(startUs).size());
+    check(host::pinLevel(SOLVE_PIN) == INACTIVE, "pulse: inactive after");
+}
+
+void checkLatch() {
+    // Away from the target and back, in latch mode
+    host::setPot(POT_GPIO, AWAY_RAW);
+    command("SET output 2; PUZZLE_RESET");
+    runFor(1000 * MS_US);
+    int64_t startUs = host::now();
+    host::setPot(POT_GPIO, TARGET_RAW);
+    runFor(3000 * MS_US);
+
+    int64_t onUs = firstWrite(startUs, ACTIVE);
+    check(onUs >= 0, "latch: solve drives the pin active");
+    check(onUs >= 0 && firstWrite(onUs, INACTIVE) < 0 && host::pinLevel(SOLVE_PIN) == ACTIVE,
+        "latch: still active %lld ms after the solve", (long long)((host::now() - onUs) / MS_US));
+
+    // PUZZLE_RESET releases it on the pass that handles the command
+    int64_t resetUs = host::now();
+    command("PUZZLE_RESET");
+    runFor(100 * MS_US);
+    int64_t offUs = firstWrite(resetUs, INACTIVE);
+    check(offUs >= 0, "latch: PUZZLE_RESET drives the pin inactive");
+}
+
+void checkConfigChange() {
+    // Still on the target after the reset, so it solves and latches again;
+    // then a new output mode over the config topic starts from off
+    runFor(3000 * MS_US);
+    check(host::pinLevel(SOLVE_PIN) == ACTIVE, "config: latched again after the reset");
+
+    int64_t changeUs = host::now();
+    host::deliver("MermaidsTale/HostCompass/config", "output=1");
+    runFor(1000 * MS_US);
+    int64_t offUs = firstWrite(changeUs, INACTIVE);
+    check(offUs >= 0 && host::pinLevel(SOLVE_PIN) == INACTIVE, "config: output=1 while latched drives the pin inactive");
+    check(firstWrite(changeUs, ACTIVE) < 0, "config: no pulse for the solve that already happened");
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--serial") == 0) {
+            host::setSerialEcho(true);
+        } else {
+            fprintf(stderr, "usage: compass_gpio_test [--serial]\n");
+            return 2;
+        }
+    }
+
+    host::onPublish([](const host::Message& message) {
+        if (message.topic == "MermaidsTale/HostCompassSolved") {
+            solvedTopic.push_back(message.payload);
+        }
+    });
+    host::setPot(POT_GPIO, AWAY_RAW);
+
+    compassSetup();
+    checkBoot();
+    runFor(2000 * MS_US);
+    check(host::connected(), "connected to the broker");
+
+    checkPulse();
+    checkLatch();
+    checkConfigChange();
+    check(host::pinMisuses() == 0, "no writes to the pin before it is an output (%u)", host::pinMisuses());
+
+    printf("%s\n", failures == 0 ? "PASS" : "FAIL");
+
+    // The firmware's tasks are still running: leave without unwinding them
+    fflush(stdout);
+    _Exit(failures == 0 ? 0 : 1);
+}
@@ -0,0 +1,193 @@
+// compass_profile: read a PROFILE dump from the firmware and report where
+// the loop's core spends its time, per function. PCs are mapped with
+// addr2line from the ESP32-S3 toolchain against the firmware ELF.
+//
+//   compass_profile [--elf FIRMWARE.elf] [--addr2line TOOL] [--top N] DUMP
+//
+// Capture a dump with e.g.
+//   mosquitto_sub -h BROKER -C 1 -t MermaidsTale/BlueCompass/profile > blue.prof
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Args.h"
+
+const uint8_t PROFILE_FORMAT_VERSION = 1;
+const size_t PROFILE_HEADER_BYTES = 28;
+const char* DEFAULT_ADDR2LINE = "xtensa-esp32s3-elf-addr2line";
+
+struct ProfileHeader {
+    uint32_t entries;
+    uint32_t hz;
+    uint32_t durationMs;
+    uint32_t samples;
+    uint32_t inInterrupt;
+    uint32_t dropped;
+};
+
+struct ProfileEntry {
+    uint32_t pc;
+    uint32_t count;
+};
+
+static uint32_t readU32(const uint8_t* bytes) {
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static bool readProfile(const char* path, ProfileHeader& header, std::vector<ProfileEntry>& entries, std::string& error) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        error = std::string("cannot open ") + path;
+        return false;
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (data.size() < PROFILE_HEADER_BYTES || data[0] != 'C' || data[1] != 'P') {
+        error = std::string(path) + ": not a profile dump";
+        return false;
+    }
+    if (data[2] != PROFILE_FORMAT_VERSION) {
+        error = std::string(path) + ": unsupported format version " + std::to_string(data[2]);
+        return false;
+    }
+    header.entries = readU32(&data[4]);
+    header.hz = readU32(&data[8]);
+    header.durationMs = readU32(&data[12]);
+    header.samples = readU32(&data[16]);
+    header.inInterrupt = readU32(&data[20]);
+    header.dropped = readU32(&data[24]);
+    if (data.size() != PROFILE_HEADER_BYTES + (size_t)header.entries * 8) {
+        error = std::string(path) + ": truncated";
+        return false;
+    }
+    for (uint32_t i = 0; i < header.entries; i++) {
+        const uint8_t* bytes = &data[PROFILE_HEADER_BYTES + i * 8];
+        entries.push_back({ readU32(bytes), readU32(bytes + 4) });
+    }
+    return true;
+}
+
+// Function name for each PC, in order; "??" where addr2line has none
+static bool symbolize(const std::string& tool, const std::string& elf, const std::vector<ProfileEntry>& entries,
+                      std::vector<std::string>& names, std::string& error) {
+    std::string command = tool + " -f -C -e '" + elf + "'";
+    for (const ProfileEntry& entry : entries) {
+        char address[16];
+        snprintf(address, sizeof(address), " 0x%08x", entry.pc);
+        command += address;
+    }
+    FILE* pipe = popen(command.c_str(), "r");
+    if (pipe == NULL) {
+        error = "cannot run " + tool;
+        return false;
+    }
+    // Two lines per address: function, then file:line
+    char line[1024];
+    bool functionLine = true;
+    while (fgets(line, sizeof(line), pipe) != NULL) {
+        if (functionLine) {
+            line[strcspn(line, "\r\n")] = '\0';
+            names.push_back(line);
+        }
+        functionLine = !functionLine;
+    }
+    int status = pclose(pipe);
+    if (status != 0 || names.size() != entries.size()) {
+        error = tool + " failed on " + elf;
+        return false;
+    }
+    return true;
+}
+
+static void usage() {
+    fprintf(stderr,
+        "usage: compass_profile [--elf FIRMWARE.elf] [--addr2line TOOL] [--top N] DUMP\n"
+        "Without --elf, PCs are listed unsymbolized\n");
+}
+
+int main(int argc, char** argv) {
+    std::string elf;
+    std::string tool = DEFAULT_ADDR2LINE;
+    long top = 30;
+    const char* path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        bool ok = true;
+        if (strcmp(arg, "--elf") == 0 && hasValue) {
+            elf = argv[++i];
+        } else if (strcmp(arg, "--addr2line") == 0 && hasValue) {
+            tool = argv[++i];
+        } else if (strcmp(arg, "--top") == 0 && hasValue) {
+            ok = parseInt(argv[++i], top) && top >= 1;
+        } else if (arg[0] == '-' || path != NULL) {
+            usage();
+            return 2;
+        } else {
+            path = arg;
+        }
+        if (!ok) {
+            fprintf(stderr, "compass_profile: bad value for %s\n", arg);
+            return 2;
+        }
+    }
+    if (path == NULL) {
+        usage();
+        return 2;
+    }
+
+    ProfileHeader header;
+    std::vector<ProfileEntry> entries;
+    std::string error;
+    if (!readProfile(path, header, entries, error)) {
+        fprintf(stderr, "compass_profile: %s\n", error.c_str());
+        return 1;
+    }
+
+    std::vector<std::string> names;
+    if (elf.empty()) {
+        for (const ProfileEntry& entry : entries) {
+            char address[16];
+            snprintf(address, sizeof(address), "0x%08x", entry.pc);
+            names.push_back(address);
+        }
+    } else if (!symbolize(tool, elf, entries, names, error)) {
+        fprintf(stderr, "compass_profile: %s\n", error.c_str());
+        return 1;
+    }
+
+    std::map<std::string, uint64_t> byFunction;
+    for (size_t i = 0; i < entries.size(); i++) {
+        byFunction[names[i]] += entries[i].count;
+    }
+    if (header.inInterrupt > 0) {
+        byFunction["(other interrupts)"] += header.inInterrupt;
+    }
+    if (header.dropped > 0) {
+        byFunction["(dropped, histogram full)"] += header.dropped;
+    }
+    std::vector<std::pair<std::string, uint64_t>> rows(byFunction.begin(), byFunction.end());
+    std::sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+
+    printf("%s: %u samples at %u Hz over %.1f s, %u PCs\n",
+        path, header.samples, header.hz, header.durationMs / 1000.0, header.entries);
+    printf("  samples       %%  function\n");
+    double total = (header.samples > 0) ? header.samples : 1;
+    for (size_t i = 0; i < rows.size() && (long)i < top; i++) {
+        printf("  %7llu  %5.1f%%  %s\n", (unsigned long long)rows[i].second, 100.0 * rows[i].second / total, rows[i].first.c_str());
+    }
+    if (rows.size() > (size_t)top) {
+        printf("  (%zu more)\n", rows.size() - (size_t)top);
+    }
+    return 0;
+}
@@ -0,0 +1,346 @@
+// compass_replay: play traces through the firmware pipeline and print the
+// messages it would publish, with sample timestamps. With --check, replays
+// the corpus named in each golden file and compares, so any change to the
+// hot path must give identical output or re-baseline with --update.
+//
+//   compass_replay [--alpha N] [--beta N] [--settle N] [--tolerance N] [--threshold N] [--debounce MS]
+//                  [--output none|pulse|latch] [--pulse MS] TRACE...
+//   compass_replay --check golden/
+//   compass_replay --update golden/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <CompassPipeline.h>
+
+#include "Args.h"
+#include "Evaluator.h"
+#include "TraceFile.h"
+
+const char* GOLDEN_FORMAT = "# compass_replay golden v5";
+const char* const OUTPUT_MODE_NAMES[] = { "none", "pulse", "latch" };
+
+// Pipeline parameters plus the solve output, which only the replay models
+struct ReplayParams : PipelineParams {
+    int outputMode;  // pipeline::OutputMode
+    int pulseMs;
+};
+
+// Same order as serviceCompasses(): track and map, session stats, direction
+// report, then the dwell, whose messages come from pipeline::solveActions()
+// as on the prop. The trace starts a session, as a PUZZLE_RESET would. The
+// ADC monitor's early dwell start has no raw-sample equivalent and is not
+// replayed.
+static void replayTrace(const Trace& trace, const ReplayParams& params, std::ostream& out, TraceResult& result) {
+    const TraceHeader& header = *trace.header;
+    std::string compass = traceCompass(header);
+    const char* targetName = pipeline::directionName(header.targetDirection);
+
+    pipeline::DwellParams dwellParams;
+    dwellParams.target = header.targetDirection;
+    dwellParams.tolerance = params.tolerance;
+    dwellParams.debounceUs = (int64_t)params.debounceMs * 1000;
+    dwellParams.settleUs = 0;
+    dwellParams.settleVelocity = pipeline::degreesPerSToVelocity(params.settleSpeed, header.samplePeriodUs);
+    pipeline::DwellState dwell = {};
+
+    pipeline::Tracker tracker = {};
+    pipeline::OutputState output = {};
+    pipeline::ReportState report;
+    pipeline::reportReset(report);
+    pipeline::SessionStats stats = {};
+    result = TraceResult();
+    result.solveSample = -1;
+
+    for (uint32_t i = 0; i < trace.count; i++) {
+        int64_t timestampUs = (int64_t)i * header.samplePeriodUs;
+
+        // The firmware ends a pulse on a timer, at its exact end time
+        if (pipeline::outputExpire(output, params.outputMode, timestampUs)) {
+            out << output.offUs << " gpio off\n";
+        }
+
+        pipeline::trackerStep(tracker, trace.samples[i], params.filterAlpha, params.trackerBeta);
+        int angle = pipeline::rawToAngle(pipeline::trackerRaw(tracker));
+        if (!dwell.solved) {
+            pipeline::sessionStep(stats, angle, header.targetDirection, params.tolerance, params.threshold, timestampUs);
+        }
+
+        if (pipeline::reportStep(report, angle, params.threshold, timestampUs)) {
+            out << timestampUs << " direction pre_" << angle << " (" << pipeline::directionName(angle) << ")\n";
+            out << timestampUs << " velocity " << pipeline::velocityToDegreesPerS(tracker.velocity, header.samplePeriodUs) << "\n";
+            result.reports++;
+        }
+
+        bool unconfirmed = dwell.fromMonitor;
+        pipeline::DwellEvent event = pipeline::dwellStep(dwell, dwellParams, angle, tracker.velocity, timestampUs);
+        uint32_t actions = pipeline::solveActions(event, unconfirmed);
+        if (actions & pipeline::SOLVE_CANDIDATE) {
+            out << timestampUs << " solve candidate\n";
+        }
+        if (actions & pipeline::SOLVE_DWELL_START) {
+            out << timestampUs << " history dwell_start\n";
+            result.dwellStarts++;
+        }
+        if (actions & pipeline::SOLVE_DWELL_CANCEL) {
+            out << timestampUs << " history dwell_cancel\n";
+            result.dwellCancels++;
+        }
+        if (actions & pipeline::SOLVE_CANCELLED) {
+            out << timestampUs << " solve cancelled\n";
+        }
+        if (actions & pipeline::SOLVE_TRIGGERED) {
+            if (pipeline::outputSolved(output, params.outputMode, (int64_t)params.pulseMs * 1000, timestampUs)) {
+                out << timestampUs << " gpio on\n";
+            }
+            out << timestampUs << " history solved\n";
+            out << timestampUs << " status {\"event\":\"session\",\"solveMs\":" << timestampUs / 1000
+                << ",\"passes\":" << stats.passes << ",\"nearTargetMs\":" << stats.nearTargetMs
+                << ",\"travel\":" << stats.travelDegrees << ",\"sectorMs\":{";
+            for (int s = 0; s < 8; s++) {
+                out << (s > 0 ? "," : "") << "\"" << pipeline::DIRECTION_NAMES[s] << "\":" << stats.sectorMs[s];
+            }
+            out << "}}\n";
+            out << timestampUs << " solved triggered\n";
+            out << timestampUs << " solve triggered\n";
+            out << timestampUs << " status SOLVED\n";
+            out << timestampUs << " log PUZZLE SOLVED - " << compass << " aligned to " << targetName << "\n";
+            result.solveSample = (int32_t)i;
+        }
+    }
+}
+
+static bool parseOutputMode(const char* text, int& mode) {
+    for (int m = pipeline::OUTPUT_NONE; m <= pipeline::OUTPUT_LATCH; m++) {
+        if (strcmp(text, OUTPUT_MODE_NAMES[m]) == 0) {
+            mode = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+static std::string paramsLine(const ReplayParams& params, const std::string& corpus) {
+    std::ostringstream line;
+    line << "# params alpha=" << params.filterAlpha << " beta=" << params.trackerBeta
+        << " settle=" << params.settleSpeed << " tolerance=" << params.tolerance
+        << " threshold=" << params.threshold << " debounce=" << params.debounceMs
+        << " output=" << OUTPUT_MODE_NAMES[params.outputMode] << " pulse=" << params.pulseMs << " corpus=" << corpus;
+    return line.str();
+}
+
+static bool parseParamsLine(const std::string& line, ReplayParams& params, std::string& corpus) {
+    char name[256];
+    char mode[16];
+    if (sscanf(line.c_str(),
+            "# params alpha=%d beta=%d settle=%d tolerance=%d threshold=%d debounce=%d output=%15s pulse=%d corpus=%255s",
+            &params.filterAlpha, &params.trackerBeta, &params.settleSpeed, &params.tolerance, &params.threshold,
+            &params.debounceMs, mode, &params.pulseMs, name) != 9) {
+        return false;
+    }
+    corpus = name;
+    return parseOutputMode(mode, params.outputMode);
+}
+
+// Full replay text for a corpus. The SIMD evaluator runs over the same
+// traces and must agree with the replay on every count.
+static bool replayCorpus(const std::string& path, const ReplayParams& params, const std::string& corpusName,
+    std::string& text, std::string& error) {
+    TraceFile file;
+    if (!file.open(path)) {
+        error = file.error();
+        return false;
+    }
+
+    std::ostringstream out;
+    out << GOLDEN_FORMAT << "\n" << paramsLine(params, corpusName) << "\n";
+    for (size_t t = 0; t < file.traces().size(); t++) {
+        const Trace& trace = file.traces()[t];
+        const TraceHeader& header = *trace.header;
+        out << "== trace " << t << " " << traceCompass(header) << " target " << header.targetDirection
+            << " samples " << trace.count << " period " << header.samplePeriodUs;
+        if (header.mainsHz != 0) {
+            out << " from " << trace.recorded->sampleCount << " conversions mains " << (int)header.mainsHz;
+        }
+        out << "\n";
+
+        TraceResult replayed;
+        replayTrace(trace, params, out, replayed);
+
+        TraceResult evaluated;
+        evaluateTrace(trace, &params, 1, &evaluated, true);
+        if (evaluated.solveSample != replayed.solveSample || evaluated.reports != replayed.reports ||
+            evaluated.dwellStarts != replayed.dwellStarts || evaluated.dwellCancels != replayed.dwellCancels) {
+            error = path + ": evaluator disagrees with replay on trace " + std::to_string(t);
+            return false;
+        }
+    }
+    text = out.str();
+    return true;
+}
+
+static bool readFile(const std::string& path, std::string& text) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    std::ostringstream buffer;
+    buffer << in.rdbuf();
+    text = buffer.str();
+    return true;
+}
+
+// First differing line, or 0 if equal
+static size_t firstDifference(const std::string& a, const std::string& b, std::string& lineA, std::string& lineB) {
+    std::istringstream inA(a), inB(b);
+    size_t number = 0;
+    for (;;) {
+        number++;
+        bool moreA = (bool)std::getline(inA, lineA);
+        bool moreB = (bool)std::getline(inB, lineB);
+        if (!moreA && !moreB) return 0;
+        if (!moreA) lineA = "<end of file>";
+        if (!moreB) lineB = "<end of file>";
+        if (!moreA || !moreB || lineA != lineB) return number;
+    }
+}
+
+static int runGolden(const std::string& dir, bool update) {
+    std::vector<std::string> goldens;
+    std::error_code status;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, status)) {
+        if (entry.path().extension() == ".golden") goldens.push_back(entry.path().string());
+    }
+    if (status || goldens.empty()) {
+        fprintf(stderr, "compass_replay: no .golden files in %s\n", dir.c_str());
+        return 1;
+    }
+    std::sort(goldens.begin(), goldens.end());
+
+    int failures = 0;
+    for (const std::string& golden : goldens) {
+        std::string expected;
+        std::string header;
+        ReplayParams params;
+        std::string corpus;
+        if (!readFile(golden, expected)) {
+            perror(golden.c_str());
+            return 1;
+        }
+        std::istringstream lines(expected);
+        std::getline(lines, header);
+        std::getline(lines, header);
+        if (!parseParamsLine(header, params, corpus)) {
+            fprintf(stderr, "%s: missing \"# params\" line\n", golden.c_str());
+            return 1;
+        }
+
+        std::string actual, error;
+        std::string corpusPath = (std::filesystem::path(dir) / corpus).string();
+        if (!replayCorpus(corpusPath, params, corpus, actual, error)) {
+            fprintf(stderr, "FAIL %s: %s\n", golden.c_str(), error.c_str());
+            failures++;
+            continue;
+        }
+
+        if (update) {
+            std::ofstream out(golden, std::ios::binary);
+            out << actual;
+            printf("updated %s\n", golden.c_str());
+            continue;
+        }
+        std::string lineExpected, lineActual;
+        size_t line = firstDifference(expected, actual, lineExpected, lineActual);
+        if (line == 0) {
+            printf("ok   %s\n", golden.c_str());
+        } else {
+            printf("FAIL %s, line %zu\n  expected: %s\n  actual:   %s\n",
+                golden.c_str(), line, lineExpected.c_str(), lineActual.c_str());
+            failures++;
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+static void usage() {
+    fprintf(stderr,
+        "usage: compass_replay [--alpha N] [--beta N] [--settle N] [--tolerance N] [--threshold N]\n"
+        "                      [--debounce MS] [--output none|pulse|latch] [--pulse MS] TRACE...\n"
+        "       compass_replay --check DIR     compare with DIR/*.golden\n"
+        "       compass_replay --update DIR    re-baseline DIR/*.golden\n");
+}
+
+int main(int argc, char** argv) {
+    ReplayParams params;
+    params.filterAlpha = pipeline::FILTER_ALPHA_DEFAULT;
+    params.tolerance = 10;
+    params.threshold = 2;
+    params.debounceMs = 500;
+    params.trackerBeta = pipeline::TRACKER_BETA_DEFAULT;
+    params.settleSpeed = pipeline::SETTLE_SPEED_DEFAULT;
+    params.outputMode = pipeline::OUTPUT_PULSE;
+    params.pulseMs = 500;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        long value = 0;
+        bool ok = true;
+        if ((strcmp(arg, "--check") == 0 || strcmp(arg, "--update") == 0) && hasValue) {
+            return runGolden(argv[i + 1], strcmp(arg, "--update") == 0);
+        } else if (strcmp(arg, "--alpha") == 0 && hasValue) {
+            ok = parseInt(argv[++i], value) && value >= 1 && value <= pipeline::FILTER_ALPHA_ONE;
+            params.filterAlpha = (int)value;
+        } else if (strcmp(arg, "--beta") == 0 && hasValue) {
+            ok = parseInt(argv[++i], value) && value >= 0 && value <= pipeline::TRACKER_BETA_MAX;
+            params.trackerBeta = (int)value;
+        } else if (strcmp(arg, "--settle") == 0 && hasValue) {
+            ok = parseInt(argv[++i], value) && value >= 0;
+            params.settleSpeed = (int)value;
+        } else if (strcmp(arg, "--tolerance") == 0 && hasValue) {
+            ok = parseInt(argv[++i], value) && value >= 1;
+            params.tolerance = (int)value;
+        } else if (strcmp(arg, "--threshold") == 0 && hasValue) {
+            ok = parseInt(argv[++i], value) && value >= 1;
+            params.threshold = (int)value;
+        } else if (strcmp(arg, "--debounce") == 0 && hasValue) {
+            ok = parseInt(argv[++i], value) && value >= 0;
+            params.debounceMs = (int)value;
+        } else if (strcmp(arg, "--output") == 0 && hasValue) {
+            ok = parseOutputMode(argv[++i], params.outputMode);
+        } else if (strcmp(arg, "--pulse") == 0 && hasValue) {
+            ok = parseInt(argv[++i], value) && value >= 0;
+            params.pulseMs = (int)value;
+        } else if (arg[0] == '-') {
+            usage();
+            return 2;
+        } else {
+            paths.push_back(arg);
+        }
+        if (!ok) {
+            fprintf(stderr, "compass_replay: bad value for %s\n", arg);
+            return 2;
+        }
+    }
+    if (paths.empty()) {
+        usage();
+        return 2;
+    }
+
+    for (const std::string& path : paths) {
+        std::string text, error;
+        std::string name = std::filesystem::path(path).filename().string();
+        if (!replayCorpus(path, params, name, text, error)) {
+            fprintf(stderr, "compass_replay: %s\n", error.c_str());
+            return 1;
+        }
+        fputs(text.c_str(), stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,432 @@
+// compass_soak: run the soak build of lib/CompassFirmware on the host HAL
+// for days of virtual uptime and check it stays healthy. The firmware runs
+// its own soak chaos (synthetic pot, broker disconnects, random commands);
+// on top of that the harness moves the pot, drops the link, takes WiFi and
+// the broker away, answers SNTP late and sends Watchtower commands with
+// id= and exp= headers, retrying unanswered ones as the Watchtower does.
+//
+//   compass_soak [--hours N] [--seed N] [--no-psram] [--serial] [--verbose]
+//
+// Hours are on the firmware's clock (SOAK_CLOCK_SCALE times the esp_timer
+// clock), which starts SOAK_CLOCK_OFFSET_US in, so millis() rolls over a
+// minute into the run. Exits 1 if it finds an anomaly: heap growth or a
+// failed allocation, clock faults, sample gaps or loop overruns in the
+// SOAK reports, a stall in publishing, keepalive not on the soak clock, a
+// malformed packet, a command run twice or never answered, or GPIO misuse.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <CompassFirmware.h>
+
+#include "Args.h"
+#include "HostHal.h"
+
+const char* DEVICE = "HostCompass";  // host/config/PropConfig.h
+const int POT_GPIO = 4;
+const int TARGET_RAW = 3536;  // map(315, 0, 359, 0, 4095)
+
+const int64_t SECOND_US = 1000000;
+const time_t SNTP_EPOCH = 1760000000;  // Wall time when SNTP answers
+const int64_t HEARTBEAT_MS = 60000;  // Set over the retained config topic
+const int64_t KEEPALIVE_MS = 15000;  // MQTT_KEEPALIVE
+const int64_t QUIET_US = 600 * SECOND_US;  // No commands at the end, so transient buffers are freed
+const int64_t RETRY_US = 300 * SECOND_US;
+const int RETRY_WINDOW = 4;  // Retry only while the id is among the firmware's last 8
+const size_t HEAP_GROWTH_MAX = 0;
+const int64_t REPORT_SILENCE_MAX_US = 4 * 3600 * SECOND_US;
+
+// Clock conversions. Harness events are scheduled on esp_timer; intervals
+// are picked in virtual (soak clock) time, real ones (WiFi, SNTP, exp=) in
+// esp_timer time
+int64_t espUs(int64_t virtualUs) {
+    return virtualUs / SOAK_CLOCK_SCALE;
+}
+
+int64_t virtualUs(int64_t espUs) {
+    return SOAK_CLOCK_OFFSET_US + espUs * SOAK_CLOCK_SCALE;
+}
+
+const int64_t ROLLOVER_ESP_US = ((1LL << 32) * 1000 - SOAK_CLOCK_OFFSET_US) / SOAK_CLOCK_SCALE;
+
+struct SoakReport {
+    int64_t us;
+    unsigned long long uptime;
+    unsigned long heapFree;
+    unsigned long heapMin;
+    unsigned long heapFrag;
+    unsigned long clockFaults;
+    unsigned long sampleGaps;
+    unsigned long loopOverruns;
+    long long maxLoop;
+};
+
+struct Request {
+    std::string message;
+    bool expired;  // exp= already past when sent
+    int64_t sentUs;
+    int sends;
+    int ran;  // OK or EXPIRED: judged once
+    int acks;
+    std::string outcome;
+};
+
+struct Soak {
+    std::mt19937 rng;
+    int64_t endUs;
+    int64_t syncUs;
+    bool verbose = false;
+
+    std::vector<SoakReport> reports;
+    std::vector<int64_t> heartbeats;
+    std::vector<int64_t> directions;
+    std::vector<host::HeapStats> hourlyHeap;
+    std::map<std::string, Request> requests;
+    std::vector<std::string> order;  // Request ids as sent
+    int wills = 0;
+    int stray = 0;  // ACKs for ids never sent
+
+    int64_t uniform(int64_t low, int64_t high) {
+        return std::uniform_int_distribution<int64_t>(low, high)(rng);
+    }
+};
+
+Soak soak;
+std::vector<std::string> anomalies;
+
+void anomaly(const char* format, ...) __attribute__((format(printf, 1, 2)));
+void anomaly(const char* format, ...) {
+    char text[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    anomalies.push_back(text);
+}
+
+// Wall time the harness knows, before the firmware does
+time_t wallTime(int64_t us) {
+    return SNTP_EPOCH + (time_t)((us - soak.syncUs) / SECOND_US);
+}
+
+std::string topic(const char* leaf) {
+    return std::string("MermaidsTale/") + DEVICE + "/" + leaf;
+}
+
+// ============================================
+// EVENTS
+// ============================================
+
+void movePot() {
+    // A player: parks on the target now and then, otherwise anywhere
+    int raw = soak.uniform(0, 9) == 0 ? TARGET_RAW : (int)soak.uniform(0, 4095);
+    host::setPot(POT_GPIO, raw);
+    host::at(host::now() + espUs(soak.uniform(1, 30) * SECOND_US), movePot);
+}
+
+void dropLink() {
+    host::dropConnection();
+    host::at(host::now() + espUs(soak.uniform(10, 90) * 60 * SECOND_US), dropLink);
+}
+
+void wifiOutage() {
+    host::setWifi(false);
+    host::at(host::now() + espUs(soak.uniform(30, 600) * SECOND_US), []() { host::setWifi(true); });
+    host::at(host::now() + espUs(soak.uniform(2, 8) * 3600 * SECOND_US), wifiOutage);
+}
+
+void brokerOutage() {
+    host::setBroker(false);
+    host::at(host::now() + espUs(soak.uniform(1, 20) * 60 * SECOND_US), []() { host::setBroker(true); });
+    host::at(host::now() + espUs(soak.uniform(3, 12) * 3600 * SECOND_US), brokerOutage);
+}
+
+void sendRequest(const std::string& id) {
+    Request& request = soak.requests[id];
+    request.sends++;
+    host::deliver(topic("command"), request.message);
+    host::at(host::now() + espUs(RETRY_US), [id]() {
+        // Unanswered: the ACK was lost or the command held and turned
+        // away. Send it again while the firmware would still know the id
+        Request& request = soak.requests[id];
+        size_t newer = soak.order.end() - std::find(soak.order.begin(), soak.order.end(), id) - 1;
+        bool answered = request.acks > 0 && request.outcome != "UNSYNCED";
+        if (!answered && newer < (size_t)RETRY_WINDOW && host::now() < soak.endUs - espUs(QUIET_US)) {
+            request.outcome.clear();
+            sendRequest(id);
+        }
+    });
+}
+
+void sendCommand() {
+    static const char* COMMANDS[] = {
+        "PING", "STATUS", "PUZZLE_RESET", "PING; STATUS", "SET tolerance 8", "SET tolerance 10",
+        "HISTORY 5", "SESSIONS 4", "NOISE", "TRACE", "TRACE DUMP", "PROFILE",
+    };
+    int64_t now = host::now();
+    if (now >= soak.endUs - espUs(QUIET_US)) return;
+
+    char id[16];
+    snprintf(id, sizeof(id), "soak-%zu", soak.order.size() + 1);
+    Request request = {};
+    request.sentUs = now;
+    request.message = std::string("id=") + id + " ";
+    long roll = soak.uniform(0, 9);
+    if (roll < 2) {
+        request.expired = true;
+        request.message += "exp=" + std::to_string(wallTime(now) - 5) + " ";
+    } else if (roll < 6) {
+        request.message += "exp=" + std::to_string(wallTime(now) + 120) + " ";
+    }
+    request.message += COMMANDS[soak.uniform(0, sizeof(COMMANDS) / sizeof(COMMANDS[0]) - 1)];
+    soak.requests[id] = request;
+    soak.order.push_back(id);
+    sendRequest(id);
+
+    host::at(now + espUs(soak.uniform(60, 600) * SECOND_US), sendCommand);
+}
+
+void sampleHeap() {
+    soak.hourlyHeap.push_back(host::heap());
+    host::at(host::now() + espUs(3600 * SECOND_US), sampleHeap);
+}
+
+// ============================================
+// BROKER TRAFFIC
+// ============================================
+
+void onAck(const std::string& payload) {
+    char id[64];
+    char outcome[16];
+    if (sscanf(payload.c_str(), "ACK %63s %15s", id, outcome) != 2) return;
+    auto found = soak.requests.find(id);
+    if (found == soak.requests.end()) {
+        soak.stray++;
+        return;
+    }
+    Request& request = found->second;
+    request.acks++;
+    request.outcome = outcome;
+    if (strcmp(outcome, "OK") == 0 || strcmp(outcome, "EXPIRED") == 0) {
+        request.ran++;
+        if (request.ran > 1) {
+            anomaly("%s judged twice (%s)", id, outcome);
+        } else if (request.expired != (strcmp(outcome, "EXPIRED") == 0)) {
+            anomaly("%s answered %s but was sent %s", id, outcome, request.expired ? "expired" : "in time");
+        }
+    }
+}
+
+void onMessage(const host::Message& message) {
+    if (soak.verbose) {
+        printf("%10.3f %s %s\n", message.us / 1e6, message.topic.c_str(), message.payload.c_str());
+    }
+    if (message.will) {
+        soak.wills++;
+        return;
+    }
+    const std::string& payload = message.payload;
+    if (message.topic == topic("status")) {
+        if (payload.compare(0, 4, "ACK ") == 0) {
+            onAck(payload);
+        } else if (payload.compare(0, 9, "ONLINE | ") == 0) {
+            soak.heartbeats.push_back(message.us);
+        }
+    } else if (message.topic == topic("direction")) {
+        soak.directions.push_back(message.us);
+    } else if (message.topic == topic("log") && payload.compare(0, 5, "SOAK ") == 0) {
+        SoakReport report = {};
+        report.us = message.us;
+        if (sscanf(payload.c_str(),
+                "SOAK uptime:%llus heapFree:%lu heapMin:%lu heapFrag:%lu%% clockFaults:%lu sampleGaps:%lu loopOverruns:%lu maxLoop:%lldus",
+                &report.uptime, &report.heapFree, &report.heapMin, &report.heapFrag, &report.clockFaults,
+                &report.sampleGaps, &report.loopOverruns, &report.maxLoop) == 8) {
+            soak.reports.push_back(report);
+        } else {
+            anomaly("unreadable report: %s", payload.c_str());
+        }
+    }
+}
+
+// ============================================
+// CHECKS
+// ============================================
+
+// Publishing must carry on through the millis() rollover and every outage:
+// each virtual hour after the rollover needs some of these
+void checkEveryHour(const std::vector<int64_t>& times, const char* what) {
+    int64_t hourUs = espUs(3600 * SECOND_US);
+    for (int64_t start = ROLLOVER_ESP_US; start + hourUs <= soak.endUs; start += hourUs) {
+        auto first = std::lower_bound(times.begin(), times.end(), start);
+        if (first == times.end() || *first >= start + hourUs) {
+            anomaly("no %s in virtual hour %lld", what, (long long)((virtualUs(start) - SOAK_CLOCK_OFFSET_US) / 3600 / SECOND_US));
+            return;
+        }
+    }
+}
+
+void checkRun(const host::HeapStats& settled, int hours) {
+    // Health reports every virtual hour. They aren't queued, so the ones
+    // due while the link is down are lost, but the job must keep going
+    int64_t lastReportUs = soak.reports.empty() ? 0 : soak.reports.back().us;
+    if ((int)soak.reports.size() < hours / 2 || lastReportUs < soak.endUs - espUs(REPORT_SILENCE_MAX_US)) {
+        anomaly("%zu SOAK reports in %d hours, the last %.1f virtual hours before the end", soak.reports.size(), hours,
+            (soak.endUs - lastReportUs) * SOAK_CLOCK_SCALE / 3600e6);
+    }
+    if (!soak.reports.empty()) {
+        const SoakReport& last = soak.reports.back();
+        if (last.clockFaults != 0) anomaly("%lu clock faults", last.clockFaults);
+        if (last.sampleGaps != 0) anomaly("%lu sample gaps", last.sampleGaps);
+        if (last.loopOverruns != 0) anomaly("%lu loop overruns", last.loopOverruns);
+    }
+
+    // Heap: back to where it settled once the commands stop
+    host::HeapStats heap = host::heap();
+    size_t used = heap.internalUsed + heap.psramUsed;
+    size_t settledUsed = settled.internalUsed + settled.psramUsed;
+    if (used > settledUsed + HEAP_GROWTH_MAX) {
+        anomaly("heap grew %zu bytes (internal %zu -> %zu, PSRAM %zu -> %zu)", used - settledUsed,
+            settled.internalUsed, heap.internalUsed, settled.psramUsed, heap.psramUsed);
+    }
+    if (heap.failures != 0) anomaly("%u failed allocations", heap.failures);
+
+    // Direction reports only come with movement, and the synthetic player
+    // can stay parked on the target for a long time
+    checkEveryHour(soak.heartbeats, "heartbeat");
+    if (std::lower_bound(soak.directions.begin(), soak.directions.end(), ROLLOVER_ESP_US) == soak.directions.end()) {
+        anomaly("no direction reports after the millis() rollover");
+    }
+
+    // Keepalive on the soak clock: a PINGREQ per idle 15 virtual seconds,
+    // not per 15 real ones
+    host::NetworkStats network = host::network();
+    int64_t virtualMs = (virtualUs(soak.endUs) - SOAK_CLOCK_OFFSET_US) / 1000;
+    if (network.pings < virtualMs / KEEPALIVE_MS / 4) {
+        anomaly("%u PINGREQs in %lld virtual s: keepalive isn't on the soak clock", network.pings, (long long)(virtualMs / 1000));
+    }
+    if (network.keepaliveTimeouts != 0) anomaly("%u keepalive timeouts", network.keepaliveTimeouts);
+    if (network.protocolErrors != 0) anomaly("%u protocol errors", network.protocolErrors);
+
+    for (const std::string& id : soak.order) {
+        const Request& request = soak.requests[id];
+        if (request.acks == 0) {
+            anomaly("%s never answered (%s)", id.c_str(), request.message.c_str());
+        }
+    }
+    if (soak.stray != 0) anomaly("%d ACKs for unknown ids", soak.stray);
+    if (host::pinMisuses() != 0) anomaly("%u writes to pins not set as outputs", host::pinMisuses());
+}
+
+static void usage() {
+    fprintf(stderr, "usage: compass_soak [--hours N] [--seed N] [--no-psram] [--serial] [--verbose]\n");
+}
+
+int main(int argc, char** argv) {
+    long hours = 72;
+    long seed = 1;
+    bool psram = true;
+    bool serial = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--hours") == 0 && i + 1 < argc) {
+            if (!parseInt(argv[++i], hours) || hours < 2) {
+                usage();
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            if (!parseInt(argv[++i], seed)) {
+                usage();
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--no-psram") == 0) {
+            psram = false;
+        } else if (strcmp(argv[i], "--serial") == 0) {
+            serial = true;
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            soak.verbose = true;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    soak.rng.seed((uint32_t)seed);
+    soak.endUs = espUs(hours * 3600 * SECOND_US);
+    soak.syncUs = espUs(soak.uniform(1, 10) * 60 * SECOND_US);
+    host::setSeed((uint32_t)seed);
+    host::setPsram(psram);
+    host::setSerialEcho(serial);
+    host::onPublish(onMessage);
+
+    // Retained config waiting on the broker, as the Watchtower leaves it
+    host::deliver(topic("config"), "heartbeat=" + std::to_string(HEARTBEAT_MS), true);
+    host::setPot(POT_GPIO, 0);
+
+    host::at(soak.syncUs, []() { host::syncClock(SNTP_EPOCH); });
+    host::at(espUs(5 * SECOND_US), movePot);
+    host::at(espUs(soak.uniform(10, 90) * 60 * SECOND_US), dropLink);
+    host::at(espUs(soak.uniform(2, 8) * 3600 * SECOND_US), wifiOutage);
+    host::at(espUs(soak.uniform(3, 12) * 3600 * SECOND_US), brokerOutage);
+    host::at(espUs(soak.uniform(10, 60) * SECOND_US), sendCommand);
+
+    // Heap once everything lazily allocated is in place
+    host::HeapStats settled = {};
+    host::at(espUs(3600 * SECOND_US), []() { sampleHeap(); });
+
+    compassSetup();
+    while (host::now() < soak.endUs) {
+        compassLoop();
+    }
+    // The quietest hour of the first three: no command buffers in flight
+    for (size_t i = 0; i < soak.hourlyHeap.size() && i < 3; i++) {
+        const host::HeapStats& sample = soak.hourlyHeap[i];
+        if (i == 0 || sample.internalUsed + sample.psramUsed < settled.internalUsed + settled.psramUsed) {
+            settled = sample;
+        }
+    }
+    checkRun(settled, (int)hours);
+
+    host::HeapStats heap = host::heap();
+    host::NetworkStats network = host::network();
+    int ok = 0;
+    int expired = 0;
+    int duplicate = 0;
+    int unsynced = 0;
+    for (const auto& entry : soak.requests) {
+        const std::string& outcome = entry.second.outcome;
+        ok += outcome == "OK";
+        expired += outcome == "EXPIRED";
+        duplicate += outcome == "DUPLICATE";
+        unsynced += outcome == "UNSYNCED";
+    }
+    printf("%ld virtual hours (%.1f s on esp_timer), seed %ld, PSRAM %s\n", hours, soak.endUs / 1e6, seed, psram ? "yes" : "no");
+    printf("heap: internal %zu used (settled %zu, peak %zu, largest free %zu), PSRAM %zu used (peak %zu), %u allocations, %u failed\n",
+        heap.internalUsed, settled.internalUsed, heap.internalPeak, heap.internalLargestFree, heap.psramUsed, heap.psramPeak,
+        heap.allocations, heap.failures);
+    if (!soak.reports.empty()) {
+        const SoakReport& last = soak.reports.back();
+        printf("firmware: %zu reports, heapMin %lu, frag %lu%%, clockFaults %lu, sampleGaps %lu, loopOverruns %lu\n",
+            soak.reports.size(), last.heapMin, last.heapFrag, last.clockFaults, last.sampleGaps, last.loopOverruns);
+    }
+    printf("broker: %u connects, %u link drops, %d wills, %u pings, %u published, %u delivered\n", network.connects,
+        network.linkDrops, soak.wills, network.pings, network.published, network.delivered);
+    printf("commands: %zu sent, last answers %d OK, %d EXPIRED, %d DUPLICATE, %d UNSYNCED\n", soak.order.size(), ok, expired,
+        duplicate, unsynced);
+    printf("publishing: %zu heartbeats, %zu direction reports\n", soak.heartbeats.size(), soak.directions.size());
+    for (const std::string& text : anomalies) {
+        printf("ANOMALY: %s\n", text.c_str());
+    }
+    printf("%s\n", anomalies.empty() ? "PASS" : "FAIL");
+
+    // The firmware's tasks are still running: leave without unwinding them
+    fflush(stdout);
+    _Exit(anomalies.empty() ? 0 : 1);
+}
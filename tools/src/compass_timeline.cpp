@@ -0,0 +1,170 @@
+// compass_timeline: convert a TRACE DUMP from the firmware to Chrome trace
+// event JSON, for ui.perfetto.dev or chrome://tracing.
+//
+//   compass_timeline [--name NAME] DUMP [OUT.json]
+//
+// Capture a dump with e.g.
+//   mosquitto_sub -h BROKER -C 1 -t MermaidsTale/BlueCompass/trace > blue.trace
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+const uint8_t TRACE_FORMAT_VERSION = 1;
+const size_t TRACE_HEADER_BYTES = 16;
+const size_t TRACE_EVENT_BYTES = 8;
+
+struct TraceDump {
+    uint32_t recorded;  // Events ever recorded on the device
+    uint32_t dumpUs;
+    std::vector<std::string> names;  // Indexed by event id
+    std::vector<const uint8_t*> events;
+    std::vector<uint8_t> data;
+};
+
+static uint32_t readU32(const uint8_t* bytes) {
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static bool readDump(const char* path, TraceDump& dump, std::string& error) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        error = std::string("cannot open ") + path;
+        return false;
+    }
+    dump.data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    const std::vector<uint8_t>& data = dump.data;
+    if (data.size() < TRACE_HEADER_BYTES || data[0] != 'C' || data[1] != 'T') {
+        error = std::string(path) + ": not a trace dump";
+        return false;
+    }
+    if (data[2] != TRACE_FORMAT_VERSION) {
+        error = std::string(path) + ": unsupported format version " + std::to_string(data[2]);
+        return false;
+    }
+    uint32_t count = readU32(&data[4]);
+    dump.recorded = readU32(&data[8]);
+    dump.dumpUs = readU32(&data[12]);
+
+    size_t offset = TRACE_HEADER_BYTES;
+    for (int i = 0; i < data[3]; i++) {
+        size_t end = offset;
+        while (end < data.size() && data[end] != 0) end++;
+        if (end == data.size()) {
+            error = std::string(path) + ": truncated";
+            return false;
+        }
+        dump.names.emplace_back((const char*)&data[offset], end - offset);
+        offset = end + 1;
+    }
+    if (data.size() - offset != (size_t)count * TRACE_EVENT_BYTES) {
+        error = std::string(path) + ": truncated";
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        dump.events.push_back(&data[offset + i * TRACE_EVENT_BYTES]);
+    }
+    return true;
+}
+
+static std::string jsonEscape(const std::string& text) {
+    std::string out;
+    for (char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        if ((unsigned char)c < 0x20) continue;
+        out += c;
+    }
+    return out;
+}
+
+static void usage() {
+    fprintf(stderr, "usage: compass_timeline [--name NAME] DUMP [OUT.json]\n");
+}
+
+int main(int argc, char** argv) {
+    std::string name = "compass";
+    std::vector<const char*> paths;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--name") == 0 && i + 1 < argc) {
+            name = argv[++i];
+        } else if (argv[i][0] == '-') {
+            usage();
+            return 2;
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+    if (paths.empty() || paths.size() > 2) {
+        usage();
+        return 2;
+    }
+
+    TraceDump dump;
+    std::string error;
+    if (!readDump(paths[0], dump, error)) {
+        fprintf(stderr, "compass_timeline: %s\n", error.c_str());
+        return 1;
+    }
+    FILE* out = stdout;
+    if (paths.size() == 2) {
+        out = fopen(paths[1], "w");
+        if (out == NULL) {
+            fprintf(stderr, "compass_timeline: cannot write %s\n", paths[1]);
+            return 1;
+        }
+    }
+
+    // Everything runs on the loop task, so one track. The device clock is
+    // 32-bit: unwrap it from event to event. The ring may have overwritten
+    // the begin of the oldest spans, so ends with no open begin are dropped
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"%s\"}},\n", jsonEscape(name).c_str());
+    fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"loop\"}}");
+    std::vector<uint8_t> open;
+    uint64_t timeUs = 0;
+    uint32_t previousUs = 0;
+    size_t written = 0;
+    size_t dropped = 0;
+    for (size_t i = 0; i < dump.events.size(); i++) {
+        const uint8_t* event = dump.events[i];
+        uint32_t eventUs = readU32(event);
+        char phase = (char)event[4];
+        uint8_t id = event[5];
+        unsigned arg = event[6] | event[7] << 8;
+        timeUs = (i == 0) ? eventUs : timeUs + (uint32_t)(eventUs - previousUs);
+        previousUs = eventUs;
+
+        if (phase == 'B') {
+            open.push_back(id);
+        } else if (phase == 'E') {
+            if (open.empty() || open.back() != id) {
+                dropped++;
+                continue;
+            }
+            open.pop_back();
+        }
+        std::string eventName = (id < dump.names.size()) ? dump.names[id] : "event " + std::to_string(id);
+        fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":1,\"tid\":1,%s\"args\":{\"arg\":%u}}",
+            jsonEscape(eventName).c_str(), phase, (unsigned long long)timeUs, phase == 'i' ? "\"s\":\"t\"," : "", arg);
+        written++;
+    }
+    fprintf(out, "\n]}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    fprintf(stderr, "%s: %zu events", paths[0], written);
+    if (dump.recorded > dump.events.size()) {
+        fprintf(stderr, " (%u older overwritten)", dump.recorded - (uint32_t)dump.events.size());
+    }
+    if (dropped > 0) {
+        fprintf(stderr, ", %zu unmatched ends dropped", dropped);
+    }
+    fprintf(stderr, "\n");
+    return 0;
+}
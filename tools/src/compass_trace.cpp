@@ -0,0 +1,405 @@
+// compass_trace: build and inspect trace files
+//
+//   compass_trace info FILE...
+//   compass_trace pack OUT.ctr --compass NAME [--target DEG] [--period US] [--expected N] [--mains HZ] CSV...
+//   compass_trace synth OUT.ctr --compass NAME [--sessions N] [--seed N] [--mains HZ]
+//
+// With --mains, the samples are raw conversions at the ADC rate, carrying
+// hum at that mains frequency; the tools filter them as the firmware does.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <CompassPipeline.h>
+
+#include "Args.h"
+#include "TraceFile.h"
+
+// Targets of the three props, as in each firmware's TARGET_DIRECTION
+struct CompassTarget {
+    const char* name;
+    int direction;
+};
+
+const CompassTarget COMPASS_TARGETS[] = {
+    { "BlueCompass", 315 },
+    { "RoseCompass", 135 },
+    { "SilverCompass", 45 },
+};
+
+const uint32_t DEFAULT_PERIOD_US = 50000;  // LOOP_DELAY
+const uint32_t CONVERSION_PERIOD_US = 1000;  // ADC_SAMPLE_FREQ_HZ
+const uint8_t CONVERSION_DECIMATION = 10;  // FIR_DECIMATION
+
+static int defaultTarget(const std::string& compass) {
+    for (const CompassTarget& target : COMPASS_TARGETS) {
+        if (compass == target.name) return target.direction;
+    }
+    return -1;
+}
+
+static void usage() {
+    fprintf(stderr,
+        "usage: compass_trace info FILE...\n"
+        "       compass_trace pack OUT.ctr --compass NAME [--target DEG] [--period US] [--expected N] [--mains HZ] CSV...\n"
+        "       compass_trace synth OUT.ctr --compass NAME [--sessions N] [--seed N] [--mains HZ]\n"
+        "CSV lines are \"raw\" or \"timestamp_us,raw\"; one trace per CSV file\n"
+        "--mains: raw ADC conversions with hum at HZ, run through the mains FIR\n");
+}
+
+// ============================================
+// INFO
+// ============================================
+
+static int runInfo(int argc, char** argv) {
+    int status = 0;
+    for (int i = 0; i < argc; i++) {
+        TraceFile file;
+        if (!file.open(argv[i])) {
+            fprintf(stderr, "compass_trace: %s\n", file.error().c_str());
+            status = 1;
+            continue;
+        }
+        printf("%s: %zu traces, %zu bytes\n", argv[i], file.traces().size(), file.bytes());
+        for (const Trace& trace : file.traces()) {
+            const TraceHeader& header = *trace.recorded;
+            double seconds = (double)header.sampleCount * header.samplePeriodUs / 1e6;
+            printf("  %-14s target %3u  %6u %s @ %u us  %7.1f s  ", traceCompass(header).c_str(), header.targetDirection,
+                header.sampleCount, header.mainsHz != 0 ? "conversions" : "samples", header.samplePeriodUs, seconds);
+            if (header.mainsHz != 0) {
+                printf("mains %u Hz  ", header.mainsHz);
+            }
+            if (header.expectedSolve == TRACE_NO_SOLVE) {
+                printf("no solve\n");
+            } else {
+                printf("solve at %.2f s\n", (double)header.expectedSolve * header.samplePeriodUs / 1e6);
+            }
+        }
+    }
+    return status;
+}
+
+// ============================================
+// PACK
+// ============================================
+
+static bool readCsv(const char* path, std::vector<uint16_t>& samples, std::vector<int64_t>& timestamps) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return false;
+    char line[128];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        long long first, second;
+        int fields = sscanf(line, "%lld , %lld", &first, &second);
+        if (fields <= 0) continue;  // Blank line or header
+        long long raw = (fields == 2) ? second : first;
+        if (raw < 0) raw = 0;
+        if (raw > pipeline::RAW_MAX) raw = pipeline::RAW_MAX;
+        samples.push_back((uint16_t)raw);
+        if (fields == 2) timestamps.push_back(first);
+    }
+    fclose(file);
+    return true;
+}
+
+static int runPack(int argc, char** argv) {
+    if (argc < 1) {
+        usage();
+        return 2;
+    }
+    const char* out = argv[0];
+    std::string compass;
+    long target = -1;
+    long period = 0;
+    long expected = TRACE_NO_SOLVE;
+    long mains = 0;
+    std::vector<const char*> inputs;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = (i + 1 < argc);
+        bool ok = true;
+        if (strcmp(argv[i], "--compass") == 0 && hasValue) {
+            compass = argv[++i];
+        } else if (strcmp(argv[i], "--target") == 0 && hasValue) {
+            ok = parseInt(argv[++i], target) && target >= 0 && target <= 359;
+        } else if (strcmp(argv[i], "--period") == 0 && hasValue) {
+            ok = parseInt(argv[++i], period) && period > 0;
+        } else if (strcmp(argv[i], "--expected") == 0 && hasValue) {
+            ok = parseInt(argv[++i], expected) && expected >= TRACE_NO_SOLVE;
+        } else if (strcmp(argv[i], "--mains") == 0 && hasValue) {
+            ok = parseInt(argv[++i], mains) && mains >= 1 && mains <= 255;
+        } else {
+            inputs.push_back(argv[i]);
+        }
+        if (!ok) {
+            fprintf(stderr, "compass_trace: bad value for %s\n", argv[i - 1]);
+            return 2;
+        }
+    }
+    if (target < 0) target = defaultTarget(compass);
+    if (compass.empty() || target < 0 || inputs.empty()) {
+        usage();
+        return 2;
+    }
+
+    TraceWriter writer;
+    if (!writer.open(out)) {
+        perror(out);
+        return 1;
+    }
+    for (const char* input : inputs) {
+        std::vector<uint16_t> samples;
+        std::vector<int64_t> timestamps;
+        if (!readCsv(input, samples, timestamps)) {
+            perror(input);
+            return 1;
+        }
+
+        // Without --period, take the mean spacing of the timestamps
+        uint32_t periodUs = (uint32_t)period;
+        if (periodUs == 0) {
+            periodUs = (mains != 0) ? CONVERSION_PERIOD_US : DEFAULT_PERIOD_US;
+            if (timestamps.size() >= 2) {
+                periodUs = (uint32_t)((timestamps.back() - timestamps.front()) / (int64_t)(timestamps.size() - 1));
+            }
+        }
+
+        TraceHeader header = makeTraceHeader(compass.c_str(), (int)target, periodUs, (uint32_t)samples.size());
+        header.expectedSolve = (int32_t)expected;
+        if (mains != 0) {
+            header.mainsHz = (uint8_t)mains;
+            header.firDecimation = CONVERSION_DECIMATION;
+        }
+        if (!writer.write(header, samples.data())) {
+            perror(out);
+            return 1;
+        }
+        printf("%s: %zu samples @ %u us\n", input, samples.size(), periodUs);
+    }
+    if (!writer.close()) {
+        perror(out);
+        return 1;
+    }
+    return 0;
+}
+
+// ============================================
+// SYNTH
+// Synthetic sessions for trying the tools without recordings: a player
+// swings the dial between random stops, sometimes sweeping through or
+// briefly resting on the target, and most sessions end parked on it. All
+// integer arithmetic, so the same seed gives the same file everywhere.
+// ============================================
+
+struct SynthProfile {
+    const char* compass;
+    int noise;  // Peak ADC noise, counts
+    int spikesPerMille;  // Wiper glitches
+    int hum;  // Peak mains hum, counts (--mains only)
+};
+
+const SynthProfile SYNTH_PROFILES[] = {
+    { "BlueCompass", 8, 0, 30 },
+    { "RoseCompass", 24, 3, 90 },
+    { "SilverCompass", 14, 1, 50 },
+};
+
+struct SynthRandom {
+    uint64_t state;
+
+    // splitmix64
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    int range(int low, int high) {
+        return low + (int)(next() % (uint64_t)(high - low + 1));
+    }
+};
+
+struct SynthSession {
+    const SynthProfile* profile;
+    SynthRandom random;
+    std::vector<uint16_t> samples;
+    int position;
+    int mainsHz;  // 0 for one sample per step, else conversions with hum
+    int lastPosition;
+
+    int noisy(int raw) {
+        // Sum of four uniforms: roughly Gaussian, peak at the profile's noise
+        int noise = 0;
+        for (int k = 0; k < 4; k++) {
+            noise += random.range(-profile->noise, profile->noise);
+        }
+        return raw + noise / 4;
+    }
+
+    void push(int raw) {
+        if (raw < 0) raw = 0;
+        if (raw > pipeline::RAW_MAX) raw = pipeline::RAW_MAX;
+        samples.push_back((uint16_t)raw);
+    }
+
+    int spike() {
+        if (random.range(0, 999) >= profile->spikesPerMille) return 0;
+        return random.range(0, 1) ? random.range(300, 800) : -random.range(300, 800);
+    }
+
+    void emit(int count) {
+        for (int i = 0; i < count; i++) {
+            if (mainsHz == 0) {
+                int raw = noisy(position);
+                push(raw + spike());
+                continue;
+            }
+            // One step of conversions, gliding from the last position. The
+            // hum is a triangle wave: odd harmonics, as a dimmer makes
+            const int conversions = (int)(DEFAULT_PERIOD_US / CONVERSION_PERIOD_US);
+            int glitch = spike();
+            for (int c = 0; c < conversions; c++) {
+                int64_t phase = ((int64_t)samples.size() * CONVERSION_PERIOD_US * mainsHz) % 1000000;
+                int hum = (int)((int64_t)profile->hum * (llabs(2 * phase - 1000000) * 2 - 1000000) / 1000000);
+                int raw = noisy(lastPosition + (position - lastPosition) * (c + 1) / conversions) + hum;
+                push(c == 0 ? raw + glitch : raw);
+            }
+            lastPosition = position;
+        }
+    }
+
+    void moveTo(int destination) {
+        int speed = random.range(30, 150);  // Counts per sample
+        while (position != destination) {
+            int step = destination - position;
+            if (step > speed) step = speed;
+            if (step < -speed) step = -speed;
+            position += step;
+            emit(1);
+        }
+    }
+};
+
+static int angleToRaw(int angle) {
+    return (angle * pipeline::RAW_MAX + pipeline::ANGLE_MAX / 2) / pipeline::ANGLE_MAX;
+}
+
+// A stop the player doesn't mean as an answer: more than 25 degrees off
+static int awayFromTarget(SynthRandom& random, int targetRaw) {
+    for (;;) {
+        int raw = random.range(0, pipeline::RAW_MAX);
+        if (abs(raw - targetRaw) > angleToRaw(25)) return raw;
+    }
+}
+
+static int runSynth(int argc, char** argv) {
+    if (argc < 1) {
+        usage();
+        return 2;
+    }
+    const char* out = argv[0];
+    std::string compass;
+    long sessions = 100;
+    long seed = 1;
+    long mains = 0;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = (i + 1 < argc);
+        bool ok = true;
+        if (strcmp(argv[i], "--compass") == 0 && hasValue) {
+            compass = argv[++i];
+        } else if (strcmp(argv[i], "--sessions") == 0 && hasValue) {
+            ok = parseInt(argv[++i], sessions) && sessions > 0;
+        } else if (strcmp(argv[i], "--seed") == 0 && hasValue) {
+            ok = parseInt(argv[++i], seed);
+        } else if (strcmp(argv[i], "--mains") == 0 && hasValue) {
+            ok = parseInt(argv[++i], mains) && mains >= 1 && mains <= 255;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            usage();
+            return 2;
+        }
+    }
+
+    const SynthProfile* profile = NULL;
+    for (const SynthProfile& candidate : SYNTH_PROFILES) {
+        if (compass == candidate.compass) profile = &candidate;
+    }
+    if (profile == NULL) {
+        fprintf(stderr, "compass_trace: no synth profile for \"%s\"\n", compass.c_str());
+        return 2;
+    }
+    int target = defaultTarget(compass);
+    int targetRaw = angleToRaw(target);
+
+    TraceWriter writer;
+    if (!writer.open(out)) {
+        perror(out);
+        return 1;
+    }
+    for (long s = 0; s < sessions; s++) {
+        SynthSession session;
+        session.profile = profile;
+        session.random.state = (uint64_t)seed * 0x100000001B3ull + (uint64_t)s;
+        SynthRandom& random = session.random;
+        session.position = random.range(0, pipeline::RAW_MAX);
+        session.mainsHz = (int)mains;
+        session.lastPosition = session.position;
+
+        int moves = random.range(3, 12);
+        for (int m = 0; m < moves; m++) {
+            if (random.range(0, 3) == 0) {
+                // Pause near the target without meaning to stop there
+                session.moveTo(targetRaw + random.range(-250, 250));
+                session.emit(random.range(1, 8));
+            } else {
+                session.moveTo(awayFromTarget(random, targetRaw));
+                session.emit(random.range(5, 60));
+            }
+        }
+
+        int32_t expected = TRACE_NO_SOLVE;
+        if (random.range(0, 4) != 0) {
+            // Park on the target
+            session.moveTo(targetRaw + random.range(-40, 40));
+            expected = (int32_t)session.samples.size();
+            session.emit(random.range(100, 200));
+        } else {
+            session.moveTo(awayFromTarget(random, targetRaw));
+            session.emit(40);
+        }
+
+        uint32_t periodUs = (mains != 0) ? CONVERSION_PERIOD_US : DEFAULT_PERIOD_US;
+        TraceHeader header = makeTraceHeader(compass.c_str(), target, periodUs, (uint32_t)session.samples.size());
+        header.expectedSolve = expected;
+        if (mains != 0) {
+            header.mainsHz = (uint8_t)mains;
+            header.firDecimation = CONVERSION_DECIMATION;
+        }
+        if (!writer.write(header, session.samples.data())) {
+            perror(out);
+            return 1;
+        }
+    }
+    if (!writer.close()) {
+        perror(out);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        usage();
+        return 2;
+    }
+    if (strcmp(argv[1], "info") == 0) return runInfo(argc - 2, argv + 2);
+    if (strcmp(argv[1], "pack") == 0) return runPack(argc - 2, argv + 2);
+    if (strcmp(argv[1], "synth") == 0) return runSynth(argc - 2, argv + 2);
+    usage();
+    return 2;
+}
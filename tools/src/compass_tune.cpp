@@ -0,0 +1,341 @@
+// compass_tune: search tracker and puzzle parameters per compass over
+// recorded traces and write a tuning.h for each firmware project
+//
+//   compass_tune --out '../%s/config/tuning.h' traces/
+//
+// A coarse grid over the whole range finds the neighbourhood, then a
+// pattern search refines it: try every combination one step either side
+// of the best set, move to the best, and halve the steps once nothing
+// nearby is better.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <CompassPipeline.h>
+
+#include "Args.h"
+#include "Sweep.h"
+
+// Current hand-picked firmware defaults, for comparison
+const PipelineParams HAND_PICKED = {
+    pipeline::FILTER_ALPHA_DEFAULT, 10, 2, 500, pipeline::TRACKER_BETA_DEFAULT, pipeline::SETTLE_SPEED_DEFAULT,
+};
+
+// Search range and the smallest step worth taking per parameter. Ranges
+// stay inside what the firmware's SET command accepts.
+struct Range {
+    int low;
+    int high;
+    int coarseStep;
+    int minStep;
+};
+
+struct SearchSpace {
+    Range alpha = { 16, 256, 32, 4 };
+    Range tolerance = { 2, 30, 4, 1 };
+    Range threshold = { 1, 5, 1, 1 };
+    Range debounceMs = { 0, 3000, 250, 25 };
+    Range beta = { 0, pipeline::TRACKER_BETA_MAX, 32, 2 };
+};
+
+struct Weights {
+    double falseSolve = 20;  // Per false solve per session
+    double missed = 20;  // Per missed solve per solvable session
+    double latency = 1;  // Per second of mean solve latency
+    double messages = 0.002;  // Per direction message per minute
+};
+
+static double cost(const SweepTotals& totals, const Weights& weights) {
+    double missRate = totals.expectedSolves > 0 ? (double)totals.missed / totals.expectedSolves : 0;
+    return weights.falseSolve * totals.falseSolveRate() +
+        weights.missed * missRate +
+        weights.latency * totals.meanLatencyMs() / 1000.0 +
+        weights.messages * totals.reportsPerMinute();
+}
+
+static int clampTo(const Range& range, int value) {
+    return std::max(range.low, std::min(range.high, value));
+}
+
+static std::vector<int> coarseValues(const Range& range) {
+    std::vector<int> values;
+    for (int value = range.low; value <= range.high; value += range.coarseStep) {
+        values.push_back(value);
+    }
+    if (values.back() != range.high) values.push_back(range.high);
+    return values;
+}
+
+struct Candidate {
+    PipelineParams params;
+    SweepTotals totals;
+    double score;
+};
+
+struct Tuner {
+    const std::vector<Trace>* traces;
+    SearchSpace space;
+    Weights weights;
+    SweepOptions options;
+    uint64_t evaluated = 0;
+
+    // Scores each set, best first. Ties keep the earlier set so the search
+    // is repeatable.
+    std::vector<Candidate> score(const std::vector<PipelineParams>& params) {
+        SweepReport report = runSweep(*traces, params, options);
+        evaluated += params.size();
+        std::vector<Candidate> candidates;
+        for (size_t p = 0; p < params.size(); p++) {
+            candidates.push_back({ params[p], report.totals[p], cost(report.totals[p], weights) });
+        }
+        std::stable_sort(candidates.begin(), candidates.end(),
+            [](const Candidate& a, const Candidate& b) { return a.score < b.score; });
+        return candidates;
+    }
+
+    Candidate search() {
+        std::vector<PipelineParams> grid;
+        for (int alpha : coarseValues(space.alpha)) {
+            for (int tolerance : coarseValues(space.tolerance)) {
+                for (int threshold : coarseValues(space.threshold)) {
+                    for (int debounce : coarseValues(space.debounceMs)) {
+                        for (int beta : coarseValues(space.beta)) {
+                            grid.push_back({ alpha, tolerance, threshold, debounce, beta, pipeline::SETTLE_SPEED_DEFAULT });
+                        }
+                    }
+                }
+            }
+        }
+        Candidate best = score(grid).front();
+
+        int steps[5] = {
+            space.alpha.coarseStep / 2, space.tolerance.coarseStep / 2,
+            space.threshold.coarseStep / 2, space.debounceMs.coarseStep / 2, space.beta.coarseStep / 2,
+        };
+        const Range* ranges[5] = { &space.alpha, &space.tolerance, &space.threshold, &space.debounceMs, &space.beta };
+        for (int d = 0; d < 5; d++) {
+            steps[d] = std::max(steps[d], ranges[d]->minStep);
+        }
+
+        for (;;) {
+            // Every combination of -step, 0, +step around the best set
+            std::vector<PipelineParams> neighbours;
+            neighbours.push_back(best.params);
+            for (int combo = 0; combo < 243; combo++) {
+                int offset[5];
+                int code = combo;
+                for (int d = 0; d < 5; d++) {
+                    offset[d] = (code % 3 - 1) * steps[d];
+                    code /= 3;
+                }
+                PipelineParams next = {
+                    clampTo(space.alpha, best.params.filterAlpha + offset[0]),
+                    clampTo(space.tolerance, best.params.tolerance + offset[1]),
+                    clampTo(space.threshold, best.params.threshold + offset[2]),
+                    clampTo(space.debounceMs, best.params.debounceMs + offset[3]),
+                    clampTo(space.beta, best.params.trackerBeta + offset[4]),
+                    best.params.settleSpeed,
+                };
+                neighbours.push_back(next);
+            }
+
+            Candidate found = score(neighbours).front();
+            if (found.score < best.score) {
+                best = found;
+                continue;
+            }
+
+            bool refined = false;
+            for (int d = 0; d < 5; d++) {
+                if (steps[d] > ranges[d]->minStep) {
+                    steps[d] = std::max(steps[d] / 2, ranges[d]->minStep);
+                    refined = true;
+                }
+            }
+            if (!refined) return best;
+        }
+    }
+};
+
+static void printCandidate(const char* label, const Candidate& candidate) {
+    const PipelineParams& params = candidate.params;
+    const SweepTotals& totals = candidate.totals;
+    printf("  %-12s alpha %3d  beta %3d  tolerance %2d  threshold %2d  debounce %4d ms | "
+        "false %5.1f%%  missed %5.1f%%  latency %6.1f ms  %6.1f msg/min  score %.3f\n",
+        label, params.filterAlpha, params.trackerBeta, params.tolerance, params.threshold, params.debounceMs,
+        100.0 * totals.falseSolveRate(),
+        totals.expectedSolves > 0 ? 100.0 * totals.missed / totals.expectedSolves : 0.0,
+        totals.meanLatencyMs(), totals.reportsPerMinute(), candidate.score);
+}
+
+static bool writeTuning(const std::string& path, const std::string& compass, const Candidate& best) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == NULL) return false;
+    const PipelineParams& params = best.params;
+    const SweepTotals& totals = best.totals;
+    fprintf(file,
+        "// Generated by tools/compass_tune for %s from %u recorded sessions.\n"
+        "// Re-run the tuner instead of editing; delete the file to go back to\n"
+        "// the defaults in lib/CompassFirmware.\n"
+        "//\n"
+        "// False solves %.1f%%, missed %.1f%%, mean solve latency %.0f ms,\n"
+        "// %.0f direction messages per minute\n"
+        "\n"
+        "#pragma once\n"
+        "\n"
+        "#define TUNED_DIRECTION_TOLERANCE %d\n"
+        "#define TUNED_ANGLE_CHANGE_THRESHOLD %d\n"
+        "#define TUNED_DEBOUNCE_TIME %d\n"
+        "#define TUNED_FILTER_ALPHA %d\n"
+        "#define TUNED_TRACKER_BETA %d\n",
+        compass.c_str(), totals.sessions,
+        100.0 * totals.falseSolveRate(),
+        totals.expectedSolves > 0 ? 100.0 * totals.missed / totals.expectedSolves : 0.0,
+        totals.meanLatencyMs(), totals.reportsPerMinute(),
+        params.tolerance, params.threshold, params.debounceMs, params.filterAlpha, params.trackerBeta);
+    return fclose(file) == 0;
+}
+
+static void usage() {
+    fprintf(stderr,
+        "usage: compass_tune [options] TRACE|DIR...\n"
+        "  --out PATTERN         write a tuning header per compass; %%s = compass name\n"
+        "                        (e.g. '../%%s/config/tuning.h'); default prints them\n"
+        "  --compass NAME        only tune this compass\n"
+        "  --alpha LO:HI         search range (default 16:256)\n"
+        "  --tolerance LO:HI     (default 2:30)\n"
+        "  --threshold LO:HI     (default 1:5)\n"
+        "  --debounce LO:HI      ms (default 0:3000)\n"
+        "  --beta LO:HI          tracker velocity gain (default 0:128)\n"
+        "  --false-weight W      cost per false solve per session (default 20)\n"
+        "  --miss-weight W       cost per missed solve per solvable session (default 20)\n"
+        "  --latency-weight W    cost per second of mean solve latency (default 1)\n"
+        "  --message-weight W    cost per direction message per minute (default 0.002)\n"
+        "  --threads N           worker threads (default: one per core)\n"
+        "  --scalar              don't use AVX2\n");
+}
+
+static bool parseRangeArg(const char* text, Range& range) {
+    std::string span = text;
+    size_t colon = span.find(':');
+    if (colon == std::string::npos) return false;
+    long low, high;
+    if (!parseInt(span.substr(0, colon).c_str(), low) || !parseInt(span.substr(colon + 1).c_str(), high)) return false;
+    if (low > high) return false;
+    range.low = (int)low;
+    range.high = (int)high;
+    return true;
+}
+
+static bool parseWeight(const char* text, double& weight) {
+    char* end;
+    weight = strtod(text, &end);
+    return end != text && *end == '\0' && weight >= 0;
+}
+
+int main(int argc, char** argv) {
+    Tuner base;
+    std::vector<std::string> paths;
+    std::string compassFilter;
+    std::string outPattern;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        bool ok = true;
+        long value;
+        if (strcmp(arg, "--out") == 0 && hasValue) {
+            outPattern = argv[++i];
+            ok = (outPattern.find("%s") != std::string::npos);
+        } else if (strcmp(arg, "--compass") == 0 && hasValue) {
+            compassFilter = argv[++i];
+        } else if (strcmp(arg, "--alpha") == 0 && hasValue) {
+            ok = parseRangeArg(argv[++i], base.space.alpha) &&
+                base.space.alpha.low >= 1 && base.space.alpha.high <= pipeline::FILTER_ALPHA_ONE;
+        } else if (strcmp(arg, "--tolerance") == 0 && hasValue) {
+            ok = parseRangeArg(argv[++i], base.space.tolerance) &&
+                base.space.tolerance.low >= 1 && base.space.tolerance.high <= 90;
+        } else if (strcmp(arg, "--threshold") == 0 && hasValue) {
+            ok = parseRangeArg(argv[++i], base.space.threshold) &&
+                base.space.threshold.low >= 1 && base.space.threshold.high <= 45;
+        } else if (strcmp(arg, "--debounce") == 0 && hasValue) {
+            ok = parseRangeArg(argv[++i], base.space.debounceMs) &&
+                base.space.debounceMs.low >= 0 && base.space.debounceMs.high <= 60000;
+        } else if (strcmp(arg, "--beta") == 0 && hasValue) {
+            ok = parseRangeArg(argv[++i], base.space.beta) &&
+                base.space.beta.low >= 0 && base.space.beta.high <= pipeline::TRACKER_BETA_MAX;
+        } else if (strcmp(arg, "--false-weight") == 0 && hasValue) {
+            ok = parseWeight(argv[++i], base.weights.falseSolve);
+        } else if (strcmp(arg, "--miss-weight") == 0 && hasValue) {
+            ok = parseWeight(argv[++i], base.weights.missed);
+        } else if (strcmp(arg, "--latency-weight") == 0 && hasValue) {
+            ok = parseWeight(argv[++i], base.weights.latency);
+        } else if (strcmp(arg, "--message-weight") == 0 && hasValue) {
+            ok = parseWeight(argv[++i], base.weights.messages);
+        } else if (strcmp(arg, "--threads") == 0 && hasValue) {
+            ok = parseInt(argv[++i], value) && value > 0;
+            base.options.threads = (int)value;
+        } else if (strcmp(arg, "--scalar") == 0) {
+            base.options.useSimd = false;
+        } else if (arg[0] == '-') {
+            usage();
+            return 2;
+        } else {
+            paths.push_back(arg);
+        }
+        if (!ok) {
+            fprintf(stderr, "compass_tune: bad value for %s\n", arg);
+            return 2;
+        }
+    }
+    if (paths.empty()) {
+        usage();
+        return 2;
+    }
+
+    TraceSet set;
+    std::string error;
+    if (!loadTraces(paths, compassFilter, set, error)) {
+        fprintf(stderr, "compass_tune: %s\n", error.c_str());
+        return 1;
+    }
+
+    // Each prop is tuned on its own sessions only
+    std::map<std::string, std::vector<Trace>> byCompass;
+    for (const Trace& trace : set.traces) {
+        byCompass[traceCompass(*trace.header)].push_back(trace);
+    }
+    if (byCompass.empty()) {
+        fprintf(stderr, "compass_tune: no traces\n");
+        return 1;
+    }
+
+    for (const auto& entry : byCompass) {
+        const std::string& compass = entry.first;
+        Tuner tuner = base;
+        tuner.traces = &entry.second;
+
+        Candidate handPicked = tuner.score({ HAND_PICKED }).front();
+        Candidate best = tuner.search();
+
+        printf("%s: %zu sessions, %llu parameter sets evaluated\n",
+            compass.c_str(), entry.second.size(), (unsigned long long)tuner.evaluated);
+        printCandidate("hand-picked", handPicked);
+        printCandidate("tuned", best);
+
+        if (outPattern.empty()) continue;
+        std::string path = outPattern;
+        path.replace(path.find("%s"), 2, compass);
+        if (!writeTuning(path, compass, best)) {
+            perror(path.c_str());
+            return 1;
+        }
+        printf("  wrote %s\n", path.c_str());
+    }
+    return 0;
+}